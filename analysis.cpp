@@ -0,0 +1,448 @@
+#include "analysis.h"
+
+#include <boost/dynamic_bitset.hpp>
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace analysis
+{
+namespace
+{
+    using namespace ast;
+
+    // A bit per variable and array, all bits are set while the statement isn't reached
+    using State = boost::dynamic_bitset<>;
+
+    // Statements are the nodes of the flow graph, the statements of IF branches are
+    // separate nodes. Line heads and the end of the program have no statement.
+    struct Node
+    {
+        const Stmt* pStmt = nullptr;
+        linenum_t line = 0;
+        std::vector<size_t> succ;
+        std::vector<size_t> calls;              // GOSUB and ON GOSUB, the heads of the called lines
+        std::optional<size_t> returnPoint;      // GOSUB, the statement after it
+        std::vector<size_t> returns;            // GOSUB, the RETURN statements that may come back
+    };
+
+    // Every DEF of the program by the function name, any of them may be called
+    using FnDefs = std::multimap<std::string, const DefFn*>;
+
+    // Calls fnc( name, isArray, defines ) for the variables used by the statement in the
+    // order of evaluation. Writing an element defines nothing, it needs DIM of the array.
+    // The branches of IF are separate statements, so they aren't visited. A FN call reads
+    // the variables the bodies of the function read, except the argument.
+    template<class AccessFnc>
+    class AccessVisitor
+    {
+    public:
+        AccessVisitor( AccessFnc& fnc, const FnDefs& fnDefs ) :
+            mFnc{ fnc }, mFnDefs{ fnDefs }
+        {
+        }
+
+        void operator()( const Nop& ) const {}
+        void operator()( const Goto& ) const {}
+        void operator()( const Gosub& ) const {}
+        void operator()( const Return& ) const {}
+        void operator()( const Next& ) const {}
+        void operator()( const End& ) const {}
+        void operator()( const Restore& ) const {}
+        void operator()( const DefFn& ) const {}
+
+        void operator()( const Print& stmt ) const
+        {
+            for( const auto& item : stmt.items )
+                Use( *item.value );
+        }
+
+        void operator()( const Input& stmt ) const
+        {
+            for( const auto& item : stmt.items )
+                Assign( item.var );
+        }
+
+        void operator()( const Assign& stmt ) const
+        {
+            for( const auto& idx : stmt.var.indices )
+                Use( *idx );
+
+            Use( *stmt.value );
+            Target( stmt.var );
+        }
+
+        void operator()( const Dim& stmt ) const
+        {
+            for( const auto& item : stmt.items )
+            {
+                for( const auto& dim : item.dimensions )
+                    Use( *dim );
+
+                mFnc( item.name, !item.dimensions.empty(), true );
+            }
+        }
+
+        void operator()( const On& stmt ) const
+        {
+            Use( *stmt.index );
+        }
+
+        void operator()( const If& stmt ) const
+        {
+            Use( *stmt.cond );
+        }
+
+        void operator()( const For& stmt ) const
+        {
+            for( const auto& idx : stmt.var.indices )
+                Use( *idx );
+
+            Use( *stmt.initVal );
+            Use( *stmt.targetVal );
+            Use( *stmt.stepVal );
+            Target( stmt.var );
+        }
+
+        void operator()( const Read& stmt ) const
+        {
+            for( const auto& var : stmt.vars )
+                Assign( var );
+        }
+
+        void operator()( const Randomize& stmt ) const
+        {
+            Use( *stmt.seed );
+        }
+
+    private:
+        void Use( const Expr& expr ) const
+        {
+            for( const auto& arg : expr.args )
+                Use( *arg );
+
+            if( expr.op == Op::Var || expr.op == Op::ArrayElem )
+            {
+                // The argument of the function being visited
+                if( expr.op == Op::Var && !mCalls.empty() && expr.name == mCalls.back()->varName )
+                    return;
+
+                mFnc( expr.name, expr.op == Op::ArrayElem, false );
+            }
+            else if( expr.op == Op::CallFn )
+            {
+                const auto [begin, end] = mFnDefs.equal_range( expr.name );
+
+                for( auto it = begin; it != end; ++it )
+                {
+                    // Recursive calls never finish anyway
+                    if( std::find( mCalls.begin(), mCalls.end(), it->second ) != mCalls.end() )
+                        continue;
+
+                    mCalls.push_back( it->second );
+                    Use( *it->second->body );
+                    mCalls.pop_back();
+                }
+            }
+        }
+
+        void Target( const VarRef& var ) const
+        {
+            mFnc( var.name, !var.indices.empty(), var.indices.empty() );
+        }
+
+        void Assign( const VarRef& var ) const
+        {
+            for( const auto& idx : var.indices )
+                Use( *idx );
+
+            Target( var );
+        }
+
+        AccessFnc& mFnc;
+        const FnDefs& mFnDefs;
+        mutable std::vector<const DefFn*> mCalls;       // The bodies being visited
+    };
+
+    template<class AccessFnc>
+    void VisitAccesses( const Stmt& stmt, const FnDefs& fnDefs, AccessFnc&& fnc )
+    {
+        std::visit( AccessVisitor<AccessFnc>{ fnc, fnDefs }, static_cast<const Stmt::variant&>(stmt) );
+    }
+
+    class Analyzer
+    {
+    public:
+        explicit Analyzer( const Program& program );
+
+        std::vector<Diagnostic> Run();
+
+    private:
+        size_t AddNode( const Stmt* pStmt, linenum_t line );
+        size_t Build( const Stmt& stmt, linenum_t line, size_t next, size_t nextLine );
+        std::optional<size_t> BuildBranch( const Branch& branch, linenum_t line, size_t next, size_t nextLine );
+        std::optional<size_t> FindLine( linenum_t line ) const;
+        std::vector<size_t> FindReturns( const std::vector<size_t>& entries ) const;
+
+        void Transfer( const Node& node, State& state, std::vector<Diagnostic>* pDiagnostics ) const;
+
+    private:
+        const Program& mProgram;
+        std::vector<Node> mNodes;
+        std::vector<size_t> mLineHeads;
+        std::map<std::pair<std::string, bool>, size_t> mIds;     // By the name and whether it's an array
+        FnDefs mFnDefs;
+        size_t mStart = 0;
+    };
+
+    Analyzer::Analyzer( const Program& program ) :
+        mProgram{ program }
+    {
+        for( const auto& line : program.lines )
+            mLineHeads.push_back( AddNode( nullptr, line.num ) );
+
+        const size_t end = AddNode( nullptr, runtime::MaxLineNum );
+        mStart = mLineHeads.empty() ? end : mLineHeads.front();
+
+        for( size_t n = 0; n < program.lines.size(); ++n )
+        {
+            const auto& line = program.lines[n];
+            const size_t nextLine = n + 1 < mLineHeads.size() ? mLineHeads[n + 1] : end;
+            size_t next = nextLine;
+
+            for( auto it = line.statements.rbegin(); it != line.statements.rend(); ++it )
+                next = Build( **it, line.num, next, nextLine );
+
+            mNodes[mLineHeads[n]].succ.push_back( next );
+        }
+
+        for( auto& node : mNodes )
+            if( node.returnPoint )
+                node.returns = FindReturns( node.calls );
+
+        for( const auto& node : mNodes )
+            if( const auto* pDef = node.pStmt ? std::get_if<DefFn>( static_cast<const Stmt::variant*>(node.pStmt) ) : nullptr )
+                mFnDefs.emplace( pDef->name, pDef );
+
+        for( const auto& node : mNodes )
+        {
+            if( !node.pStmt )
+                continue;
+
+            VisitAccesses( *node.pStmt, mFnDefs, [this]( const std::string& name, bool isArray, bool ) {
+                mIds.try_emplace( { name, isArray }, mIds.size() );
+            } );
+        }
+    }
+
+    size_t Analyzer::AddNode( const Stmt* pStmt, linenum_t line )
+    {
+        mNodes.push_back( Node{ pStmt, line } );
+
+        return mNodes.size() - 1;
+    }
+
+    std::optional<size_t> Analyzer::FindLine( linenum_t line ) const
+    {
+        const auto& lines = mProgram.lines;
+        const auto it = std::lower_bound( lines.begin(), lines.end(), line, []( const Line& l, linenum_t num ) { return l.num < num; } );
+
+        //A jump to a missing line fails
+        if( it == lines.end() || it->num != line )
+            return std::nullopt;
+
+        return mLineHeads[it - lines.begin()];
+    }
+
+    // The RETURN statements reachable from the entries without the ones of the nested GOSUB.
+    // A NEXT going back to a loop started before the GOSUB isn't followed, the bodies of
+    // the loops started inside are reached anyway.
+    std::vector<size_t> Analyzer::FindReturns( const std::vector<size_t>& entries ) const
+    {
+        std::vector<size_t> res;
+        std::vector<char> visited( mNodes.size() );
+        std::vector<size_t> toVisit = entries;
+
+        while( !toVisit.empty() )
+        {
+            const size_t idx = toVisit.back();
+            toVisit.pop_back();
+
+            if( visited[idx] )
+                continue;
+
+            visited[idx] = true;
+
+            const Node& node = mNodes[idx];
+
+            if( node.pStmt && std::holds_alternative<Return>( *node.pStmt ) )
+                res.push_back( idx );
+
+            toVisit.insert( toVisit.end(), node.succ.begin(), node.succ.end() );
+
+            if( node.returnPoint )
+                toVisit.push_back( *node.returnPoint );
+        }
+
+        return res;
+    }
+
+    // See codegen::Emitter::EmitStatement(), the flow is the same
+    size_t Analyzer::Build( const Stmt& stmt, linenum_t line, size_t next, size_t nextLine )
+    {
+        const size_t res = AddNode( &stmt, line );
+        std::vector<std::optional<size_t>> succ;
+        std::vector<std::optional<size_t>> calls;
+
+        if( const auto* pGoto = std::get_if<Goto>( &stmt ) )
+        {
+            succ.push_back( FindLine( pGoto->line ) );
+        }
+        else if( const auto* pGosub = std::get_if<Gosub>( &stmt ) )
+        {
+            calls.push_back( FindLine( pGosub->line ) );
+            mNodes[res].returnPoint = next;
+        }
+        else if( const auto* pOn = std::get_if<On>( &stmt ) )
+        {
+            // An index out of range goes to the next statement, so after ON GOSUB only the
+            // variables assigned before it are known
+            for( linenum_t target : pOn->lines )
+                (pOn->gosub ? calls : succ).push_back( FindLine( target ) );
+
+            succ.push_back( next );
+        }
+        else if( const auto* pIf = std::get_if<If>( &stmt ) )
+        {
+            // A false condition without ELSE skips the rest of the line
+            succ.push_back( BuildBranch( pIf->then, line, next, nextLine ) );
+            succ.push_back( pIf->otherwise ? BuildBranch( *pIf->otherwise, line, next, nextLine ) : nextLine );
+        }
+        else if( !std::holds_alternative<Return>( stmt ) && !std::holds_alternative<End>( stmt ) )
+        {
+            // The FOR bodies start after the FOR statement and everything assigned before
+            // it stays assigned when NEXT goes back, so NEXT only goes further
+            succ.push_back( next );
+        }
+
+        for( const auto& s : succ )
+            if( s )
+                mNodes[res].succ.push_back( *s );
+
+        for( const auto& c : calls )
+            if( c )
+                mNodes[res].calls.push_back( *c );
+
+        return res;
+    }
+
+    std::optional<size_t> Analyzer::BuildBranch( const Branch& branch, linenum_t line, size_t next, size_t nextLine )
+    {
+        if( const auto* pLine = std::get_if<linenum_t>( &branch ) )
+            return FindLine( *pLine );
+
+        return Build( *std::get<StmtPtr>( branch ), line, next, nextLine );
+    }
+
+    void Analyzer::Transfer( const Node& node, State& state, std::vector<Diagnostic>* pDiagnostics ) const
+    {
+        if( !node.pStmt )
+            return;
+
+        VisitAccesses( *node.pStmt, mFnDefs, [&]( const std::string& name, bool isArray, bool defines ) {
+            const size_t id = mIds.at( { name, isArray } );
+
+            if( defines )
+                state.set( id );
+            else if( pDiagnostics && !state.test( id ) )
+                pDiagnostics->push_back( { isArray ? Diagnostic::Kind::ArrayBeforeDim : Diagnostic::Kind::UninitializedVar, node.line, name } );
+        } );
+    }
+
+    std::vector<Diagnostic> Analyzer::Run()
+    {
+        // Must-be-assigned analysis, the states only lose bits until nothing changes
+        std::vector<State> in( mNodes.size(), State( mIds.size() ).set() );
+        in[mStart].reset();
+
+        for( bool changed = true; changed; )
+        {
+            changed = false;
+
+            const auto merge = [&in, &changed]( size_t idx, const State& state ) {
+                const State res = in[idx] & state;
+
+                if( res != in[idx] )
+                {
+                    in[idx] = res;
+                    changed = true;
+                }
+            };
+
+            for( size_t n = 0; n < mNodes.size(); ++n )
+            {
+                const Node& node = mNodes[n];
+                State out = in[n];
+                Transfer( node, out, nullptr );
+
+                for( size_t s : node.succ )
+                    merge( s, out );
+
+                for( size_t c : node.calls )
+                    merge( c, out );
+
+                // Nothing is unassigned by the subroutine, so it adds what all its RETURN know
+                if( node.returnPoint )
+                {
+                    State returned = State( mIds.size() ).set();
+
+                    for( size_t r : node.returns )
+                        returned &= in[r];
+
+                    merge( *node.returnPoint, out | returned );
+                }
+            }
+        }
+
+        std::vector<Diagnostic> res;
+
+        for( size_t n = 0; n < mNodes.size(); ++n )
+            Transfer( mNodes[n], in[n], &res );
+
+        std::sort( res.begin(), res.end(), []( const Diagnostic& d1, const Diagnostic& d2 ) {
+            return std::tie( d1.line, d1.name, d1.kind ) < std::tie( d2.line, d2.name, d2.kind );
+        } );
+
+        res.erase( std::unique( res.begin(), res.end() ), res.end() );
+
+        return res;
+    }
+}
+
+std::vector<Diagnostic> AnalyzeProgram( const ast::Program& program )
+{
+    return Analyzer{ program }.Run();
+}
+
+void PrintDiagnostics( const std::vector<Diagnostic>& diagnostics, std::ostream& os )
+{
+    for( const auto& diag : diagnostics )
+    {
+        os << diag.line << '\t';
+
+        switch( diag.kind )
+        {
+        case Diagnostic::Kind::UninitializedVar:
+            os << "Variable may be used before initialization: " << diag.name << '\n';
+            break;
+
+        case Diagnostic::Kind::ArrayBeforeDim:
+            os << "Array element may be accessed before DIM: " << diag.name << '\n';
+            break;
+        }
+    }
+}
+
+}
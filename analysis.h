@@ -0,0 +1,46 @@
+#ifndef BASIC_INT_ANALYSIS_H
+#define BASIC_INT_ANALYSIS_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+
+namespace analysis
+{
+    using runtime::linenum_t;
+
+    struct Diagnostic
+    {
+        enum class Kind
+        {
+            UninitializedVar,   // May be read before any assignment, READ, INPUT or FOR
+            ArrayBeforeDim      // An element may be read or written before the DIM of the array
+        };
+
+        Kind kind;
+        linenum_t line;
+        std::string name;       // Lower case, without indices
+
+        bool operator==( const Diagnostic& other ) const
+        {
+            return kind == other.kind && line == other.line && name == other.name;
+        }
+    };
+
+    // Load time dataflow check of the whole program. A variable is proven to be initialized
+    // at a statement if it's assigned on every path from the start of the program, an array
+    // if it's DIMmed on every path. The paths go through GOTO, IF, ON and the FOR bodies.
+    // After GOSUB come the variables assigned before it or on every path of the subroutine
+    // to a RETURN. A FN call reads the variables its bodies read, except the argument.
+    // The rest of the accesses are returned sorted by line, one per variable and line.
+    // Unreachable lines aren't reported, neither are elements out of the DIM ranges,
+    // they depend on the values of the indices.
+    std::vector<Diagnostic> AnalyzeProgram( const ast::Program& program );
+
+    // One line per diagnostic: the line number and the message
+    void PrintDiagnostics( const std::vector<Diagnostic>& diagnostics, std::ostream& os );
+}
+
+#endif // BASIC_INT_ANALYSIS_H
@@ -0,0 +1,225 @@
+#include "ast.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <cassert>
+#include <stdexcept>
+
+namespace ast
+{
+namespace
+{
+    bool IsPure( const std::vector<ExprPtr>& args )
+    {
+        for( const auto& arg : args )
+            if( !arg->pure )
+                return false;
+
+        return true;
+    }
+
+    std::shared_ptr<Expr> MakeExpr( Op op, ValueType type, std::vector<ExprPtr> args )
+    {
+        const bool pure = op != Op::Rnd && op != Op::Inkey && op != Op::CallFn && IsPure( args );
+
+        return std::make_shared<Expr>( Expr{ op, type, pure, value_t{}, std::string{}, std::move( args ) } );
+    }
+}
+
+ExprPtr RequireNumber( ExprPtr expr )
+{
+    if( expr->type == ValueType::Str )
+        throw std::runtime_error( "Cannot be string" );
+
+    return expr;
+}
+
+ExprPtr RequireStr( ExprPtr expr )
+{
+    if( expr->type != ValueType::Str )
+        throw std::runtime_error( "Must be string" );
+
+    return expr;
+}
+
+ExprPtr RequireAssignable( const VarRef& var, ExprPtr expr )
+{
+    if( var.type == ValueType::Str && expr->type != ValueType::Str )
+        throw std::runtime_error( "Expected String variable" );
+
+    return var.type == ValueType::Str ? std::move( expr ) : RequireNumber( std::move( expr ) );
+}
+
+ExprPtr MakeConst( value_t value )
+{
+    struct Visitor
+    {
+        ValueType operator()( int_t ) const { return ValueType::Int; }
+        ValueType operator()( float_t ) const { return ValueType::Float; }
+        ValueType operator()( const str_t& ) const { return ValueType::Str; }
+    };
+
+    const ValueType type = boost::apply_visitor( Visitor{}, value );
+
+    return std::make_shared<const Expr>( Expr{ Op::Const, type, true, std::move( value ), std::string{}, {} } );
+}
+
+VarRef MakeVarRef( std::string name, std::vector<ExprPtr> indices )
+{
+    boost::algorithm::to_lower( name );
+
+    for( const auto& idx : indices )
+        RequireNumber( idx );
+
+    const ValueType type = runtime::DetectVarType( name );
+
+    return VarRef{ std::move( name ), std::move( indices ), type };
+}
+
+ExprPtr MakeVar( VarRef var )
+{
+    const Op op = var.indices.empty() ? Op::Var : Op::ArrayElem;
+    auto res = MakeExpr( op, var.type, std::move( var.indices ) );
+    res->name = std::move( var.name );
+
+    return res;
+}
+
+ExprPtr MakeUnary( Op op, ExprPtr arg )
+{
+    switch( op )
+    {
+    case Op::Neg:
+        return MakeExpr( op, ValueType::Float, { RequireNumber( std::move( arg ) ) } );
+
+    case Op::Not:
+        return MakeExpr( op, ValueType::Int, { RequireNumber( std::move( arg ) ) } );
+
+    default:
+        throw std::logic_error( "Not an unary operation" );
+    }
+}
+
+ExprPtr MakeBinary( Op op, ExprPtr lhs, ExprPtr rhs )
+{
+    const bool bothStr = lhs->type == ValueType::Str && rhs->type == ValueType::Str;
+
+    switch( op )
+    {
+    case Op::Add:
+        //Strings may also be concatenated through the use of the "+" operator
+        if( bothStr )
+            return MakeExpr( op, ValueType::Str, { std::move( lhs ), std::move( rhs ) } );
+
+        return MakeExpr( op, ValueType::Float, { RequireNumber( std::move( lhs ) ), RequireNumber( std::move( rhs ) ) } );
+
+    case Op::Sub:
+    case Op::Mul:
+    case Op::Div:
+    case Op::Pow:
+        return MakeExpr( op, ValueType::Float, { RequireNumber( std::move( lhs ) ), RequireNumber( std::move( rhs ) ) } );
+
+    case Op::Eq:
+    case Op::NotEq:
+        if( bothStr )
+            return MakeExpr( op, ValueType::Int, { std::move( lhs ), std::move( rhs ) } );
+
+        [[fallthrough]];
+
+    case Op::Less:
+    case Op::Greater:
+    case Op::LessEq:
+    case Op::GreaterEq:
+    case Op::And:
+    case Op::Or:
+        return MakeExpr( op, ValueType::Int, { RequireNumber( std::move( lhs ) ), RequireNumber( std::move( rhs ) ) } );
+
+    default:
+        throw std::logic_error( "Not a binary operation" );
+    }
+}
+
+ExprPtr MakeCall( Op op, std::vector<ExprPtr> args )
+{
+    const auto arg = [&args]( size_t i ) -> ExprPtr& {
+        assert( i < args.size() );
+        return args[i];
+    };
+
+    switch( op )
+    {
+    case Op::Sqr:
+    case Op::Abs:
+    case Op::Rnd:
+        RequireNumber( arg( 0 ) );
+        return MakeExpr( op, ValueType::Float, std::move( args ) );
+
+    case Op::Int:
+        RequireNumber( arg( 0 ) );
+        return MakeExpr( op, ValueType::Int, std::move( args ) );
+
+    case Op::Left:
+    case Op::Right:
+    case Op::Mid:
+        RequireStr( arg( 0 ) );
+
+        for( size_t i = 1; i < args.size(); ++i )
+            RequireNumber( arg( i ) );
+
+        return MakeExpr( op, ValueType::Str, std::move( args ) );
+
+    case Op::Str:
+        arg( 0 );
+        return MakeExpr( op, ValueType::Str, std::move( args ) );
+
+    case Op::Val:
+        RequireStr( arg( 0 ) );
+        return MakeExpr( op, ValueType::Float, std::move( args ) );
+
+    case Op::Len:
+    case Op::Asc:
+        RequireStr( arg( 0 ) );
+        return MakeExpr( op, ValueType::Int, std::move( args ) );
+
+    case Op::Chr:
+        RequireNumber( arg( 0 ) );
+        return MakeExpr( op, ValueType::Str, std::move( args ) );
+
+    case Op::Inkey:
+        return MakeExpr( op, ValueType::Str, std::move( args ) );
+
+    default:
+        throw std::logic_error( "Not a function call" );
+    }
+}
+
+ValueType GetFnType( std::string_view name )
+{
+    return runtime::DetectVarType( name ) == ValueType::Str ? ValueType::Str : ValueType::Float;
+}
+
+ExprPtr MakeFnCall( std::string name, ExprPtr arg )
+{
+    boost::algorithm::to_lower( name );
+
+    auto res = MakeExpr( Op::CallFn, GetFnType( name ), { std::move( arg ) } );
+    res->name = std::move( name );
+
+    return res;
+}
+
+void ForEachStmt( const Stmt& stmt, const std::function<void( const Stmt& )>& fnc )
+{
+    fnc( stmt );
+
+    const auto* const pIf = std::get_if<If>( &stmt );
+
+    if( !pIf )
+        return;
+
+    for( const Branch* pBranch : { &pIf->then, pIf->otherwise ? &*pIf->otherwise : nullptr } )
+        if( pBranch )
+            if( const auto* pStmt = std::get_if<StmtPtr>( pBranch ) )
+                ForEachStmt( **pStmt, fnc );
+}
+
+}
@@ -0,0 +1,157 @@
+#ifndef BASIC_INT_AST_H
+#define BASIC_INT_AST_H
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <variant>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include "value.h"
+
+namespace runtime
+{
+    class Runtime;
+}
+
+// Abstract Syntax Tree used by the compiling backends (see emit_cpp.h).
+// The interpreter itself still parses and executes the program text directly.
+namespace ast
+{
+    using runtime::value_t;
+    using runtime::ValueType;
+    using runtime::linenum_t;
+    using runtime::int_t;
+    using runtime::float_t;
+    using runtime::str_t;
+
+    enum class Op
+    {
+        Const,
+        Var,
+        ArrayElem,
+        Neg,
+        Not,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Eq,
+        NotEq,
+        Less,
+        Greater,
+        LessEq,
+        GreaterEq,
+        And,
+        Or,
+        Sqr,
+        Int,
+        Abs,
+        Left,
+        Right,
+        Mid,
+        Str,
+        Val,
+        Len,
+        Asc,
+        Chr,
+        Rnd,
+        Inkey,
+        CallFn
+    };
+
+    struct Expr;
+    using ExprPtr = std::shared_ptr<const Expr>;
+
+    struct Expr
+    {
+        Op op;
+        ValueType type;                 // The same type the interpreter would produce
+        bool pure;                      // No RND, INKEY$ or FN calls inside
+        value_t value;                  // Op::Const
+        std::string name;               // Op::Var, Op::ArrayElem, Op::CallFn (lower case)
+        std::vector<ExprPtr> args;
+    };
+
+    struct VarRef
+    {
+        std::string name;               // Lower case, without indices
+        std::vector<ExprPtr> indices;   // Empty for scalar variables
+        ValueType type;
+    };
+
+    struct Stmt;
+    using StmtPtr = std::shared_ptr<const Stmt>;
+    using Branch = std::variant<linenum_t, StmtPtr>;
+
+    struct Nop {};
+    struct PrintItem { ExprPtr value; bool tab; };
+    struct Print { std::vector<PrintItem> items; };
+    struct InputItem { std::string prompt; VarRef var; };
+    struct Input { std::vector<InputItem> items; };
+    struct Assign { VarRef var; ExprPtr value; };
+    struct DimItem { std::string name; std::vector<ExprPtr> dimensions; };
+    struct Dim { std::vector<DimItem> items; };
+    struct Goto { linenum_t line; };
+    struct Gosub { linenum_t line; };
+    struct Return {};
+    struct On { ExprPtr index; std::vector<linenum_t> lines; bool gosub; };
+    struct If { ExprPtr cond; Branch then; std::optional<Branch> otherwise; };
+    struct For { VarRef var; ExprPtr initVal; ExprPtr targetVal; ExprPtr stepVal; };
+    struct Next { std::vector<std::string> varNames; };
+    struct End {};
+    struct Read { std::vector<VarRef> vars; };
+    struct Restore { linenum_t line; };  // MaxLineNum restores to the beginning
+    struct Randomize { ExprPtr seed; };
+    struct DefFn { std::string name; std::string varName; ExprPtr body; };
+
+    struct Stmt : std::variant<
+        Nop, Print, Input, Assign, Dim, Goto, Gosub, Return, On, If,
+        For, Next, End, Read, Restore, Randomize, DefFn
+    >
+    {
+        using variant::variant;
+    };
+
+    struct Line
+    {
+        linenum_t num;
+        std::vector<StmtPtr> statements;
+    };
+
+    struct Program
+    {
+        std::vector<Line> lines;
+        std::vector<value_t> data;
+        std::vector<std::pair<linenum_t, size_t>> lineToDataPos;  // Sorted by line
+    };
+
+    // Builders validate operand types the same way value.cpp does it at runtime,
+    // but report the mismatch at compile time
+    ExprPtr MakeConst( value_t value );
+    ExprPtr MakeVar( VarRef var );
+    ExprPtr MakeUnary( Op op, ExprPtr arg );
+    ExprPtr MakeBinary( Op op, ExprPtr lhs, ExprPtr rhs );
+    ExprPtr MakeCall( Op op, std::vector<ExprPtr> args );
+    ExprPtr MakeFnCall( std::string name, ExprPtr arg );
+    VarRef MakeVarRef( std::string name, std::vector<ExprPtr> indices );
+
+    ExprPtr RequireNumber( ExprPtr expr );
+    ExprPtr RequireStr( ExprPtr expr );
+    ExprPtr RequireAssignable( const VarRef& var, ExprPtr expr );
+
+    // Function results are typed by the name: "FN A$" returns a string, others a number
+    ValueType GetFnType( std::string_view name );
+
+    // Visits the statement and all statements nested into its IF branches
+    void ForEachStmt( const Stmt& stmt, const std::function<void( const Stmt& )>& fnc );
+
+    ExprPtr ParseExpression( std::string_view str );
+    Line ParseLine( linenum_t num, std::string_view str );
+    Program ParseProgram( const runtime::Runtime& runtime );
+}
+
+#endif // BASIC_INT_AST_H
@@ -0,0 +1,503 @@
+//#define BOOST_SPIRIT_X3_DEBUG
+
+#include "ast.h"
+#include "parse_utils.hpp"
+#include "runtime.h"
+#include "keyword_parser.hpp"
+
+#include <boost/config/warning_disable.hpp>
+#include <boost/spirit/home/x3.hpp>
+#include <boost/fusion/adapted/std_tuple.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <algorithm>
+
+// The same language as in grammar.cpp, but instead of executing statements
+// the semantic actions build the AST. The rules are duplicated deliberately: the
+// actions of grammar.cpp execute the statements through the runtime while they are
+// parsed and the rules are shaped for that, sharing them would slow the interpreter
+// down or make every rule a template of the pass. A change of the language goes into
+// both files, emit_cpp_test in tests.cpp compares the translations with the interpreter.
+namespace ast_pass
+{
+    namespace x3 = boost::spirit::x3;
+    using namespace ast;
+    using boost::fusion::at_c;
+
+    using x3::int_;
+    constexpr x3::real_parser<float, x3::strict_real_policies<float>> strict_float = {};
+    using x3::char_;
+    using x3::lit;
+    using x3::no_case;
+    using x3::attr;
+    using x3::eoi;
+    using x3::eps;
+    using x3::omit;
+    using x3::lexeme;
+    constexpr auto line_num = x3::ulong_long;
+
+    template<class T>
+    StmtPtr MakeStmt( T&& stmt )
+    {
+        return std::make_shared<const Stmt>( std::forward<T>( stmt ) );
+    }
+
+    constexpr auto cpy_op = []( auto& ctx )
+    {
+        _val( ctx ) = _attr( ctx );
+    };
+
+    constexpr auto const_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeConst( value_t{ _attr( ctx ) } );
+    };
+
+    constexpr auto const_int_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeConst( value_t{ static_cast<int_t>(_attr( ctx )) } );
+    };
+
+    constexpr auto unary_op = []( Op op )
+    {
+        return [op]( auto& ctx ) {
+            _val( ctx ) = MakeUnary( op, _attr( ctx ) );
+        };
+    };
+
+    constexpr auto binary_op = []( Op op )
+    {
+        return [op]( auto& ctx ) {
+            _val( ctx ) = MakeBinary( op, _val( ctx ), _attr( ctx ) );
+        };
+    };
+
+    constexpr auto call_op = []( Op op, size_t minArgs, size_t maxArgs )
+    {
+        return [=]( auto& ctx ) {
+            auto&& args = _attr( ctx );
+
+            if( args.size() < minArgs || args.size() > maxArgs )
+            {
+                _pass( ctx ) = false;
+                return;
+            }
+
+            _val( ctx ) = MakeCall( op, std::move( args ) );
+        };
+    };
+
+    constexpr auto inkey_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeCall( Op::Inkey, {} );
+    };
+
+    constexpr auto call_fn_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        _val( ctx ) = MakeFnCall( std::move( at_c<0>( v ) ), std::move( at_c<1>( v ) ) );
+    };
+
+    constexpr auto var_ref_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        _val( ctx ) = MakeVarRef( std::move( at_c<0>( v ) ), std::move( at_c<1>( v ) ) );
+    };
+
+    constexpr auto load_var_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeVar( std::move( _attr( ctx ) ) );
+    };
+
+    constexpr auto stmt_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( std::move( _attr( ctx ) ) );
+    };
+
+    template<class StmtT>
+    constexpr auto simple_stmt_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( StmtT{} );
+    };
+
+    constexpr auto print_op = []( auto& ctx )
+    {
+        _val( ctx ).items.push_back( PrintItem{ _attr( ctx ), false } );
+    };
+
+    constexpr auto print_const_op = []( auto& ctx )
+    {
+        _val( ctx ).items.push_back( PrintItem{ MakeConst( _attr( ctx ) ), false } );
+    };
+
+    constexpr auto print_tab_op = []( auto& ctx )
+    {
+        _val( ctx ).items.push_back( PrintItem{ RequireNumber( _attr( ctx ) ), true } );
+    };
+
+    constexpr auto print_newline_op = []( auto& ctx )
+    {
+        _val( ctx ).items = { PrintItem{ MakeConst( value_t{ "\n" } ), false } };
+    };
+
+    constexpr auto input_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        _val( ctx ).items.push_back( InputItem{ std::move( at_c<0>( v ) ), std::move( at_c<1>( v ) ) } );
+    };
+
+    constexpr auto dim_item_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        auto name = std::move( at_c<0>( v ) );
+
+        boost::algorithm::to_lower( name );
+        _val( ctx ) = DimItem{ std::move( name ), std::move( at_c<1>( v ) ) };
+    };
+
+    constexpr auto dim_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( Dim{ std::move( _attr( ctx ) ) } );
+    };
+
+    constexpr auto branch_op = []( auto& ctx )
+    {
+        _val( ctx ) = Branch{ _attr( ctx ) };
+    };
+
+    constexpr auto if_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        auto&& otherwise = at_c<2>( v );
+
+        _val( ctx ) = MakeStmt( If{
+            std::move( at_c<0>( v ) ),
+            Branch{ std::move( at_c<1>( v ) ) },
+            otherwise ? std::optional<Branch>{ std::move( *otherwise ) } : std::nullopt
+        } );
+    };
+
+    constexpr auto on_op = []( bool gosub )
+    {
+        return [gosub]( auto& ctx ) {
+            auto&& v = _attr( ctx );
+            _val( ctx ) = MakeStmt( On{ RequireNumber( std::move( at_c<0>( v ) ) ), std::move( at_c<1>( v ) ), gosub } );
+        };
+    };
+
+    constexpr auto goto_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( Goto{ _attr( ctx ) } );
+    };
+
+    constexpr auto gosub_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( Gosub{ _attr( ctx ) } );
+    };
+
+    constexpr auto for_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        auto&& var = at_c<0>( v );
+        auto&& step = at_c<3>( v );
+
+        if( var.type == ValueType::Str || !var.indices.empty() )
+            throw std::runtime_error( "Unsupported FOR variable: " + var.name );
+
+        _val( ctx ) = MakeStmt( For{
+            std::move( var ),
+            RequireNumber( std::move( at_c<1>( v ) ) ),
+            RequireNumber( std::move( at_c<2>( v ) ) ),
+            step ? RequireNumber( std::move( *step ) ) : MakeConst( value_t{ int_t{ 1 } } )
+        } );
+    };
+
+    constexpr auto next_op = []( auto& ctx )
+    {
+        auto names = std::move( _attr( ctx ) );
+
+        for( auto& name : names )
+            boost::algorithm::to_lower( name );
+
+        _val( ctx ) = MakeStmt( Next{ std::move( names ) } );
+    };
+
+    constexpr auto read_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( Read{ std::move( _attr( ctx ) ) } );
+    };
+
+    constexpr auto restore_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( Restore{ _attr( ctx ) } );
+    };
+
+    constexpr auto randomize_op = []( auto& ctx )
+    {
+        _val( ctx ) = MakeStmt( Randomize{ RequireNumber( _attr( ctx ) ) } );
+    };
+
+    constexpr auto def_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        auto name = std::move( at_c<0>( v ) );
+        auto varName = std::move( at_c<1>( v ) );
+        auto&& body = at_c<2>( v );
+
+        boost::algorithm::to_lower( name );
+        boost::algorithm::to_lower( varName );
+
+        if( (GetFnType( name ) == ValueType::Str) != (body->type == ValueType::Str) )
+            throw std::runtime_error( "Function result type mismatch: " + name );
+
+        _val( ctx ) = MakeStmt( DefFn{ std::move( name ), std::move( varName ), std::move( body ) } );
+    };
+
+    constexpr auto assign_op = []( auto& ctx )
+    {
+        auto&& v = _attr( ctx );
+        auto&& var = at_c<0>( v );
+        auto value = RequireAssignable( var, std::move( at_c<1>( v ) ) );
+
+        _val( ctx ) = MakeStmt( Assign{ std::move( var ), std::move( value ) } );
+    };
+
+    constexpr auto push_stmt_op = []( auto& ctx )
+    {
+        _val( ctx ).push_back( std::move( _attr( ctx ) ) );
+    };
+
+    x3::rule<class expression, ExprPtr> const expression( "expression" );
+    x3::rule<class term, ExprPtr> const term( "term" );
+    x3::rule<class exponent, ExprPtr> const exponent( "exponent" );
+    x3::rule<class mult_div, ExprPtr> const mult_div( "mult_div" );
+    x3::rule<class add_sub, ExprPtr> const add_sub( "add_sub" );
+    x3::rule<class relational, ExprPtr> const relational( "relational" );
+    x3::rule<class log_and, ExprPtr> const log_and( "log_and" );
+    x3::rule<class log_or, ExprPtr> const log_or( "log_or" );
+    x3::rule<class args, std::vector<ExprPtr>> const args( "args" );
+    x3::rule<class identifier, std::string> const identifier( "identifier" );
+    x3::rule<class var_ref, VarRef> const var_ref( "var_ref" );
+    x3::rule<class string_lit, std::string> const string_lit( "string_lit" );
+    x3::rule<class print_stmt, Print> const print_stmt( "print_stmt" );
+    x3::rule<class input_stmt, Input> const input_stmt( "input_stmt" );
+    x3::rule<class dim_item, DimItem> const dim_item( "dim_item" );
+    x3::rule<class branch, Branch> const branch( "branch" );
+    x3::rule<class statement, StmtPtr> const statement( "statement" );
+    x3::rule<class line, std::vector<StmtPtr>> const line( "line" );
+
+    const auto expression_def =
+        log_or;
+
+    const auto quote = char_( '"' ); //MSVC has problems if we inline it.
+
+    const auto string_lit_def =
+        lexeme['"' >> *~quote >> '"'];
+
+    const auto statement_end =
+        ':' | no_case["else"] | eoi;
+
+    const auto sequence_separator =
+        +lit( ':' );
+
+    const auto args_def =
+        '(' >> expression % ',' >> ')';
+
+    const auto print_arg =
+        +(
+            +(',' >> attr( value_t{ "\t" } )[print_const_op]) |
+            no_case["tab"] >> '(' >> expression[print_tab_op] >> ')' |
+            expression[print_op]
+            );
+
+    // Statements below don't include their keywords, see statement_def
+
+    const auto print_stmt_def =
+        (print_arg >> *(';' >> print_arg) >> (
+            ';' | (&statement_end >> attr( value_t{ "\n" } )[print_const_op])
+            )) |
+        eps[print_newline_op];
+
+    const auto input_stmt_def =
+        (
+            (string_lit >> ';' >> var_ref)[input_op] |
+            (attr( std::string{ "?" } ) >> var_ref)[input_op]
+            ) >>
+        *((',' >> attr( std::string{ "??" } ) >> var_ref)[input_op]);
+
+    const auto branch_def =
+        line_num[branch_op] |
+        statement[branch_op];
+
+    const auto if_stmt =
+        (expression >> (no_case["then"] | no_case["goto"]) >> line_num >> -(no_case["else"] >> branch))[if_op] |
+        (expression >> -no_case["then"] >> statement >> -(no_case["else"] >> branch))[if_op]
+        ;
+
+    const auto dim_item_def =
+        (identifier >> '(' >> expression % ',' >> ')')[dim_item_op] |
+        (identifier >> attr( std::vector<ExprPtr>{} ))[dim_item_op]
+        ;
+
+    // See statement_def in grammar.cpp
+    const auto statement_keywords = runtime::keyword_dispatch(
+        "text", eps[simple_stmt_op<Nop>],
+        "home", eps[simple_stmt_op<Nop>],
+        "cls", eps[simple_stmt_op<Nop>],
+        "stop", eps[simple_stmt_op<End>],
+        "print", print_stmt[stmt_op],
+        "input", input_stmt[stmt_op],
+        "if", if_stmt,
+        "on", (expression >> no_case["goto"] >> line_num % ',')[on_op( false )] |
+              (expression >> no_case["gosub"] >> line_num % ',')[on_op( true )],
+        "goto", line_num[goto_op],
+        "gosub", line_num[gosub_op],
+        "return", eps[simple_stmt_op<Return>],
+        "for", (var_ref >> '=' >> expression >> no_case["to"] >> expression >> -(no_case["step"] >> expression))[for_op],
+        "next", (identifier % ',')[next_op] | attr( std::vector<std::string>{} )[next_op],
+        "end", eps[simple_stmt_op<End>],
+        "dim", (dim_item % ',')[dim_op],
+        "restore", line_num[restore_op] | attr( runtime::MaxLineNum )[restore_op],
+        "read", (var_ref % ',')[read_op],
+        "randomize", expression[randomize_op],
+        "rem", omit[lexeme[*char_]][simple_stmt_op<Nop>],
+        "def", no_case["fn"] >> (identifier >> '(' >> identifier >> ')' >> '=' >> expression)[def_op]
+    );
+
+    const auto statement_def =
+        statement_keywords |
+        (-no_case["let"] >> var_ref >> '=' >> expression)[assign_op]
+        ;
+
+    // See the comment for identifier_def in grammar.cpp
+    const auto identifier_def = x3::raw[!no_case["else"] >> lexeme[(x3::alpha | '_') >> *(x3::alnum | '_') >> -(lit( '%' ) | '$')]];
+
+    const auto var_ref_def =
+        (identifier >> '(' >> expression % ',' >> ')')[var_ref_op] |
+        (identifier >> attr( std::vector<ExprPtr>{} ))[var_ref_op]
+        ;
+
+    const auto builtin_keywords = runtime::keyword_dispatch(
+        "not", term[unary_op( Op::Not )],
+        "sqr", args[call_op( Op::Sqr, 1, 1 )],
+        "int", args[call_op( Op::Int, 1, 1 )],
+        "abs", args[call_op( Op::Abs, 1, 1 )],
+        "left$", args[call_op( Op::Left, 2, 2 )],
+        "right$", args[call_op( Op::Right, 2, 2 )],
+        "mid$", args[call_op( Op::Mid, 2, 3 )],
+        "str$", args[call_op( Op::Str, 1, 1 )],
+        "val", args[call_op( Op::Val, 1, 1 )],
+        "len", args[call_op( Op::Len, 1, 1 )],
+        "asc", args[call_op( Op::Asc, 1, 1 )],
+        "chr$", args[call_op( Op::Chr, 1, 1 )],
+        "rnd", args[call_op( Op::Rnd, 1, 1 )],
+        "inkey$", eps[inkey_op],
+        "fn", (identifier >> '(' >> expression >> ')')[call_fn_op]
+    );
+
+    const auto term_def =
+        strict_float[const_op] |
+        int_[const_int_op] |
+        string_lit[const_op] |
+        '(' >> expression[cpy_op] >> ')' |
+        '-' >> term[unary_op( Op::Neg )] |
+        '+' >> term[cpy_op] |
+        builtin_keywords |
+        var_ref[load_var_op]
+        ;
+
+    const auto exponent_def =
+        term[cpy_op] >> *(
+            ('^' >> term[binary_op( Op::Pow )])
+            );
+
+    const auto mult_div_def =
+        exponent[cpy_op] >> *(
+            ('*' >> exponent[binary_op( Op::Mul )]) |
+            ('/' >> exponent[binary_op( Op::Div )])
+            );
+
+    const auto add_sub_def =
+        mult_div[cpy_op] >> *(
+            ('+' >> mult_div[binary_op( Op::Add )]) |
+            ('-' >> mult_div[binary_op( Op::Sub )])
+            );
+
+    const auto relational_def =
+        add_sub[cpy_op] >> *(
+            ((lit( "==" ) | '=') >> add_sub[binary_op( Op::Eq )]) |
+            ('<' >> lit( '>' ) >> add_sub[binary_op( Op::NotEq )]) |
+            ('<' >> add_sub[binary_op( Op::Less )]) |
+            ('>' >> add_sub[binary_op( Op::Greater )]) |
+            ('<' >> lit( '=' ) >> add_sub[binary_op( Op::LessEq )]) |
+            ('>' >> lit( '=' ) >> add_sub[binary_op( Op::GreaterEq )])
+            );
+
+    const auto log_and_def =
+        relational[cpy_op] >> *(
+            no_case["and"] >> relational[binary_op( Op::And )]
+            );
+
+    const auto log_or_def =
+        log_and[cpy_op] >> *(
+            no_case["or"] >> log_and[binary_op( Op::Or )]
+            );
+
+    const auto line_def =
+        -sequence_separator >> -(statement[push_stmt_op] % sequence_separator) >> -sequence_separator;
+
+    BOOST_SPIRIT_DEFINE( expression, term, exponent, mult_div, add_sub, relational, log_and, log_or, args,
+                         identifier, var_ref, string_lit, print_stmt, input_stmt, dim_item, branch, statement, line
+    );
+}
+
+namespace ast
+{
+ExprPtr ParseExpression( std::string_view str )
+{
+    ExprPtr res;
+    std::string err{};
+
+    const auto parseFnc = [&res]( auto& args )
+    {
+        return phrase_parse( args.cur, args.end, ast_pass::expression, args.spaceParser, res );
+    };
+
+    if( !runtime::ParseSingle( str, 0, err, parseFnc ) )
+        throw std::runtime_error( "Expression " + err );
+
+    return res;
+}
+
+Line ParseLine( linenum_t num, std::string_view str )
+{
+    Line res{ num, {} };
+    std::string err{};
+
+    const auto parseFnc = [&res]( auto& args )
+    {
+        return phrase_parse( args.cur, args.end, ast_pass::line, args.spaceParser, res.statements );
+    };
+
+    if( !runtime::ParseSingle( str, 0, err, parseFnc ) )
+        throw std::runtime_error( "Line " + std::to_string( num ) + " " + err );
+
+    return res;
+}
+
+Program ParseProgram( const runtime::Runtime& runtime )
+{
+    Program res;
+
+    for( const auto& [num, str] : runtime.GetProgram() )
+        res.lines.push_back( ParseLine( num, str ) );
+
+    const auto& data = runtime.GetData();
+    res.data.reserve( data.size() );
+
+    for( size_t i = 0; i < data.size(); ++i )
+        res.data.push_back( data[i] );
+
+    res.lineToDataPos = runtime.GetLineToDataPos();
+
+    return res;
+}
+}
@@ -2,21 +2,41 @@
 #include "runtime.h"
 #include "parse_utils.hpp"
 #include "platform.h"
+#include "ast.h"
+#include "analysis.h"
+#include "emit_cpp.h"
+#include "jit.h"
+#include "thread_pool.hpp"
+#include "server.h"
+#include "loader.h"
+#include "repl.h"
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
 
 //#define DEBUG_FULL_EXEC_LOG
 
+//Set by --cache, see runtime::LoadProgramCached()
+bool gUseProgramCache = false;
+
 void InteractiveMode()
 {                                            
     std::cout << "\033[96m" "-------------------------\n";
     std::cout << "Interactive mode\n";
     std::cout << "-------------------------\n" "\033[0m";
 
-    runtime::TestExecutor calc{ main_pass::statement_rule() };
+    runtime::Runtime runtime;
+    runtime::Repl repl{ runtime };
 
     std::string str;
 
@@ -27,88 +47,373 @@ void InteractiveMode()
         if( !std::getline( std::cin, str ) || str.empty() )
             break;
 
-        const auto res = calc(str);
-
-        std::cout << res << std::endl;
+        repl.Execute( str );
     }
 }
 
 bool Preparse( const char* szFileName, runtime::Runtime &runtime )
 {
-    std::ifstream flIn{ szFileName };
+    if( gUseProgramCache )
+    {
+        auto pProgram = runtime::LoadProgramCached( szFileName, runtime.Err() );
 
-    std::string str;
+        if( !pProgram )
+            return false;
 
-    while( std::getline( flIn, str ) )
-    {
-        boost::spirit::x3::unused_type res{};
-        std::string err{};
+        runtime.SetProgram( std::move( pProgram ) );
+        return true;
+    }
 
-        const auto parseFnc = [&runtime, &res]( auto& args )
-        {
-            return phrase_parse( args.cur, args.end, args.MakeFullParser(runtime, preparse::line_rule()), args.spaceParser, res );
-        };
+    //A missing file is an empty program
+    auto pText = MapFile( szFileName );
 
-        if( !runtime::ParseSingle( str, 0, err, parseFnc ) )
-        {
-            std::cerr << "\033[91m" "-------------------------\n";
-            std::cerr << "Preparse failed\n" << str << "\n";
-            std::cerr << "Error: \"" << err << "\"\n";
-            std::cerr << "-------------------------\n" "\033[0m";
+    return !pText || runtime::Preparse( std::move( pText ), runtime );
+}
 
-            return false;
-        }
+using Diagnostics = std::optional<std::vector<analysis::Diagnostic>>;
+
+// A loaded program with the result of its static check, all the runs of the file share both
+struct CheckedProgram
+{
+    std::shared_ptr<const runtime::Program> pProgram;
+    Diagnostics diagnostics;
+};
+
+// Programs the compiling backends can't parse, e.g. with a type error on a line that may
+// never run, are checked during the execution only, std::nullopt is returned for them
+Diagnostics CheckProgram( std::shared_ptr<const runtime::Program> pProgram )
+{
+    runtime::Runtime runtime;
+    runtime.SetProgram( std::move( pProgram ) );
+
+    try
+    {
+        return analysis::AnalyzeProgram( ast::ParseProgram( runtime ) );
+    }
+    catch( const std::exception& )
+    {
+        return std::nullopt;
     }
+}
 
-    return true;
+// The accesses to variables not proven to be initialized are reported before the start
+// and not again during the execution
+void ReportDiagnostics( const Diagnostics& diagnostics, runtime::Runtime& runtime )
+{
+    if( !diagnostics )
+        return;
+
+    if( !diagnostics->empty() )
+    {
+        auto& errOut = runtime.Err();
+        errOut << "\033[93m" "-------------------------\n";
+        errOut << "Static check warnings\n";
+        analysis::PrintDiagnostics( *diagnostics, errOut );
+        errOut << "-------------------------\n" "\033[0m";
+    }
+
+    runtime.SetStaticallyChecked( true );
 }
 
 bool Execute( runtime::Runtime& runtime )
 {
+    using RunStatus = runtime::Runtime::RunStatus;
+
 #ifdef DEBUG_FULL_EXEC_LOG
     std::ofstream flOut( "program.log" );
+    constexpr size_t stepsPerRun = 1;
+#else
+    constexpr size_t stepsPerRun = std::numeric_limits<size_t>::max();
 #endif
 
     runtime.Start();
 
     for(;;) 
     {
-        const auto [pStr, lineNum, offset] = runtime.GetNextLine();
+        const auto status = runtime.Run( stepsPerRun );
+        const auto& step = runtime.GetLastStep();
 
-        if( !pStr )
+        if( status == RunStatus::Finished )
             return true;
 
-        runtime::value_t res{};
-        std::string err{};
-
-        if( !runtime::ParseSequence( *pStr, offset, main_pass::statement_rule(), runtime, res, err ) )
+        if( status == RunStatus::Error )
         {
-            std::cerr << "\033[91m" "-------------------------\n";
-            std::cerr << "Execute failed\n" << lineNum << '\t' << *pStr << "\n";
-            std::cerr << "Error: " << err << "\n";
-            std::cerr << "-------------------------\n" "\033[0m";
+            auto& errOut = runtime.Err();
+            errOut << "\033[91m" "-------------------------\n";
+            errOut << "Execute failed\n" << step.line << '\t' << runtime.GetProgram().at( step.line ) << "\n";
+            errOut << "Error: " << step.error << "\n";
+            errOut << "-------------------------\n" "\033[0m";
             return false;
         }
 
 #ifdef DEBUG_FULL_EXEC_LOG
-        const std::string_view cmd{ pStr->c_str() + offset, pStr->length() - offset};
+        const std::string_view cmd = runtime.GetProgram().at( step.line ).substr( step.offset );
 
-        flOut << lineNum << ' ' << cmd;
-        flOut << std::setfill( ' ' ) << std::setw( std::max(80u, cmd.length() + 1) - cmd.length() ) << ' ';
+        flOut << step.line << ' ' << cmd;
+        flOut << std::setfill( ' ' ) << std::setw( std::max( size_t{ 80 }, cmd.length() + 1 ) - cmd.length() ) << ' ';
         runtime.PrintVars( flOut );
         flOut << std::endl;
 #endif
     }
 }
 
+// pText is the already mapped file, if any
+void ReadFakeInput( const char* szFileName, runtime::Runtime& runtime, std::ostream& out, std::shared_ptr<const std::string_view> pText = nullptr )
+{
+    out << "\033[96m" "-------------------------\n";
+    out << "Read input: " << szFileName << std::endl;
+    out << "-------------------------\n" "\033[0m";
+
+    if( !pText )
+        pText = MapFile( szFileName );
+
+    //The lines are read when the program asks for them
+    if( pText )
+        runtime.AddFakeInputScript( std::move( pText ) );
+}
+
+// pLoaded is the already loaded and checked file, if any
+bool RunProgram( const char* szFileName, runtime::Runtime& runtime, std::ostream& out, const CheckedProgram* pLoaded = nullptr )
+{
+    out << "\033[96m" "-------------------------\n";
+    out << "Running: " << szFileName << std::endl;
+    out << "-------------------------\n" "\033[0m";
+
+    bool res = true;
+    Diagnostics diagnostics;
+
+    if( pLoaded && pLoaded->pProgram )
+    {
+        runtime.SetProgram( pLoaded->pProgram );
+        diagnostics = pLoaded->diagnostics;
+    }
+    else if( (res = Preparse( szFileName, runtime )) )
+        diagnostics = CheckProgram( runtime.GetSharedProgram() );
+
+    if( res )
+    {
+        ReportDiagnostics( diagnostics, runtime );
+        res = Execute( runtime );
+    }
+
+    out << std::endl << (res ? "\033[92m" "[SUCCESS]" "\033[0m" : "\033[91m" "[FAILURE]" "\033[0m") << std::endl << std::endl;
+
+    runtime.Clear();
+
+    return res;
+}
+
+// The errors are reported when the file is preparsed again, nullptr on errors
+std::shared_ptr<const runtime::Program> LoadProgram( const char* szFileName )
+{
+    std::ostringstream errOut;
+
+    if( gUseProgramCache )
+        return runtime::LoadProgramCached( szFileName, errOut );
+
+    auto pText = MapFile( szFileName );
+
+    return runtime::LoadProgram( pText ? std::move( pText ) : std::make_shared<const std::string_view>(), errOut );
+}
+
+// Every program with the ".input" files before it is a separate job. Jobs run on
+// their own runtimes in parallel, the output of each job is printed at once and
+// in the order of the command line. Every file is loaded and checked once, all
+// the jobs running it share the program or the mapped input.
+int RunBatch( unsigned jobsCount, int argc, char* argv[] )
+{
+    std::vector<std::vector<const char*>> jobs( 1 );
+
+    for( int i = 0; i < argc; ++i )
+    {
+        jobs.back().push_back( argv[i] );
+
+        if( !boost::algorithm::ends_with( argv[i], ".input" ) )
+            jobs.emplace_back();
+    }
+
+    if( jobs.back().empty() )
+        jobs.pop_back();
+
+    std::map<std::string_view, CheckedProgram> programs;
+    std::map<std::string_view, std::shared_ptr<const std::string_view>> inputs;
+
+    for( int i = 0; i < argc; ++i )
+        if( !boost::algorithm::ends_with( argv[i], ".input" ) )
+            programs.emplace( argv[i], CheckedProgram{} );
+        else if( inputs.count( argv[i] ) == 0 )
+            inputs.emplace( argv[i], MapFile( argv[i] ) );
+
+    std::vector<decltype(programs)::value_type*> toLoad;
+
+    for( auto& item : programs )
+        toLoad.push_back( &item );
+
+    //A file that fails to load is preparsed again by its jobs to report the errors
+    runtime::RunParallel( toLoad.size(), jobsCount, [&toLoad]( size_t idx ) {
+        auto& loaded = toLoad[idx]->second;
+        loaded.pProgram = LoadProgram( toLoad[idx]->first.data() );
+
+        if( loaded.pProgram )
+            loaded.diagnostics = CheckProgram( loaded.pProgram );
+    } );
+
+    struct Result
+    {
+        std::ostringstream out;
+        bool success = true;
+        bool done = false;
+    };
+
+    std::vector<Result> results( jobs.size() );
+    std::mutex printMutex;
+    size_t nextToPrint = 0;
+
+    runtime::RunParallel( jobs.size(), jobsCount, [&]( size_t idx ) {
+        auto& res = results[idx];
+
+        //A failed job must not hold back the output of the next ones
+        try
+        {
+            //No console input, the programs have to rely on the fake one
+            std::istringstream noInput;
+            runtime::Runtime runtime;
+            runtime.SetStreams( noInput, res.out, res.out );
+
+            for( const char* szFileName : jobs[idx] )
+            {
+                if( boost::algorithm::ends_with( szFileName, ".input" ) )
+                    ReadFakeInput( szFileName, runtime, res.out, inputs.at( szFileName ) );
+                else
+                    res.success = RunProgram( szFileName, runtime, res.out, &programs.at( szFileName ) );
+            }
+        }
+        catch( const std::exception& e )
+        {
+            res.success = false;
+            res.out << "\033[91m" "Job failed: " << e.what() << "\033[0m" << std::endl;
+        }
+
+        const std::lock_guard lock( printMutex );
+
+        res.done = true;
+
+        for( ; nextToPrint < results.size() && results[nextToPrint].done; ++nextToPrint )
+            std::cout << results[nextToPrint].out.str() << std::flush;
+    } );
+
+    const bool success = std::all_of( results.begin(), results.end(), []( const auto& res ) { return res.success; } );
+
+    return success ? 0 : 1;
+}
+
+bool EmitCpp( const char* szFileName )
+{
+    runtime::Runtime runtime;
+
+    if( !Preparse( szFileName, runtime ) )
+        return false;
+
+    try
+    {
+        codegen::EmitCpp( ast::ParseProgram( runtime ), std::cout );
+    }
+    catch( const std::exception& e )
+    {
+        std::cerr << "\033[91m" "-------------------------\n";
+        std::cerr << "Compilation failed\n";
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cerr << "-------------------------\n" "\033[0m";
+        return false;
+    }
+
+    return true;
+}
+
+int RunJit( int argc, char* argv[] )
+{
+    runtime::Runtime runtime;
+
+    if( !Preparse( argv[0], runtime ) )
+        return 1;
+
+    //Runtime errors are reported by jit::Run() itself
+    try
+    {
+        return jit::Run( ast::ParseProgram( runtime ), argc, argv );
+    }
+    catch( const std::exception& e )
+    {
+        std::cerr << "\033[91m" "-------------------------\n";
+        std::cerr << "Compilation failed\n";
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cerr << "-------------------------\n" "\033[0m";
+        return 1;
+    }
+}
+
+int Serve( const char* szSocketPath, const char* szFileName, unsigned threadsCount )
+{
+    runtime::Runtime loader;
+
+    if( !Preparse( szFileName, loader ) )
+        return 1;
+
+    //All the sessions run the same program
+    const auto pProgram = loader.GetSharedProgram();
+
+    server::Options options;
+    options.socketPath = szSocketPath;
+    options.threadsCount = threadsCount;
+
+    try
+    {
+        return server::Run( options, [&pProgram]( runtime::Runtime& runtime ) {
+            runtime.SetProgram( pProgram );
+            return true;
+        } );
+    }
+    catch( const std::exception& e )
+    {
+        std::cerr << "\033[91m" "Server failed: " << e.what() << "\033[0m" << std::endl;
+        return 1;
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //  Main program
 ///////////////////////////////////////////////////////////////////////////////
 int main(int argc, char* argv[])
 {
-    extern void RunTests( const char* szPath );
+    //Only iostreams are used, the unit tests are in basic_int_tests
+    std::ios::sync_with_stdio( false );
+
+    if( argc >= 2 && std::string_view{ argv[1] } == "--cache" )
+    {
+        gUseProgramCache = true;
+        argv[1] = argv[0];
+        --argc;
+        ++argv;
+    }
+
+    //The generated code goes to stdout, so nothing else should be printed there
+    if( argc == 3 && std::string_view{ argv[1] } == "--emit-cpp" )
+        return EmitCpp( argv[2] ) ? 0 : 1;
 
-    RunTests(argv[0]);
+    //The output must be the same as of the compiled program
+    if( argc >= 3 && std::string_view{ argv[1] } == "--jit" )
+        return RunJit( argc - 2, argv + 2 );
+
+    if( argc >= 3 && std::string_view{ argv[1] } == "--jobs" )
+    {
+        EnableConsoleColors();
+
+        const int jobsCount = std::atoi( argv[2] );
+        return RunBatch( jobsCount > 0 ? jobsCount : std::thread::hardware_concurrency(), argc - 3, argv + 3 );
+    }
+
+    if( (argc == 4 || argc == 5) && std::string_view{ argv[1] } == "--serve" )
+        return Serve( argv[2], argv[3], argc == 5 ? std::atoi( argv[4] ) : 0 );
 
     EnableConsoleColors();
     
@@ -120,9 +425,20 @@ int main(int argc, char* argv[])
 
     if( argc <= 1 )
     {
-        std::cout << "\nBASIC_INT [FILE [...]]\n\n";
+        std::cout << "\nBASIC_INT [--cache] [FILE [...]]\n";
+        std::cout << "BASIC_INT --emit-cpp FILE\n";
+        std::cout << "BASIC_INT --jit FILE [INPUT [...]]\n";
+        std::cout << "BASIC_INT --jobs N FILE [...]\n";
+        std::cout << "BASIC_INT --serve SOCKET FILE [THREADS]\n\n";
         std::cout << "  FILE\tBASIC program file. if the file name ends on \".input\"\n"
                          "  \tits content is used as fake input for the next program\n";
+        std::cout << "  --cache\tkeep preparsed programs in FILE.basc next to the sources, goes before other options\n";
+        std::cout << "  --emit-cpp\tprint C++ translation of the program to stdout\n";
+        std::cout << "  --jit\tcompile the program with LLVM and run it, needs a build with BASIC_INT_WITH_LLVM\n";
+        std::cout << "  --jobs\trun the programs on N threads (0 - one per core) without interactive mode,\n"
+                         "  \tthe output is printed in the order of the files\n";
+        std::cout << "  --serve\trun a session of the program for every connection to the Unix socket,\n"
+                         "  \tSIGUSR1 prints the sessions statistics, Linux only\n";
     }
 
     runtime::Runtime runtime;
@@ -130,32 +446,9 @@ int main(int argc, char* argv[])
     for( int i = 1; i < argc; ++i )
     {
         if( boost::algorithm::ends_with( argv[i], ".input" ) )
-        {
-            std::cout << "\033[96m" "-------------------------\n";
-            std::cout << "Read input: " << argv[i] << std::endl;
-            std::cout << "-------------------------\n" "\033[0m";
-
-            std::ifstream flIn( argv[i] );
-            std::string str;
-
-            while( std::getline( flIn, str ) )
-                runtime.AddFakeInput( std::move(str) );
-
-            continue;
-        }
-
-        std::cout << "\033[96m" "-------------------------\n";
-        std::cout << "Running: " << argv[i] << std::endl;
-        std::cout << "-------------------------\n" "\033[0m";
-
-        bool res = Preparse( argv[i], runtime );
-
-        if( res )
-            res = Execute( runtime );
-
-        std::cout << std::endl << (res ? "\033[92m" "[SUCCESS]" "\033[0m" : "\033[91m" "[FAILURE]" "\033[0m")  << std::endl << std::endl;
-
-        runtime.Clear();
+            ReadFakeInput( argv[i], runtime, std::cout );
+        else
+            RunProgram( argv[i], runtime, std::cout );
     }
 
     InteractiveMode();
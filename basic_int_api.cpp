@@ -0,0 +1,168 @@
+#include "basic_int_api.h"
+#include "loader.h"
+#include "output_stream.h"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+
+struct basic_program
+{
+    std::shared_ptr<const runtime::Program> pProgram;
+};
+
+struct basic_session
+{
+    basic_session( basic_output_fn output, void* userData ) :
+        out{ [this, output, userData]( std::string_view text ) {
+            if( output )
+                output( userData, text.data(), text.size() );
+            else
+                outBuf.append( text );
+        } }
+    {}
+
+    std::istringstream noInput;
+    runtime::OutputStream out;
+    std::string outBuf;
+    std::string error;
+    runtime::Runtime runtime;
+};
+
+basic_program* basic_load_program( const char* text, size_t size, basic_output_fn errors, void* user_data )
+{
+    try
+    {
+        std::istringstream in{ std::string{ text, size } };
+        runtime::OutputStream err{ [errors, user_data]( std::string_view str ) {
+            if( errors )
+                errors( user_data, str.data(), str.size() );
+        } };
+
+        auto pProgram = runtime::LoadProgram( in, err );
+        err.flush();
+
+        return pProgram ? new basic_program{ std::move( pProgram ) } : nullptr;
+    }
+    catch( const std::exception& )
+    {
+        return nullptr;
+    }
+}
+
+void basic_free_program( basic_program* program )
+{
+    delete program;
+}
+
+basic_session* basic_create_session( const basic_program* program, basic_output_fn output, void* user_data )
+{
+    if( !program )
+        return nullptr;
+
+    try
+    {
+        auto pSession = std::make_unique<basic_session>( output, user_data );
+        auto& runtime = pSession->runtime;
+
+        runtime.SetStreams( pSession->noInput, pSession->out, pSession->out );
+        runtime.SetBlockingInput( false );
+        runtime.SetProgram( program->pProgram );
+        runtime.Start();
+
+        return pSession.release();
+    }
+    catch( const std::exception& )
+    {
+        return nullptr;
+    }
+}
+
+void basic_free_session( basic_session* session )
+{
+    delete session;
+}
+
+basic_status basic_run( basic_session* session, size_t max_steps, unsigned timeout_ms )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    session->outBuf.clear();
+    session->error.clear();
+
+    const auto deadline = timeout_ms != 0 ? std::chrono::steady_clock::now() + std::chrono::milliseconds( timeout_ms ) : std::chrono::steady_clock::time_point::max();
+
+    try
+    {
+        const RunStatus status = session->runtime.Run( max_steps, deadline );
+        session->out.flush();
+
+        switch( status )
+        {
+        case RunStatus::Yielded:            return BASIC_YIELDED;
+        case RunStatus::WaitingForInput:    return BASIC_WAITING_FOR_INPUT;
+        case RunStatus::WaitingForKey:      return BASIC_WAITING_FOR_KEY;
+        case RunStatus::Finished:           return BASIC_FINISHED;
+        default:
+            session->error = session->runtime.GetLastStep().error;
+            return BASIC_ERROR;
+        }
+    }
+    catch( const std::exception& e )
+    {
+        session->error = e.what();
+        return BASIC_ERROR;
+    }
+}
+
+void basic_push_input( basic_session* session, const char* text, size_t size )
+{
+    try
+    {
+        session->runtime.AddInput( std::string{ text, size } );
+    }
+    catch( const std::exception& )
+    {
+    }
+}
+
+int basic_patch_line( basic_session* session, const char* text, size_t size )
+{
+    session->error.clear();
+
+    try
+    {
+        std::ostringstream err;
+        runtime::linenum_t line = 0;
+        runtime::Program part;
+
+        if( !runtime::PreparseLine( { text, size }, line, part, err ) )
+        {
+            session->error = err.str();
+            return 0;
+        }
+
+        session->runtime.PatchLine( line, std::move( part ) );
+
+        return 1;
+    }
+    catch( const std::exception& e )
+    {
+        session->error = e.what();
+        return 0;
+    }
+}
+
+const char* basic_get_output( const basic_session* session, size_t* size )
+{
+    *size = session->outBuf.size();
+    return session->outBuf.data();
+}
+
+const char* basic_last_error( const basic_session* session, unsigned long long* line )
+{
+    if( line )
+        *line = session->runtime.GetLastStep().line;
+
+    return session->error.c_str();
+}
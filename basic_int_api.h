@@ -0,0 +1,63 @@
+#ifndef BASIC_INT_API_H
+#define BASIC_INT_API_H
+
+/* C interface of the interpreter for embedding it into other programs.
+ * A program is loaded once and can be run by any number of sessions, also
+ * on different threads. A single session must not be used concurrently.
+ * The functions never throw, the errors are reported by the return values. */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct basic_program basic_program;
+typedef struct basic_session basic_session;
+
+typedef enum basic_status
+{
+    BASIC_YIELDED,              /* the budget is over, call basic_run() again */
+    BASIC_WAITING_FOR_INPUT,    /* INPUT needs a line, see basic_push_input() */
+    BASIC_WAITING_FOR_KEY,      /* INKEY$ returned nothing, run again later or push a key */
+    BASIC_FINISHED,
+    BASIC_ERROR                 /* see basic_last_error() */
+} basic_status;
+
+/* The text is only valid during the call */
+typedef void (*basic_output_fn)( void* user_data, const char* text, size_t size );
+
+/* Parses the listing. Returns NULL on errors, they are passed to errors if it's not NULL */
+basic_program* basic_load_program( const char* text, size_t size, basic_output_fn errors, void* user_data );
+
+/* The sessions using the program keep it alive */
+void basic_free_program( basic_program* program );
+
+/* Starts the program. With output == NULL the output is collected, see basic_get_output() */
+basic_session* basic_create_session( const basic_program* program, basic_output_fn output, void* user_data );
+
+void basic_free_session( basic_session* session );
+
+/* Executes at most max_steps lines, timeout_ms limits the time if it's not 0 */
+basic_status basic_run( basic_session* session, size_t max_steps, unsigned timeout_ms );
+
+/* A line for INPUT or a key for INKEY$, without the line end */
+void basic_push_input( basic_session* session, const char* text, size_t size );
+
+/* Replaces, inserts or deletes a line of the session between basic_run() calls without
+ * restarting it, see runtime::Runtime::PatchLine(). text is a numbered line, only the
+ * number deletes the line. The other sessions of the program aren't changed. Returns 0
+ * on errors, see basic_last_error() */
+int basic_patch_line( basic_session* session, const char* text, size_t size );
+
+/* The output of the last basic_run() of a session without a callback, valid until the next call */
+const char* basic_get_output( const basic_session* session, size_t* size );
+
+/* The error of the last basic_run() which returned BASIC_ERROR or of basic_patch_line(), line may be NULL */
+const char* basic_last_error( const basic_session* session, unsigned long long* line );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASIC_INT_API_H */
@@ -0,0 +1,156 @@
+#ifndef BASIC_INT_BINARY_STREAM_H
+#define BASIC_INT_BINARY_STREAM_H
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "runtime.h"
+
+// Checkpoints and program caches. Numbers are in the native byte order, the files
+// start with BinaryByteOrderMark to detect a foreign one. Strings are u32 length +
+// bytes, values are a type byte + i16, f32 or string.
+namespace runtime
+{
+    constexpr uint32_t BinaryByteOrderMark = 0x01020304;
+
+    class BinaryWriter
+    {
+    public:
+        template<class T>
+        void Write( const T& val )
+        {
+            static_assert( std::is_trivially_copyable_v<T> );
+            mBuf.append( reinterpret_cast<const char*>(&val), sizeof( val ) );
+        }
+
+        void WriteBytes( const void* pData, size_t size )
+        {
+            mBuf.append( static_cast<const char*>(pData), size );
+        }
+
+        void WriteStr( std::string_view str )
+        {
+            Write( static_cast<uint32_t>(str.size()) );
+            mBuf.append( str );
+        }
+
+        void WriteCount( size_t count )
+        {
+            Write( static_cast<uint32_t>(count) );
+        }
+
+        void WriteValue( const value_t& val )
+        {
+            const auto type = static_cast<uint8_t>(val.get().which());
+            Write( type );
+
+            if( const auto* pInt = boost::get<int_t>( &val.get() ) )
+                Write( *pInt );
+            else if( const auto* pFloat = boost::get<float_t>( &val.get() ) )
+                Write( *pFloat );
+            else
+                WriteStr( boost::get<str_t>( val.get() ) );
+        }
+
+        void WriteIndices( const ArrayIndices& indices )
+        {
+            WriteCount( indices.size() );
+            WriteBytes( indices.data(), indices.size() * sizeof( int_t ) );
+        }
+
+        const std::string& GetBuffer() const
+        {
+            return mBuf;
+        }
+
+    private:
+        std::string mBuf;
+    };
+
+    class BinaryReader
+    {
+    public:
+        explicit BinaryReader( std::string_view buf ) : mBuf{ buf }
+        {}
+
+        template<class T>
+        T Read()
+        {
+            static_assert( std::is_trivially_copyable_v<T> );
+
+            T res;
+            ReadBytes( &res, sizeof( res ) );
+            return res;
+        }
+
+        void ReadBytes( void* pData, size_t size )
+        {
+            if( mBuf.size() < size )
+                throw std::runtime_error( "Binary data is truncated" );
+
+            std::memcpy( pData, mBuf.data(), size );
+            mBuf.remove_prefix( size );
+        }
+
+        std::string ReadStr()
+        {
+            return std::string{ ReadStrView() };
+        }
+
+        // Points into the buffer
+        std::string_view ReadStrView()
+        {
+            const size_t size = ReadCount( 1 );
+            const std::string_view res = mBuf.substr( 0, size );
+            mBuf.remove_prefix( size );
+            return res;
+        }
+
+        // Every item takes at least minItemSize bytes, so a broken count can't
+        // make the loader allocate more than the file size
+        size_t ReadCount( size_t minItemSize )
+        {
+            const size_t count = Read<uint32_t>();
+
+            if( count > mBuf.size() / std::max<size_t>( minItemSize, 1 ) )
+                throw std::runtime_error( "Binary data is truncated" );
+
+            return count;
+        }
+
+        value_t ReadValue()
+        {
+            switch( Read<uint8_t>() )
+            {
+            case 0: return value_t{ Read<int_t>() };
+            case 1: return value_t{ Read<float_t>() };
+            case 2: return value_t{ ReadStr() };
+            default:
+                throw std::runtime_error( "Binary data is broken" );
+            }
+        }
+
+        ArrayIndices ReadIndices()
+        {
+            ArrayIndices res( ReadCount( sizeof( int_t ) ) );
+            ReadBytes( res.data(), res.size() * sizeof( int_t ) );
+            return res;
+        }
+
+        bool IsEnd() const
+        {
+            return mBuf.empty();
+        }
+
+    private:
+        std::string_view mBuf;
+    };
+
+    static_assert( std::is_same_v<int_t, int16_t> && sizeof( float_t ) == 4, "The binary layout depends on the value types" );
+}
+
+#endif // BASIC_INT_BINARY_STREAM_H
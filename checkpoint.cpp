@@ -0,0 +1,286 @@
+#include "runtime.h"
+#include "binary_stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// Checkpoint layout, see binary_stream.hpp for the encoding of the items:
+//
+//   header     "BASICKPT", version: u32, byte order mark: u32, program hash: u64
+//   vars       count: u32, {name, value}
+//   arrays     count: u32, {name, dims count: u32, dims: i16[], elements, out of range count: u32, {indices, value}}
+//   functions  count: u32, {name, arg name, body}
+//   FOR stack  count: u32, {var name, indices, target value, step value, body pc}
+//   GOSUB      count: u32, {pc}
+//   input      count: u32, {line or the rest of the script, flags: u8 (1 - echo, 2 - script)}
+//   scalars    pc, DATA cursor: u64, RNG state, input resume state, ELSE parts to skip on resume: u32
+//
+// Dense array elements all have the type of the array, so numeric ones are stored
+// as a raw block which is loaded with a memcpy of its non-zero pages.
+
+namespace runtime
+{
+namespace
+{
+    constexpr char Magic[8] = { 'B', 'A', 'S', 'I', 'C', 'K', 'P', 'T' };
+    // Older versions are loaded as well: 1 has no input scripts, 2 has no ELSE parts to
+    // skip after the resumed INPUT
+    constexpr uint32_t Version = 3;
+}
+
+void Runtime::SaveCheckpoint( std::ostream& os ) const
+{
+    BinaryWriter writer;
+
+    writer.WriteBytes( Magic, sizeof( Magic ) );
+    writer.Write( Version );
+    writer.Write( BinaryByteOrderMark );
+    writer.Write( mpProgram->GetHash() );
+
+    writer.WriteCount( mVars.size() );
+
+    for( const auto& [name, val] : mVars )
+    {
+        writer.WriteStr( name );
+        writer.WriteValue( val );
+    }
+
+    writer.WriteCount( mArrays.size() );
+
+    for( const auto& [name, pArray] : mArrays )
+    {
+        const ArrayVar& array = *pArray;
+
+        writer.WriteStr( name );
+        writer.WriteCount( array.dimensions.size() );
+        writer.WriteBytes( array.dimensions.data(), array.dimensions.size() * sizeof( int_t ) );
+        writer.WriteCount( array.count );
+
+        if( array.type == ValueType::Str )
+        {
+            for( size_t pos = 0; pos < array.count; ++pos )
+            {
+                const auto itStr = array.strings.find( pos );
+                writer.WriteStr( itStr != array.strings.end() ? itStr->second : str_t{} );
+            }
+        }
+        else
+        {
+            writer.WriteBytes( array.numbers.data(), array.numbers.size() );
+        }
+
+        writer.WriteCount( array.outOfRange.size() );
+
+        for( const auto& [indices, val] : array.outOfRange )
+        {
+            writer.WriteIndices( indices );
+            writer.WriteValue( val );
+        }
+    }
+
+    writer.WriteCount( mFunctions.size() );
+
+    for( const auto& [name, info] : mFunctions )
+    {
+        writer.WriteStr( name );
+        writer.WriteStr( info.varName );
+        writer.WriteStr( info.exprStr );
+    }
+
+    const auto writePC = [&writer]( ProgramCounter pc ) {
+        writer.Write( static_cast<uint64_t>(pc.line) );
+        writer.Write( static_cast<uint32_t>(pc.lineOffset) );
+    };
+
+    writer.WriteCount( mForLoopStack.size() );
+
+    for( const auto& item : mForLoopStack )
+    {
+        writer.WriteStr( item.varName );
+        writer.WriteIndices( item.indices );
+        writer.WriteValue( item.targetVal );
+        writer.WriteValue( item.stepVal );
+        writePC( item.startBodyPC );
+    }
+
+    writer.WriteCount( mGosubStack.size() );
+
+    for( const auto& pc : mGosubStack )
+        writePC( pc );
+
+    writer.WriteCount( mFakeInput.size() );
+
+    for( const auto& input : mFakeInput )
+    {
+        writer.WriteStr( input.pScript ? input.pScript->substr( input.scriptPos ) : input.str );
+        writer.Write( static_cast<uint8_t>((input.echo ? 1 : 0) | (input.pScript ? 2 : 0)) );
+    }
+
+    writePC( mProgramCounter );
+    writer.Write( static_cast<uint64_t>(mCurDataIdx) );
+    writer.Write( mRandom.GetState() );
+
+    const uint8_t flags = (mWaitingForInput ? 1 : 0) | (mWaitingForKey ? 2 : 0) | (mInputPromptShown ? 4 : 0) | (mResumingInput ? 8 : 0);
+    writer.Write( flags );
+    writer.Write( static_cast<uint32_t>(mInputItemsDone) );
+    writer.Write( static_cast<uint32_t>(mInputItemsToSkip) );
+    writer.Write( static_cast<uint32_t>(mStatementOffset) );
+    writer.Write( static_cast<uint32_t>(mSkipElseOnResume) );
+
+    const auto& buf = writer.GetBuffer();
+
+    if( !os.write( buf.data(), static_cast<std::streamsize>(buf.size()) ) )
+        throw std::runtime_error( "Can't write the checkpoint" );
+}
+
+void Runtime::LoadCheckpoint( std::istream& is )
+{
+    const std::string buf{ std::istreambuf_iterator<char>{ is }, std::istreambuf_iterator<char>{} };
+    BinaryReader reader{ buf };
+
+    char magic[sizeof( Magic )] = {};
+    reader.ReadBytes( magic, sizeof( magic ) );
+
+    if( std::memcmp( magic, Magic, sizeof( Magic ) ) != 0 )
+        throw std::runtime_error( "Not a checkpoint" );
+
+    const auto version = reader.Read<uint32_t>();
+
+    if( version < 1 || version > Version )
+        throw std::runtime_error( "Unsupported checkpoint version" );
+
+    if( reader.Read<uint32_t>() != BinaryByteOrderMark )
+        throw std::runtime_error( "Checkpoint has another byte order" );
+
+    if( reader.Read<uint64_t>() != mpProgram->GetHash() )
+        throw std::runtime_error( "Checkpoint belongs to another program" );
+
+    // Loaded aside, so a broken checkpoint leaves this runtime as it is
+    Runtime res{ *this };
+
+    res.mVars.clear();
+    res.mArrays.clear();
+    res.mVarNames.clear();
+    res.mFunctions.clear();
+    res.mForLoopStack.clear();
+    res.mGosubStack.clear();
+    res.mFakeInput.clear();
+
+    for( size_t count = reader.ReadCount( 5 ); count > 0; --count )
+    {
+        const std::string name = reader.ReadStr();
+        res.mVars.insert_or_assign( res.InternName( name ), reader.ReadValue() );
+    }
+
+    for( size_t count = reader.ReadCount( 12 ); count > 0; --count )
+    {
+        const std::string name = reader.ReadStr();
+        auto pArray = MakeArray( name );
+        ArrayVar& array = *pArray;
+
+        array.dimensions.resize( reader.ReadCount( sizeof( int_t ) ) );
+        reader.ReadBytes( array.dimensions.data(), array.dimensions.size() * sizeof( int_t ) );
+
+        const size_t elementsCount = reader.ReadCount( sizeof( int_t ) );
+        const size_t expectedCount = GetElementsCount( array.dimensions, array.type );
+
+        if( array.dimensions.empty() ? elementsCount != 0 : elementsCount != expectedCount )
+            throw std::runtime_error( "Checkpoint is broken" );
+
+        array.count = elementsCount;
+
+        if( array.type == ValueType::Str )
+        {
+            for( size_t pos = 0; pos < elementsCount; ++pos )
+            {
+                str_t str = reader.ReadStr();
+
+                if( !str.empty() )
+                    array.strings.emplace( pos, std::move( str ) );
+            }
+        }
+        else
+        {
+            // Read page by page, the zero pages stay unbacked in the array
+            const size_t size = elementsCount * GetNumberSize( array.type );
+            char page[ZeroedMemory::PageSize];
+            array.numbers = ZeroedMemory{ size };
+
+            for( size_t offset = 0; offset < size; offset += sizeof( page ) )
+            {
+                const size_t pageSize = std::min( sizeof( page ), size - offset );
+                reader.ReadBytes( page, pageSize );
+                array.numbers.CopyFrom( page, pageSize, offset );
+            }
+        }
+
+        for( size_t outOfRangeCount = reader.ReadCount( 5 ); outOfRangeCount > 0; --outOfRangeCount )
+        {
+            auto indices = reader.ReadIndices();
+            array.outOfRange.insert_or_assign( std::move( indices ), reader.ReadValue() );
+        }
+
+        res.mArrays.insert_or_assign( res.InternName( name ), std::move( pArray ) );
+    }
+
+    for( size_t count = reader.ReadCount( 12 ); count > 0; --count )
+    {
+        const std::string name = reader.ReadStr();
+        const std::string varName = reader.ReadStr();
+        res.DefineFuntion( name, varName, reader.ReadStr() );
+    }
+
+    const auto readPC = [&reader]() {
+        ProgramCounter pc{};
+        pc.line = reader.Read<uint64_t>();
+        pc.lineOffset = reader.Read<uint32_t>();
+        return pc;
+    };
+
+    for( size_t count = reader.ReadCount( 26 ); count > 0; --count )
+    {
+        ForLoopItem item;
+        item.varName = reader.ReadStr();
+        item.indices = reader.ReadIndices();
+        item.targetVal = reader.ReadValue();
+        item.stepVal = reader.ReadValue();
+        item.startBodyPC = readPC();
+        res.mForLoopStack.push_back( std::move( item ) );
+    }
+
+    for( size_t count = reader.ReadCount( 12 ); count > 0; --count )
+        res.mGosubStack.push_back( readPC() );
+
+    for( size_t count = reader.ReadCount( 5 ); count > 0; --count )
+    {
+        std::string str = reader.ReadStr();
+        const auto flags = reader.Read<uint8_t>();
+
+        if( (flags & 2) != 0 )
+            res.mFakeInput.push_back( { {}, (flags & 1) != 0, MakeSharedText( std::move( str ) ) } );
+        else
+            res.mFakeInput.push_back( { std::move( str ), (flags & 1) != 0 } );
+    }
+
+    res.mProgramCounter = readPC();
+    res.mCurDataIdx = static_cast<size_t>(reader.Read<uint64_t>());
+    res.mRandom.SetState( reader.Read<Random::State>() );
+
+    const auto flags = reader.Read<uint8_t>();
+    res.mWaitingForInput = (flags & 1) != 0;
+    res.mWaitingForKey = (flags & 2) != 0;
+    res.mInputPromptShown = (flags & 4) != 0;
+    res.mResumingInput = (flags & 8) != 0;
+    res.mInputItemsDone = reader.Read<uint32_t>();
+    res.mInputItemsToSkip = reader.Read<uint32_t>();
+    res.mStatementOffset = reader.Read<uint32_t>();
+    res.mSkipElseOnResume = version >= 3 ? reader.Read<uint32_t>() : 0;
+
+    if( !reader.IsEnd() )
+        throw std::runtime_error( "Checkpoint is broken" );
+
+    res.mLastStep = {};
+    *this = res;
+}
+}
@@ -0,0 +1,876 @@
+#include "emit_cpp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace codegen
+{
+namespace
+{
+    using namespace ast;
+
+    const char* GetTypeName( ValueType type )
+    {
+        switch( type )
+        {
+        case ValueType::Int:
+            return "int_t";
+
+        case ValueType::Float:
+            return "float_t";
+
+        default:
+            return "str_t";
+        }
+    }
+
+    // BASIC names are case insensitive and they are already in lower case,
+    // so the suffixes can be replaced by upper case letters without collisions
+    std::string Mangle( std::string_view name )
+    {
+        std::string res;
+
+        for( char c : name )
+        {
+            switch( c )
+            {
+            case '$': res += 'S'; break;
+            case '%': res += 'I'; break;
+            default: res += c;
+            }
+        }
+
+        return res;
+    }
+
+    std::string Quote( std::string_view str )
+    {
+        std::ostringstream os;
+
+        os << '"';
+
+        for( const unsigned char c : str )
+        {
+            switch( c )
+            {
+            case '\n': os << "\\n"; break;
+            case '\t': os << "\\t"; break;
+            case '\r': os << "\\r"; break;
+            case '\\': os << "\\\\"; break;
+            case '"': os << "\\\""; break;
+
+            default:
+                if( c < 0x20 || c >= 0x7F )
+                    os << '\\' << std::oct << std::setw( 3 ) << std::setfill( '0' ) << int{ c } << std::dec;
+                else
+                    os << c;
+            }
+        }
+
+        os << '"';
+
+        return os.str();
+    }
+
+    std::string FloatLiteral( float_t val )
+    {
+        if( !std::isfinite( val ) )
+            throw std::runtime_error( "Unsupported float constant" );
+
+        std::ostringstream os;
+
+        os << std::setprecision( 9 ) << val;
+
+        std::string res = os.str();
+
+        if( res.find_first_of( ".e" ) == std::string::npos )
+            res += ".0";
+
+        return res + 'f';
+    }
+
+    std::string ConstLiteral( const value_t& value )
+    {
+        struct Visitor
+        {
+            std::string operator()( int_t v ) const { return "int_t( " + std::to_string( v ) + " )"; }
+            std::string operator()( float_t v ) const { return FloatLiteral( v ); }
+            std::string operator()( const str_t& v ) const { return "str_t( " + Quote( v ) + " )"; }
+        };
+
+        return boost::apply_visitor( Visitor{}, value );
+    }
+
+    std::string ToFloat( const std::string& code, ValueType type )
+    {
+        switch( type )
+        {
+        case ValueType::Float:
+            return code;
+
+        case ValueType::Int:
+            return "static_cast<float_t>( " + code + " )";
+
+        default:
+            throw std::runtime_error( "Cannot be string" );
+        }
+    }
+
+    std::string ToInt( const std::string& code, ValueType type )
+    {
+        switch( type )
+        {
+        case ValueType::Int:
+            return code;
+
+        case ValueType::Float:
+            return "static_cast<int_t>( " + code + " )";
+
+        default:
+            throw std::runtime_error( "Cannot be string" );
+        }
+    }
+
+    // Mirrors the conversions of runtime::Runtime::Store()
+    std::string Convert( const std::string& code, ValueType from, ValueType to )
+    {
+        switch( to )
+        {
+        case ValueType::Int:
+            return ToInt( code, from );
+
+        case ValueType::Float:
+            return ToFloat( code, from );
+
+        default:
+            if( from != ValueType::Str )
+                throw std::runtime_error( "Expected String variable" );
+
+            return code;
+        }
+    }
+
+    std::string ToBool( const std::string& code, ValueType type )
+    {
+        return type == ValueType::Str ? "!(" + code + ").empty()" : "(" + code + ") != 0";
+    }
+
+    class Emitter
+    {
+    public:
+        explicit Emitter( const Program& program ) :
+            mProgram{ program }
+        {
+            for( const auto& line : program.lines )
+            {
+                mLineNums.insert( line.num );
+
+                for( const auto& pStmt : line.statements )
+                    ForEachStmt( *pStmt, [this]( const Stmt& stmt ) { Register( stmt ); } );
+            }
+        }
+
+        void Emit( std::ostream& os );
+
+    private:
+        struct FnInfo
+        {
+            ValueType argType;
+            std::vector<const DefFn*> defs;
+        };
+
+        void Register( const Stmt& stmt );
+
+        std::string EmitExpr( const Expr& expr );
+        std::string EmitTarget( const VarRef& var );
+        std::string EmitScalar( const std::string& name, ValueType type );
+
+        template<class FormatFnc>
+        std::string EmitSequenced( const std::vector<ExprPtr>& args, FormatFnc&& format, const std::string& retType = {} );
+
+        void EmitStatement( const Stmt& stmt, int indent );
+        void EmitBranch( const Branch& branch, int indent );
+        void EmitNextStep( const std::string& varName, int indent );
+        std::string EmitGoto( linenum_t line );
+
+        std::string EmitGotoEnd()
+        {
+            mEndReferenced = true;
+            return "goto L_end;";
+        }
+
+        std::ostream& Out( int indent )
+        {
+            return mOut << std::string( indent * 4, ' ' );
+        }
+
+        unsigned NewResumePoint()
+        {
+            return mResumePoints++;
+        }
+
+        FnInfo& GetFnInfo( const std::string& name );
+
+    private:
+        const Program& mProgram;
+        std::set<linenum_t> mLineNums;
+        std::set<linenum_t> mReferencedLines;
+        std::map<std::string, ValueType> mScalars;
+        std::map<std::string, ValueType> mArrays;
+        std::map<std::string, unsigned> mForVarIds;
+        std::map<std::string, FnInfo> mFunctions;
+        std::ostringstream mOut;
+        const DefFn* mpCurFn = nullptr;
+        std::optional<linenum_t> mNextLine;
+        bool mIsLastInLine = false;
+        unsigned mResumePoints = 0;
+        unsigned mTempVars = 0;
+        bool mNeedDispatch = false;
+        bool mEndReferenced = false;
+    };
+
+    void Emitter::Register( const Stmt& stmt )
+    {
+        if( const auto* pFor = std::get_if<For>( &stmt ) )
+        {
+            mForVarIds.try_emplace( pFor->var.name, static_cast<unsigned>(mForVarIds.size()) );
+        }
+        else if( const auto* pDef = std::get_if<DefFn>( &stmt ) )
+        {
+            const ValueType argType = runtime::DetectVarType( pDef->varName );
+            auto& info = mFunctions.try_emplace( pDef->name, FnInfo{ argType, {} } ).first->second;
+
+            if( info.argType != argType )
+                throw std::runtime_error( "Incompatible redefinition of FN " + pDef->name );
+
+            info.defs.push_back( pDef );
+        }
+    }
+
+    Emitter::FnInfo& Emitter::GetFnInfo( const std::string& name )
+    {
+        //A function without any DEF is still callable, it just fails at runtime
+        return mFunctions.try_emplace( name, FnInfo{ ValueType::Float, {} } ).first->second;
+    }
+
+    // The interpreter evaluates operands from left to right. C++ doesn't guarantee
+    // the order of function arguments evaluation, so it has to be enforced when
+    // more than one operand has side effects.
+    template<class FormatFnc>
+    std::string Emitter::EmitSequenced( const std::vector<ExprPtr>& args, FormatFnc&& format, const std::string& retType )
+    {
+        std::vector<std::string> codes;
+        size_t impureCount = 0;
+
+        for( const auto& arg : args )
+        {
+            codes.push_back( EmitExpr( *arg ) );
+            impureCount += !arg->pure;
+        }
+
+        if( impureCount < 2 )
+            return format( codes );
+
+        std::string res = "[&]()" + retType + " { ";
+
+        for( auto& code : codes )
+        {
+            const std::string tmpName = "t" + std::to_string( mTempVars++ );
+
+            res += "const auto " + tmpName + " = " + code + "; ";
+            code = tmpName;
+        }
+
+        return res + "return " + format( codes ) + "; }()";
+    }
+
+    std::string Emitter::EmitScalar( const std::string& name, ValueType type )
+    {
+        if( mpCurFn )
+        {
+            if( name != mpCurFn->varName )
+                throw std::runtime_error( "Unknown variable inside the function body: " + name );
+
+            return "arg";
+        }
+
+        mScalars.emplace( name, type );
+
+        return "v_" + Mangle( name );
+    }
+
+    std::string Emitter::EmitExpr( const Expr& expr )
+    {
+        const auto& args = expr.args;
+        const auto f = [&args]( const std::vector<std::string>& c, size_t i ) { return ToFloat( c[i], args[i]->type ); };
+        const auto i = [&args]( const std::vector<std::string>& c, size_t i ) { return ToInt( c[i], args[i]->type ); };
+
+        const auto binary = [&]( const char* szOp ) {
+            return EmitSequenced( args, [&]( const auto& c ) { return "(" + f( c, 0 ) + " " + szOp + " " + f( c, 1 ) + ")"; } );
+        };
+
+        const auto compare = [&]( const char* szOp ) {
+            return EmitSequenced( args, [&]( const auto& c ) {
+                return args[0]->type == ValueType::Str ?
+                    "int_t( " + c[0] + " " + szOp + " " + c[1] + " )" :
+                    "int_t( " + f( c, 0 ) + " " + szOp + " " + f( c, 1 ) + " )";
+            } );
+        };
+
+        // Both operands are always evaluated
+        const auto logical = [&]( const char* szOp ) {
+            return EmitSequenced( args, [&]( const auto& c ) { return "int_t( (" + i( c, 0 ) + " != 0) " + szOp + " (" + i( c, 1 ) + " != 0) )"; } );
+        };
+
+        const auto call = [&]( const char* szFnc, auto&& formatArgs ) {
+            return EmitSequenced( args, [&]( const auto& c ) { return szFnc + std::string( "( " ) + formatArgs( c ) + " )"; } );
+        };
+
+        switch( expr.op )
+        {
+        case Op::Const:
+            return ConstLiteral( expr.value );
+
+        case Op::Var:
+            return EmitScalar( expr.name, expr.type );
+
+        case Op::ArrayElem:
+        {
+            if( mpCurFn )
+                throw std::runtime_error( "Unknown variable inside the function body: " + expr.name );
+
+            mArrays.emplace( expr.name, expr.type );
+
+            return EmitSequenced( args, [&]( const auto& c ) {
+                std::string res = "a_" + Mangle( expr.name ) + ".Get( ";
+
+                for( size_t n = 0; n < c.size(); ++n )
+                    res += (n == 0 ? "" : ", ") + i( c, n );
+
+                return res + " )";
+            } );
+        }
+
+        case Op::Neg:
+            return "(-" + ToFloat( EmitExpr( *args[0] ), args[0]->type ) + ")";
+
+        case Op::Not:
+            return "int_t( !" + ToInt( EmitExpr( *args[0] ), args[0]->type ) + " )";
+
+        case Op::Add:
+            if( expr.type == ValueType::Str )
+                return EmitSequenced( args, []( const auto& c ) { return "(" + c[0] + " + " + c[1] + ")"; } );
+
+            return binary( "+" );
+
+        case Op::Sub: return binary( "-" );
+        case Op::Mul: return binary( "*" );
+        case Op::Div: return binary( "/" );
+
+        case Op::Pow: return call( "std::pow", [&]( const auto& c ) { return f( c, 0 ) + ", " + f( c, 1 ); } );
+
+        case Op::Eq: return compare( "==" );
+        case Op::NotEq: return compare( "!=" );
+        case Op::Less: return compare( "<" );
+        case Op::Greater: return compare( ">" );
+        case Op::LessEq: return compare( "<=" );
+        case Op::GreaterEq: return compare( ">=" );
+
+        case Op::And: return logical( "&" );
+        case Op::Or: return logical( "|" );
+
+        case Op::Sqr: return call( "std::sqrt", [&]( const auto& c ) { return f( c, 0 ); } );
+        case Op::Int: return call( "runtime::IntImpl", [&]( const auto& c ) { return f( c, 0 ); } );
+        case Op::Abs: return call( "std::fabs", [&]( const auto& c ) { return f( c, 0 ); } );
+        case Op::Left: return call( "runtime::SubStrImpl", [&]( const auto& c ) { return c[0] + ", 1, " + i( c, 1 ); } );
+        case Op::Right: return call( "runtime::RightImpl", [&]( const auto& c ) { return c[0] + ", " + i( c, 1 ); } );
+
+        case Op::Mid:
+            return call( "runtime::SubStrImpl", [&]( const auto& c ) {
+                return c[0] + ", " + i( c, 1 ) + (c.size() > 2 ? ", " + i( c, 2 ) : std::string{});
+            } );
+
+        case Op::Str: return call( "runtime::ToStrImpl", [&]( const auto& c ) { return "value_t{ " + c[0] + " }"; } );
+        case Op::Val: return call( "runtime::ValImpl", [&]( const auto& c ) { return c[0]; } );
+        case Op::Len: return call( "static_cast<int_t>", [&]( const auto& c ) { return "(" + c[0] + ").length()"; } );
+        case Op::Asc: return call( "runtime::AscImpl", [&]( const auto& c ) { return c[0]; } );
+        case Op::Chr: return call( "str_t", [&]( const auto& c ) { return "1, static_cast<char>( " + i( c, 0 ) + " )"; } );
+        case Op::Rnd: return call( "rt.Rnd", [&]( const auto& c ) { return f( c, 0 ); } );
+
+        case Op::Inkey:
+            return "rt.Inkey()";
+
+        case Op::CallFn:
+        {
+            const FnInfo& info = GetFnInfo( expr.name );
+            const std::string argCode = Convert( EmitExpr( *args[0] ), args[0]->type, info.argType );
+
+            return "rt.CheckFn( fn_" + Mangle( expr.name ) + ", " + Quote( expr.name ) + " )( rt, " + argCode + " )";
+        }
+        }
+
+        throw std::logic_error( "Unknown operation" );
+    }
+
+    std::string Emitter::EmitTarget( const VarRef& var )
+    {
+        if( var.indices.empty() )
+            return EmitScalar( var.name, var.type );
+
+        mArrays.emplace( var.name, var.type );
+
+        return EmitSequenced( var.indices, [&]( const auto& c ) {
+            std::string res = "a_" + Mangle( var.name ) + ".At( ";
+
+            for( size_t n = 0; n < c.size(); ++n )
+                res += (n == 0 ? "" : ", ") + ToInt( c[n], var.indices[n]->type );
+
+            return res + " )";
+        }, std::string( " -> " ) + GetTypeName( var.type ) + "&" );
+    }
+
+    std::string Emitter::EmitGoto( linenum_t line )
+    {
+        if( mLineNums.count( line ) == 0 )
+            return "throw std::runtime_error( \"Unknown line " + std::to_string( line ) + "\" );";
+
+        mReferencedLines.insert( line );
+
+        return "goto L" + std::to_string( line ) + ";";
+    }
+
+    void Emitter::EmitBranch( const Branch& branch, int indent )
+    {
+        if( const auto* pLine = std::get_if<linenum_t>( &branch ) )
+            Out( indent ) << EmitGoto( *pLine ) << '\n';
+        else
+            EmitStatement( *std::get<StmtPtr>( branch ), indent );
+    }
+
+    // See runtime::Runtime::NextImpl()
+    void Emitter::EmitNextStep( const std::string& varName, int indent )
+    {
+        const ValueType type = runtime::DetectVarType( varName );
+        const std::string var = EmitScalar( varName, type );
+
+        Out( indent ) << "cur = " << ToFloat( var, type ) << " + item.stepVal;\n";
+        Out( indent ) << var << " = " << Convert( "cur", ValueType::Float, type ) << ";\n";
+    }
+
+    void Emitter::EmitStatement( const Stmt& stmtVariant, int indent )
+    {
+        struct Visitor
+        {
+            void operator()( const Nop& ) const {}
+
+            void operator()( const Print& stmt ) const
+            {
+                for( const auto& item : stmt.items )
+                {
+                    const std::string code = e.EmitExpr( *item.value );
+
+                    if( item.tab )
+                        e.Out( indent ) << "rt.PrintTab( " << ToInt( code, item.value->type ) << " );\n";
+                    else
+                        e.Out( indent ) << "rt.Print( " << code << " );\n";
+                }
+            }
+
+            void operator()( const Input& stmt ) const
+            {
+                for( const auto& item : stmt.items )
+                    e.Out( indent ) << "rt.Input( " << Quote( item.prompt ) << ", " << e.EmitTarget( item.var ) << " );\n";
+            }
+
+            void operator()( const Assign& stmt ) const
+            {
+                const std::string target = e.EmitTarget( stmt.var );
+                const std::string value = Convert( e.EmitExpr( *stmt.value ), stmt.value->type, stmt.var.type );
+                bool impureTarget = false;
+
+                for( const auto& idx : stmt.var.indices )
+                    impureTarget |= !idx->pure;
+
+                // Indices are evaluated before the value, C++17 guarantees the opposite order for "="
+                if( impureTarget && !stmt.value->pure )
+                {
+                    e.Out( indent ) << "{\n";
+                    e.Out( indent + 1 ) << "auto& ref = " << target << ";\n";
+                    e.Out( indent + 1 ) << "ref = " << value << ";\n";
+                    e.Out( indent ) << "}\n";
+                }
+                else
+                {
+                    e.Out( indent ) << target << " = " << value << ";\n";
+                }
+            }
+
+            void operator()( const Dim& stmt ) const
+            {
+                for( const auto& item : stmt.items )
+                {
+                    const ValueType type = runtime::DetectVarType( item.name );
+
+                    if( item.dimensions.empty() )
+                    {
+                        e.Out( indent ) << e.EmitScalar( item.name, type ) << " = " << GetTypeName( type ) << "{};\n";
+                        continue;
+                    }
+
+                    e.mArrays.emplace( item.name, type );
+                    e.Out( indent ) << "a_" << Mangle( item.name ) << ".Dim( { ";
+
+                    for( size_t n = 0; n < item.dimensions.size(); ++n )
+                    {
+                        const auto& dim = *item.dimensions[n];
+                        e.mOut << (n == 0 ? "" : ", ") << ToInt( e.EmitExpr( dim ), dim.type );
+                    }
+
+                    e.mOut << " } );\n";
+                }
+            }
+
+            void operator()( const Goto& stmt ) const
+            {
+                e.Out( indent ) << e.EmitGoto( stmt.line ) << '\n';
+            }
+
+            void operator()( const Gosub& stmt ) const
+            {
+                const unsigned resumePoint = e.NewResumePoint();
+
+                e.Out( indent ) << "rt.Gosub( " << resumePoint << " );\n";
+                e.Out( indent ) << e.EmitGoto( stmt.line ) << '\n';
+                e.Out( indent - 1 ) << "R" << resumePoint << ":;\n";
+            }
+
+            void operator()( const Return& ) const
+            {
+                e.mNeedDispatch = true;
+                e.Out( indent ) << "resume = rt.Return();\n";
+                e.Out( indent ) << "goto dispatch;\n";
+            }
+
+            void operator()( const On& stmt ) const
+            {
+                const unsigned resumePoint = stmt.gosub ? e.NewResumePoint() : 0;
+                const std::string index = ToInt( e.EmitExpr( *stmt.index ), stmt.index->type );
+
+                e.Out( indent ) << "switch( rt.OnBranch( " << index << ", " << stmt.lines.size() << " ) )\n";
+                e.Out( indent ) << "{\n";
+
+                for( size_t n = 0; n < stmt.lines.size(); ++n )
+                {
+                    e.Out( indent ) << "case " << n + 1 << ":\n";
+
+                    if( stmt.gosub )
+                        e.Out( indent + 1 ) << "rt.Gosub( " << resumePoint << " );\n";
+
+                    e.Out( indent + 1 ) << e.EmitGoto( stmt.lines[n] ) << '\n';
+                }
+
+                e.Out( indent ) << "}\n";
+
+                if( stmt.gosub )
+                    e.Out( indent - 1 ) << "R" << resumePoint << ":;\n";
+            }
+
+            void operator()( const If& stmt ) const
+            {
+                e.Out( indent ) << "if( " << ToBool( e.EmitExpr( *stmt.cond ), stmt.cond->type ) << " )\n";
+                e.Out( indent ) << "{\n";
+                e.EmitBranch( stmt.then, indent + 1 );
+                e.Out( indent ) << "}\n";
+
+                // A false condition without ELSE skips the rest of the line
+                if( !stmt.otherwise && e.mIsLastInLine )
+                    return;
+
+                e.Out( indent ) << "else\n";
+                e.Out( indent ) << "{\n";
+
+                if( stmt.otherwise )
+                {
+                    e.EmitBranch( *stmt.otherwise, indent + 1 );
+                }
+                else
+                {
+                    e.Out( indent + 1 ) << (e.mNextLine ? e.EmitGoto( *e.mNextLine ) : e.EmitGotoEnd()) << '\n';
+                }
+
+                e.Out( indent ) << "}\n";
+            }
+
+            void operator()( const For& stmt ) const
+            {
+                const unsigned resumePoint = e.NewResumePoint();
+                const std::string var = e.EmitScalar( stmt.var.name, stmt.var.type );
+
+                // Target and step are calculated before the variable is assigned
+                e.Out( indent ) << "{\n";
+                e.Out( indent + 1 ) << "const " << GetTypeName( stmt.var.type ) << " initVal = "
+                    << Convert( e.EmitExpr( *stmt.initVal ), stmt.initVal->type, stmt.var.type ) << ";\n";
+                e.Out( indent + 1 ) << "const float_t targetVal = " << ToFloat( e.EmitExpr( *stmt.targetVal ), stmt.targetVal->type ) << ";\n";
+                e.Out( indent + 1 ) << "const float_t stepVal = " << ToFloat( e.EmitExpr( *stmt.stepVal ), stmt.stepVal->type ) << ";\n";
+                e.Out( indent + 1 ) << var << " = initVal;\n";
+                e.Out( indent + 1 ) << "rt.ForLoop( " << e.mForVarIds.at( stmt.var.name ) << ", targetVal, stepVal, " << resumePoint << " );\n";
+                e.Out( indent ) << "}\n";
+                e.Out( indent - 1 ) << "R" << resumePoint << ":;\n";
+            }
+
+            void operator()( const Next& stmt ) const
+            {
+                e.mNeedDispatch = true;
+
+                if( stmt.varNames.empty() )
+                {
+                    EmitNext( {}, "native::Runtime::AnyForLoopVar" );
+                    return;
+                }
+
+                for( const auto& name : stmt.varNames )
+                {
+                    const auto it = e.mForVarIds.find( name );
+
+                    if( it == e.mForVarIds.end() )
+                    {
+                        // There is no FOR with this variable, so it always fails
+                        e.Out( indent ) << "rt.Next( " << e.mForVarIds.size() << " );\n";
+                        return;
+                    }
+
+                    EmitNext( name, std::to_string( it->second ) );
+                }
+            }
+
+            void EmitNext( const std::string& varName, const std::string& varId ) const
+            {
+                e.Out( indent ) << "{\n";
+                e.Out( indent + 1 ) << "const auto& item = rt.Next( " << varId << " );\n";
+                e.Out( indent + 1 ) << "float_t cur{};\n\n";
+
+                if( !varName.empty() )
+                {
+                    e.EmitNextStep( varName, indent + 1 );
+                }
+                else
+                {
+                    e.Out( indent + 1 ) << "switch( item.varId )\n";
+                    e.Out( indent + 1 ) << "{\n";
+
+                    for( const auto& [name, id] : e.mForVarIds )
+                    {
+                        e.Out( indent + 1 ) << "case " << id << ":\n";
+                        e.EmitNextStep( name, indent + 2 );
+                        e.Out( indent + 2 ) << "break;\n";
+                    }
+
+                    e.Out( indent + 1 ) << "default:\n";
+                    e.Out( indent + 2 ) << "throw std::logic_error( \"Unknown FOR variable\" );\n";
+                    e.Out( indent + 1 ) << "}\n";
+                }
+
+                e.Out( indent + 1 ) << "\n";
+                e.Out( indent + 1 ) << "if( item.IsContinue( cur ) )\n";
+                e.Out( indent + 1 ) << "{\n";
+                e.Out( indent + 2 ) << "resume = item.resumePoint;\n";
+                e.Out( indent + 2 ) << "goto dispatch;\n";
+                e.Out( indent + 1 ) << "}\n\n";
+                e.Out( indent + 1 ) << "rt.PopForLoop();\n";
+                e.Out( indent ) << "}\n";
+            }
+
+            void operator()( const End& ) const
+            {
+                e.Out( indent ) << e.EmitGotoEnd() << '\n';
+            }
+
+            void operator()( const Read& stmt ) const
+            {
+                for( const auto& var : stmt.vars )
+                    e.Out( indent ) << "rt.Read( " << e.EmitTarget( var ) << " );\n";
+            }
+
+            void operator()( const Restore& stmt ) const
+            {
+                if( stmt.line == runtime::MaxLineNum )
+                    e.Out( indent ) << "rt.Restore();\n";
+                else
+                    e.Out( indent ) << "rt.Restore( " << stmt.line << " );\n";
+            }
+
+            void operator()( const Randomize& stmt ) const
+            {
+                e.Out( indent ) << "rt.Randomize( " << ToInt( e.EmitExpr( *stmt.seed ), stmt.seed->type ) << " );\n";
+            }
+
+            void operator()( const DefFn& stmt ) const
+            {
+                const auto& defs = e.mFunctions.at( stmt.name ).defs;
+                const auto idx = std::find( defs.begin(), defs.end(), &stmt ) - defs.begin();
+
+                e.Out( indent ) << "fn_" << Mangle( stmt.name ) << " = &fn_" << Mangle( stmt.name ) << '_' << idx << ";\n";
+            }
+
+            Emitter& e;
+            int indent;
+        };
+
+        std::visit( Visitor{ *this, indent }, static_cast<const Stmt::variant&>(stmtVariant) );
+    }
+
+    void Emitter::Emit( std::ostream& os )
+    {
+        std::vector<std::string> lineCodes;
+
+        for( size_t n = 0; n < mProgram.lines.size(); ++n )
+        {
+            const auto& line = mProgram.lines[n];
+
+            mNextLine = n + 1 < mProgram.lines.size() ? std::optional{ mProgram.lines[n + 1].num } : std::nullopt;
+
+            mOut.str( "" );
+
+            try
+            {
+                for( size_t i = 0; i < line.statements.size(); ++i )
+                {
+                    mIsLastInLine = i + 1 == line.statements.size();
+                    EmitStatement( *line.statements[i], 3 );
+                }
+            }
+            catch( const std::runtime_error& e )
+            {
+                throw std::runtime_error( "Line " + std::to_string( line.num ) + " " + e.what() );
+            }
+
+            lineCodes.push_back( mOut.str() );
+        }
+
+        // Function bodies can only refer to their argument and other functions
+        std::vector<std::string> fnCodes;
+
+        for( const auto& [name, info] : mFunctions )
+        {
+            for( size_t n = 0; n < info.defs.size(); ++n )
+            {
+                const DefFn& def = *info.defs[n];
+                const ValueType resType = GetFnType( name );
+
+                mpCurFn = &def;
+                mOut.str( "" );
+                mOut << "    " << GetTypeName( resType ) << " fn_" << Mangle( name ) << '_' << n
+                     << "( Runtime& rt, " << GetTypeName( info.argType ) << " arg )\n";
+                mOut << "    {\n";
+                mOut << "        return " << Convert( EmitExpr( *def.body ), def.body->type, resType ) << ";\n";
+                mOut << "    }\n\n";
+                mpCurFn = nullptr;
+
+                fnCodes.push_back( mOut.str() );
+            }
+        }
+
+        os << "// Generated by `basic_int --emit-cpp`\n\n";
+        os << "#include \"native_runtime.h\"\n\n";
+        os << "#include <cmath>\n\n";
+        os << "namespace basic_program\n";
+        os << "{\n";
+        os << "    using native::int_t;\n";
+        os << "    using native::float_t;\n";
+        os << "    using native::str_t;\n";
+        os << "    using native::value_t;\n";
+        os << "    using native::Array;\n";
+        os << "    using native::Runtime;\n\n";
+
+        for( const auto& [name, info] : mFunctions )
+            os << "    " << GetTypeName( GetFnType( name ) ) << " ( *fn_" << Mangle( name ) << " )( Runtime&, "
+               << GetTypeName( info.argType ) << " ) = nullptr;\n";
+
+        if( !mFunctions.empty() )
+            os << '\n';
+
+        for( const auto& code : fnCodes )
+            os << code;
+
+        os << "    int Run( int argc, char* argv[] )\n";
+        os << "    {\n";
+        os << "        Runtime rt{ argc, argv,\n";
+        os << "            {";
+
+        for( size_t n = 0; n < mProgram.data.size(); ++n )
+            os << (n % 8 == 0 ? "\n                " : " ") << "value_t{ " << ConstLiteral( mProgram.data[n] ) << " },";
+
+        os << "\n            },\n";
+        os << "            {";
+
+        for( const auto& [line, pos] : mProgram.lineToDataPos )
+            os << " { " << line << ", " << pos << " },";
+
+        os << " }\n";
+        os << "        };\n\n";
+
+        for( const auto& [name, type] : mScalars )
+            os << "        " << GetTypeName( type ) << " v_" << Mangle( name ) << "{};\n";
+
+        for( const auto& [name, type] : mArrays )
+            os << "        Array<" << GetTypeName( type ) << "> a_" << Mangle( name ) << ";\n";
+
+        if( mNeedDispatch )
+            os << "        unsigned resume = 0;\n";
+
+        os << '\n';
+        os << "        try\n";
+        os << "        {\n";
+
+        for( size_t n = 0; n < mProgram.lines.size(); ++n )
+        {
+            const linenum_t num = mProgram.lines[n].num;
+
+            if( mReferencedLines.count( num ) != 0 )
+                os << "        L" << num << ":\n";
+
+            os << lineCodes[n];
+        }
+
+        if( mNeedDispatch )
+        {
+            os << "            " << EmitGotoEnd() << "\n\n";
+            os << "        dispatch:\n";
+            os << "            switch( resume )\n";
+            os << "            {\n";
+
+            for( unsigned n = 0; n < mResumePoints; ++n )
+                os << "            case " << n << ": goto R" << n << ";\n";
+
+            os << "            }\n\n";
+        }
+
+        if( mEndReferenced )
+            os << "        L_end:;\n";
+
+        os << "        }\n";
+        os << "        catch( const std::exception& e )\n";
+        os << "        {\n";
+        os << "            return rt.ReportError( e );\n";
+        os << "        }\n\n";
+        os << "        return 0;\n";
+        os << "    }\n";
+        os << "}\n\n";
+        os << "int main( int argc, char* argv[] )\n";
+        os << "{\n";
+        os << "    return basic_program::Run( argc, argv );\n";
+        os << "}\n";
+    }
+}
+
+void EmitCpp( const ast::Program& program, std::ostream& os )
+{
+    Emitter{ program }.Emit( os );
+}
+
+}
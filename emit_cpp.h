@@ -0,0 +1,17 @@
+#ifndef BASIC_INT_EMIT_CPP_H
+#define BASIC_INT_EMIT_CPP_H
+
+#include <ostream>
+
+#include "ast.h"
+
+namespace codegen
+{
+    // Translates the program into a standalone C++ source that has to be linked
+    // with native_runtime.cpp, value.cpp and platform.cpp.
+    // Each BASIC line becomes a label, GOSUB/RETURN and FOR/NEXT use the explicit
+    // return stacks of native::Runtime and the numbered resume points.
+    void EmitCpp( const ast::Program& program, std::ostream& os );
+}
+
+#endif // BASIC_INT_EMIT_CPP_H
@@ -3,6 +3,7 @@
 #include "grammar.h"
 #include "grammar_actions.hpp"
 #include "runtime.h"
+#include "keyword_parser.hpp"
 
 #include <boost/fusion/adapted/std_tuple.hpp>
 
@@ -39,11 +40,12 @@ namespace main_pass
     x3::rule<class log_or, value_t> const log_or( "log_or" );
     x3::rule<class double_args, std::tuple<value_t, value_t>> const double_args( "double_args" );
     x3::rule<class triple_args, std::tuple<value_t, value_t, value_t>> const triple_args( "triple_args" );
-    x3::rule<class identifier, std::string> const identifier( "identifier" );
-    x3::rule<class var_name, std::string> const var_name( "var_name" );
+    x3::rule<class identifier, std::string_view> const identifier( "identifier" );
+    x3::rule<class var_name, VarName> const var_name( "var_name" );
     x3::rule<class string_lit, std::string> const string_lit( "string_lit" );
     
-    x3::rule<class next_stmt, std::string> const next_stmt( "next_stmt" );
+    x3::rule<class next_stmt> const next_stmt( "next_stmt" );
+    x3::rule<class if_then, linenum_t> const if_then( "if_then" );
     x3::rule<class expression_int, int_t> const expression_int( "expression_int" );
 
     const auto expression_def =
@@ -82,14 +84,15 @@ namespace main_pass
             expression[print_op]
             );
 
+    // Statements below don't include their keywords, see statement_def
+
     const auto print_stmt =
-        (no_case["print"] >> print_arg >> *(';' >> print_arg) >> (
+        (print_arg >> *(';' >> print_arg) >> (
             ';' | (&statement_end >> attr( value_t{ "\n" } )[print_op])
             )) |
-        no_case["print"] >> attr( value_t{ "\n" } )[print_op];
+        attr( value_t{ "\n" } )[print_op];
 
     const auto input_stmt =
-        no_case["input"] >>
         (
             (string_lit >> ';' >> var_name)[input_op] |
             (attr( std::string{ "?" } ) >> var_name)[input_op]
@@ -97,11 +100,11 @@ namespace main_pass
         *((',' >> attr( std::string{ "??" } ) >> var_name)[input_op]);
 
     const auto next_stmt_def =
-        no_case["next"] >> (var_name % ',')[next_stmt_op] |
-        no_case["next"] >> attr( std::vector<std::string>{} )[next_stmt_op];
+        var_name[next_var_op] % ',' |
+        eps[next_stmt_op];
 
     const auto for_stmt =
-        (no_case["for"] >> var_name >> '=' >> expression >> no_case["to"] >> expression >>
+        (var_name >> '=' >> expression >> no_case["to"] >> expression >>
           -(no_case["step"] >> expression)
           )[for_stmt_op];
 
@@ -110,17 +113,20 @@ namespace main_pass
     //during backtracking:
     //  https://github.com/boostorg/spirit/issues/378
     //  https://stackoverflow.com/a/49309385/3415353  
+    //The condition is parsed once, it's evaluated while parsing and may read a key with INKEY$
+    const auto if_then_def =
+        (no_case["then"] | no_case["goto"]) >> line_num |
+        -no_case["then"] >> attr(MaxLineNum);
+
     const auto if_stmt =
-        (no_case["if"] >> expression >> (no_case["then"] | no_case["goto"]) >> line_num)[if_stmt_op] |
-        (no_case["if"] >> expression >> -no_case["then"] >> attr(MaxLineNum))[if_stmt_op]
-        ;
+        (expression >> if_then)[if_stmt_op];
 
     const auto else_statement_def =
         no_case["else"] >> -line_num[else_stmt_op];
 
     const auto on_stmt =
-        (no_case["on"] >> expression >> no_case["goto"] >> line_num % ',')[on_goto_stmt_op] |
-        (no_case["on"] >> expression >> no_case["gosub"] >> line_num % ',')[on_gosub_stmt_op]
+        (expression >> no_case["goto"] >> line_num % ',')[on_goto_stmt_op] |
+        (expression >> no_case["gosub"] >> line_num % ',')[on_gosub_stmt_op]
         ;
 
     const auto var_name_dim =
@@ -129,43 +135,69 @@ namespace main_pass
         ;
 
     const auto restore_stmt = 
-        no_case["restore"] >> line_num [restore_stmt_op] |
-        no_case["restore"] >> attr( MaxLineNum )[restore_stmt_op]
+        line_num [restore_stmt_op] |
+        attr( MaxLineNum )[restore_stmt_op]
         ;
 
+    // The keyword table selects the only statement to try. Assignment goes last because
+    // variable names may start with a keyword, e.g. "ONE = 1"
+    const auto statement_keywords = keyword_dispatch(
+        "text", eps,
+        "home", eps,
+        "cls", eps,
+        "stop", eps[stop_stmt_op],
+        "print", print_stmt,
+        "input", input_stmt,
+        "if", if_stmt,
+        "on", on_stmt,
+        "goto", line_num[goto_stmt_op],
+        "gosub", line_num[gosub_stmt_op],
+        "return", eps[return_stmt_op],
+        "for", for_stmt,
+        "next", next_stmt,
+        "end", eps[end_stmt_op],
+        "dim", var_name_dim % ',',
+        "restore", restore_stmt,
+        "read", var_name[read_stmt_op] % ',',
+        "randomize", expression[randomize_stmt_op],
+        "rem", omit[lexeme[*char_]],
+        "def", no_case["fn"] >> (identifier >> '(' >> identifier >> ')' >> '=' >> lexeme[+~char_(':')])[def_stmt_op]
+    );
+
+    // The position is needed to execute INPUT again after waiting for the input
     const auto statement_def =
-        no_case["text"] |
-        no_case["home"] |
-        no_case["cls"] |
-        no_case["stop"][stop_stmt_op] |
-        print_stmt |
-        input_stmt |
-        if_stmt |
-        on_stmt |
-        no_case["goto"] >> line_num[goto_stmt_op] |
-        no_case["gosub"] >> line_num[gosub_stmt_op] |
-        no_case["return"][return_stmt_op] |
-        for_stmt |
-        next_stmt |
-        no_case["end"][end_stmt_op] |
-        no_case["dim"] >> var_name_dim % ',' |
-        restore_stmt |
-        no_case["read"] >> var_name[read_stmt_op] % ',' |
-        no_case["randomize"] >> expression[randomize_stmt_op] |
-        no_case["rem"] >> omit[lexeme[*char_]] |
-        no_case["def"] >> no_case["fn"] >> (identifier >> '(' >> identifier >> ')' >> '=' >> lexeme[+~char_(':')])[def_stmt_op] |
+        eps[begin_statement_op] >> statement_keywords |
         (-no_case["let"] >> var_name >> '=' >> expression)[assing_var_op]
         ;
 
     // Technically, we should exclude all keywords here, but only ELSE is necessary due to 
     // the crazy PRINT syntax that allows multiple statements not divided by any separator 
-    const auto identifier_def = !no_case["else"] >> x3::raw[lexeme[(x3::alpha | '_') >> *(x3::alnum | '_') >> -(lit( '%' ) | '$')]];
+    const auto identifier_def = !no_case["else"] >> x3::raw[lexeme[(x3::alpha | '_') >> *(x3::alnum | '_') >> -(lit( '%' ) | '$')]][view_op];
 
     const auto var_name_def =
-        identifier[cpy_op] >> char_( '(' )[append_op] >> expression[append_idx_op] % char_( ',' )[append_op] >> char_( ')' )[append_op] |
-        identifier[cpy_op]
+        identifier[name_op] >> '(' >> expression[append_idx_op] % ',' >> ')' |
+        identifier[name_op]
         ;
 
+    // A failed builtin falls back to a variable with the same prefix, e.g. "LENGTH"
+    const auto builtin_keywords = keyword_dispatch(
+        "not", term[not_op],
+        "sqr", single_arg[sqr_op],
+        "int", single_arg[int_op],
+        "abs", single_arg[abs_op],
+        "left$", double_args[left_op],
+        "right$", double_args[right_op],
+        "mid$", triple_args[mid_op] | double_args[mid2_op],
+        "str$", single_arg[str_op],
+        "val", single_arg[val_op],
+        "len", single_arg[len_op],
+        "asc", single_arg[asc_op],
+        "chr$", single_arg[chr_op],
+        "rnd", single_arg[rnd_op],
+        "inkey$", eps[inkey_op],
+        "fn", (identifier >> single_arg)[call_fn_op]
+    );
+
     const auto term_def =
         strict_float[cpy_op] |
         int_[cpy_int_op] |
@@ -173,22 +205,7 @@ namespace main_pass
         '(' >> expression[cpy_op] >> ')' |
         '-' >> term[neg_op] |
         '+' >> term[cpy_op] |
-        (no_case["not"] >> term[not_op]) |
-        no_case["sqr"] >> single_arg[sqr_op] |
-        no_case["int"] >> single_arg[int_op] |
-        no_case["abs"] >> single_arg[abs_op] |
-        no_case["left$"] >> double_args[left_op] |
-        no_case["right$"] >> double_args[right_op] |
-        no_case["mid$"] >> triple_args[mid_op] |
-        no_case["mid$"] >> double_args[mid2_op] |
-        no_case["str$"] >> single_arg[str_op] |
-        no_case["val"] >> single_arg[val_op] |
-        no_case["len"] >> single_arg[len_op] |
-        no_case["asc"] >> single_arg[asc_op] |
-        no_case["chr$"] >> single_arg[chr_op] |
-        no_case["rnd"] >> single_arg[rnd_op] |
-        no_case["inkey$"][inkey_op] |
-        no_case["fn"] >> (identifier >> single_arg) [call_fn_op] |
+        builtin_keywords |
         var_name[load_var_op]
         ;
 
@@ -230,7 +247,8 @@ namespace main_pass
             );
 
     BOOST_SPIRIT_DEFINE( expression, expression_int, exponent, mult_div, term, add_sub, relational, log_and, log_or,
-                         double_args, triple_args, identifier, var_name, string_lit, statement, else_statement, sequence_separator, next_stmt
+                         double_args, triple_args, identifier, var_name, string_lit, statement, else_statement, sequence_separator, next_stmt,
+                         if_then
     );
 
     expression_type expression_rule()
@@ -265,32 +283,39 @@ namespace preparse
     using x3::lexeme;
     using main_pass::line_num;
     using main_pass::strict_float;
-    using main_pass::string_lit;
 
     line_type const line( "line" );
     x3::rule<class statement> const statement( "statement" );
+    x3::rule<class text, std::string_view> const text( "text" );
+    x3::rule<class data_str, std::string_view> const data_str( "data_str" );
+
+    // The same as string_lit, but the program keeps the view of the source till READ
+    const auto data_str_def = lexeme['"' >> x3::raw[*~char_( '"' )][view_op] >> '"'];
 
     const auto data_stmt =
         no_case["data"] >> (
             strict_float[data_op] |
             int_[data_op] |
-            string_lit[data_op]
+            data_str[data_op]
             ) % ',';
 
     const auto statement_def =
         no_case["rem"] >> omit[lexeme[*char_]] |
         data_stmt;
 
+    // A view of the rest of the line, the program references the source instead of copying it
+    const auto text_def = x3::raw[lexeme[+char_]][view_op];
+
     const auto num_line =
-        (line_num[update_cur_line_op] >> statement % ':' >> attr(std::string{}))[add_num_line_op] |
-        (line_num >> lexeme[+char_])[add_num_line_op];
+        (line_num[update_cur_line_op] >> statement % ':' >> attr(std::string_view{}))[add_num_line_op] |
+        (line_num >> text)[add_num_line_op];
 
     const auto line_def =
         num_line |
-        ':' >> lexeme[+char_][append_line_op] |
+        ':' >> text[append_line_op] |
         eoi;
 
-    BOOST_SPIRIT_DEFINE( line, statement );
+    BOOST_SPIRIT_DEFINE( line, statement, text, data_str );
 
     line_type line_rule()
     {
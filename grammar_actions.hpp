@@ -25,22 +25,22 @@ namespace actions
         _val( ctx ) = _attr( ctx );
     };
 
-    constexpr auto append_op = []( auto& ctx )
+    // Points into the line buffer, which outlives the statement being parsed
+    constexpr auto view_op = []( auto& ctx )
     {
-        auto& op1 = _val( ctx );
-        auto&& op2 = _attr( ctx );
+        const auto& range = _attr( ctx );
 
-        op1 += op2;
+        _val( ctx ) = range.empty() ? std::string_view{} : std::string_view{ &*range.begin(), static_cast<size_t>(range.size()) };
     };
 
-    constexpr auto append_idx_op = []( auto& ctx )
+    constexpr auto name_op = []( auto& ctx )
     {
-        auto& op1 = _val( ctx );
-        auto&& op2 = _attr( ctx );
-
-        const auto idx = ForceInt( op2 );
+        _val( ctx ) = runtime::VarName{ _attr( ctx ) };
+    };
 
-        op1 += std::to_string( idx );
+    constexpr auto append_idx_op = []( auto& ctx )
+    {
+        _val( ctx ).indices.push_back( ForceInt( _attr( ctx ) ) );
     };
 
     constexpr auto cpy_int_op = []( auto& ctx )
@@ -148,18 +148,6 @@ namespace actions
         _val( ctx ) = int_t{ ForceInt( _val( ctx ) ) || ForceInt( _attr( ctx ) ) };
     };
 
-    str_t SubStrImpl( const str_t& str, int_t pos, int_t count = -1 )
-    {
-        --pos;
-
-        if( pos < 0 )
-            pos = 0;
-        else if( static_cast<size_t>(pos) > str.size() )
-            return str_t{};
-
-        return str.substr( pos, count );
-    }
-
     constexpr auto left_op = []( auto& ctx ) {
         auto&& [o1, o2] = _attr( ctx );
         auto&& str = ForceStr( o1 );
@@ -190,7 +178,7 @@ namespace actions
         auto&& str = ForceStr( o1 );
         auto&& count = ForceInt( o2 );            
 
-        _val( ctx ) = SubStrImpl( str, static_cast<int_t>(str.length()) - count + 1, count );
+        _val( ctx ) = RightImpl( str, count );
     };
     
     constexpr auto str_op = []( auto& ctx ) {
@@ -201,12 +189,7 @@ namespace actions
 
     constexpr auto val_op = []( auto& ctx ) {
         auto&& arg = _attr( ctx );
-        auto&& s = ForceStr( arg );
-
-        char* ending = nullptr;
-        const float res = std::strtof( s.c_str(), &ending );
-
-        _val( ctx ) = *ending == '\0' ? res : float_t{0};
+        _val( ctx ) = ValImpl( ForceStr( arg ) );
     };
 
     constexpr auto len_op = []( auto& ctx ) {
@@ -216,12 +199,7 @@ namespace actions
 
     constexpr auto asc_op = []( auto& ctx ) {
         auto&& arg = _attr( ctx );
-        auto&& s = ForceStr( arg );
-
-        if( s.empty() )
-            throw std::runtime_error( "Illegal ASC() call" );
-
-        _val( ctx ) = int_t{ s[0] };
+        _val( ctx ) = AscImpl( ForceStr( arg ) );
     };    
     
     constexpr auto chr_op = []( auto& ctx ) {
@@ -238,12 +216,7 @@ namespace actions
 
     constexpr auto int_op = []( auto& ctx ) {
         const auto& v = _attr( ctx );
-        float_t val = ForceFloat( v );
-
-        if ( val < 0 )
-            val -= 0.5f;
-
-        _val( ctx ) = static_cast<int_t>(val);
+        _val( ctx ) = IntImpl( ForceFloat( v ) );
     };
 
     constexpr auto abs_op = []( auto& ctx ) {
@@ -253,11 +226,8 @@ namespace actions
 
     constexpr auto rnd_op = []( auto& ctx ) {
         const auto v = ForceFloat(_attr( ctx ));
-
-        if( v <= FLT_EPSILON )
-            throw std::runtime_error("Only positive arguments of RND are supported");
-
-        _val( ctx ) = v * std::rand() / (RAND_MAX + 1);
+        auto& runtime = x3::get<runtime_tag>( ctx ).get();
+        _val( ctx ) = runtime.Rnd( v );
     };
 
     constexpr auto inkey_op = []( auto& ctx ) { 
@@ -279,6 +249,11 @@ namespace actions
         runtime.Print( str_t( ForceInt( v ), ' ' ) );
     };
 
+    constexpr auto begin_statement_op = []( auto& ctx ) {
+        auto& runtime = x3::get<runtime_tag>( ctx ).get();
+        runtime.BeginStatement( GetPos( ctx ) );
+    };
+
     constexpr auto assing_var_op = []( auto& ctx ) {
         auto&& v = _attr( ctx );
         auto&& name = at_c<0>( v );
@@ -288,15 +263,15 @@ namespace actions
     };
 
     constexpr auto load_var_op = []( auto& ctx ) {
-        auto&& name = _attr( ctx );
+        auto&& var = _attr( ctx );
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
-        _val( ctx ) = runtime.Load( std::move( name ) );
+        _val( ctx ) = runtime.Load( var );
     };
 
     constexpr auto read_stmt_op = []( auto& ctx ) {
-        auto&& name = _attr( ctx );
+        auto&& var = _attr( ctx );
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
-        runtime.Read( std::move( name ) );
+        runtime.Read( var );
     };
     
     constexpr auto randomize_stmt_op = []( auto& ctx ) {
@@ -405,14 +380,14 @@ namespace actions
 
     constexpr auto for_stmt_op = []( auto& ctx ) {
         auto&& v = _attr( ctx );
-        auto&& name = at_c<0>( v );
+        auto&& var = at_c<0>( v );
         auto&& initVal = at_c<1>( v );
         auto&& endVal = at_c<2>( v );
         auto&& step = at_c<3>( v );
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
         const auto lineOffset = GetPos( ctx );
 
-        runtime.ForLoop( std::move(name), std::move(initVal), std::move(endVal), 
+        runtime.ForLoop( var, std::move(initVal), std::move(endVal), 
                         step ? std::move( *step ) : value_t{ int_t{1} }, lineOffset );
     };
 
@@ -423,7 +398,7 @@ namespace actions
         auto&& exprStr = at_c<2>( v );
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
 
-        runtime.DefineFuntion( std::move(fncName), std::move(varName), std::move(exprStr) );
+        runtime.DefineFuntion( fncName, varName, std::move(exprStr) );
     };     
     
     constexpr auto call_fn_op = []( auto& ctx ) {
@@ -432,13 +407,21 @@ namespace actions
         auto&& arg = at_c<1>( v );
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
 
-        _val( ctx ) = runtime.CallFuntion( std::move(fncName), std::move(arg) );
+        _val( ctx ) = runtime.CallFuntion( fncName, std::move(arg) );
     };
 
     constexpr auto next_stmt_op = []( auto& ctx ) {
-        auto&& v = _attr( ctx );
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
-        runtime.Next( std::move(v) );
+        runtime.Next();
+    };
+
+    // "NEXT I, J" stops at the first variable whose loop jumps back
+    constexpr auto next_var_op = []( auto& ctx ) {
+        auto&& var = _attr( ctx );
+        auto& runtime = x3::get<runtime_tag>( ctx ).get();
+
+        if( runtime.IsExpectedToContinueLineExecution() )
+            runtime.Next( var );
     };
 
     constexpr auto dim_stmt_op = []( auto& ctx ) {
@@ -447,7 +430,7 @@ namespace actions
         auto&& dimension = at_c<1>( v );
 
         auto& runtime = x3::get<runtime_tag>( ctx ).get();
-        runtime.Dim( std::move(varName), std::move( dimension) );
+        runtime.Dim( varName, dimension );
     };
 
     constexpr auto input_op = []( auto& ctx ) {
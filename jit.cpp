@@ -0,0 +1,1220 @@
+#include "jit.h"
+
+#ifndef BASIC_INT_WITH_LLVM
+
+#include <stdexcept>
+
+namespace jit
+{
+int Run( const ast::Program& program, int argc, char* argv[] )
+{
+    throw std::runtime_error( "JIT is unavailable, the interpreter is built without BASIC_INT_WITH_LLVM" );
+}
+}
+
+#else
+
+#include "native_runtime.h"
+
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+
+namespace jit
+{
+namespace
+{
+    using namespace ast;
+    using native::Array;
+
+    // Everything the generated code works with. The addresses of the members are
+    // embedded into the code as constants, so the containers must keep them stable.
+    struct State
+    {
+        State( const Program& program, int argc, char* argv[] ) :
+            rt{ argc, argv, program.data, { program.lineToDataPos.begin(), program.lineToDataPos.end() } }
+        {}
+
+        native::Runtime rt;
+        std::deque<str_t> strConsts;
+        std::map<std::string, str_t> strVars;
+        std::map<std::string, Array<int_t>> intArrays;
+        std::map<std::string, Array<float_t>> floatArrays;
+        std::map<std::string, Array<str_t>> strArrays;
+        std::deque<str_t> temps;    // String results, released after each statement
+    };
+
+    // The generated code calls these functions for everything besides numbers.
+    // Integers are passed as `int` to avoid relying on the extension rules of
+    // narrow types in the calling convention.
+    namespace callbacks
+    {
+        using ForLoopItem = native::Runtime::ForLoopItem;
+
+        static_assert( sizeof( ForLoopItem ) == 16, "The layout is duplicated in Compiler::mForItemTy" );
+
+        str_t* Temp( State* s, str_t str )
+        {
+            return &s->temps.emplace_back( std::move( str ) );
+        }
+
+        void PrintInt( State* s, int v ) { s->rt.Print( static_cast<int_t>(v) ); }
+        void PrintFloat( State* s, float_t v ) { s->rt.Print( v ); }
+        void PrintStr( State* s, const str_t* v ) { s->rt.Print( *v ); }
+        void PrintTab( State* s, int v ) { s->rt.PrintTab( static_cast<int_t>(v) ); }
+
+        void InputInt( State* s, const char* szPrompt, int_t* v ) { s->rt.Input( szPrompt, *v ); }
+        void InputFloat( State* s, const char* szPrompt, float_t* v ) { s->rt.Input( szPrompt, *v ); }
+        void InputStr( State* s, const char* szPrompt, str_t* v ) { s->rt.Input( szPrompt, *v ); }
+
+        void ReadInt( State* s, int_t* v ) { s->rt.Read( *v ); }
+        void ReadFloat( State* s, float_t* v ) { s->rt.Read( *v ); }
+        void ReadStr( State* s, str_t* v ) { s->rt.Read( *v ); }
+
+        void Restore( State* s ) { s->rt.Restore(); }
+        void RestoreLine( State* s, linenum_t line ) { s->rt.Restore( line ); }
+        void Randomize( State* s, int n ) { s->rt.Randomize( static_cast<int_t>(n) ); }
+        float_t Rnd( State* s, float_t v ) { return s->rt.Rnd( v ); }
+
+        void Gosub( State* s, unsigned resumePoint ) { s->rt.Gosub( resumePoint ); }
+        unsigned Return( State* s ) { return s->rt.Return(); }
+        void ForLoop( State* s, unsigned varId, float_t targetVal, float_t stepVal, unsigned resumePoint ) { s->rt.ForLoop( varId, targetVal, stepVal, resumePoint ); }
+        const ForLoopItem* Next( State* s, unsigned varId ) { return &s->rt.Next( varId ); }
+        void PopForLoop( State* s ) { s->rt.PopForLoop(); }
+        int OnBranch( int num, int count ) { return native::Runtime::OnBranch( static_cast<int_t>(num), static_cast<int_t>(count) ); }
+
+        void UnknownLine( linenum_t line ) { throw std::runtime_error( "Unknown line " + std::to_string( line ) ); }
+        void UnknownFn( const char* szName ) { throw std::runtime_error( std::string( "Unknown function name " ) + szName ); }
+
+        void ReleaseTemps( State* s ) { s->temps.clear(); }
+        void StrAssign( str_t* dst, const str_t* src ) { *dst = *src; }
+        int StrEqual( const str_t* a, const str_t* b ) { return *a == *b; }
+        int StrToBool( const str_t* v ) { return !v->empty(); }
+        str_t* Concat( State* s, const str_t* a, const str_t* b ) { return Temp( s, *a + *b ); }
+        str_t* Left( State* s, const str_t* v, int count ) { return Temp( s, runtime::SubStrImpl( *v, 1, static_cast<int_t>(count) ) ); }
+        str_t* Right( State* s, const str_t* v, int count ) { return Temp( s, runtime::RightImpl( *v, static_cast<int_t>(count) ) ); }
+        str_t* Mid( State* s, const str_t* v, int pos, int count ) { return Temp( s, runtime::SubStrImpl( *v, static_cast<int_t>(pos), static_cast<int_t>(count) ) ); }
+        str_t* StrOfInt( State* s, int v ) { return Temp( s, runtime::ToStrImpl( value_t{ static_cast<int_t>(v) } ) ); }
+        str_t* StrOfFloat( State* s, float_t v ) { return Temp( s, runtime::ToStrImpl( value_t{ v } ) ); }
+        float_t Val( const str_t* v ) { return runtime::ValImpl( *v ); }
+        int Len( const str_t* v ) { return static_cast<int_t>(v->length()); }
+        int Asc( const str_t* v ) { return runtime::AscImpl( *v ); }
+        str_t* Chr( State* s, int v ) { return Temp( s, str_t( 1, static_cast<char>(v) ) ); }
+        str_t* Inkey( State* s ) { return Temp( s, s->rt.Inkey() ); }
+
+        template<class T>
+        T* ArrayElement( Array<T>* pArray, unsigned count, const int_t* pIndices )
+        {
+            return &pArray->Element( pIndices, count );
+        }
+
+        template<class T>
+        void ArrayDim( Array<T>* pArray, unsigned count, const int_t* pDimensions )
+        {
+            pArray->Dim( { pDimensions, pDimensions + count } );
+        }
+    }
+
+    template<class T>
+    T Check( llvm::Expected<T> value )
+    {
+        if( !value )
+            throw std::runtime_error( "LLVM error: " + llvm::toString( value.takeError() ) );
+
+        return std::move( *value );
+    }
+
+    void Check( llvm::Error err )
+    {
+        if( err )
+            throw std::runtime_error( "LLVM error: " + llvm::toString( std::move( err ) ) );
+    }
+
+    class Compiler
+    {
+    public:
+        static constexpr const char* MainName = "basic_main";
+
+        Compiler( const Program& program, State& state, llvm::Module& module );
+
+        void Compile();
+
+        const std::vector<std::pair<std::string, void*>>& GetSymbols() const
+        {
+            return mSymbols;
+        }
+
+    private:
+        struct FnInfo
+        {
+            ValueType argType;
+            std::vector<const DefFn*> defs;
+            llvm::FunctionType* pType = nullptr;
+            llvm::GlobalVariable* pPtr = nullptr;
+            std::vector<llvm::Function*> bodies;
+        };
+
+        void Declare( const char* szName, void* pAddress, llvm::Type* pRetType, std::vector<llvm::Type*> args );
+        llvm::Value* Call( const char* szName, std::vector<llvm::Value*> args );
+
+        llvm::Type* GetType( ValueType type ) const;
+        llvm::Value* Ptr( const void* p, llvm::Type* pPointee = nullptr );
+        llvm::Value* StatePtr() { return Ptr( &mState ); }
+        llvm::Value* StrConst( const str_t& str ) { return Ptr( &mState.strConsts.emplace_back( str ) ); }
+
+        llvm::Value* ToFloat( llvm::Value* pVal, ValueType type );
+        llvm::Value* ToInt( llvm::Value* pVal, ValueType type );
+        llvm::Value* Convert( llvm::Value* pVal, ValueType from, ValueType to );
+        llvm::Value* ToBool( llvm::Value* pVal, ValueType type );
+        llvm::Value* FromBool( llvm::Value* pVal ) { return mBuilder.CreateZExt( pVal, mI16Ty ); }
+        llvm::Value* ToArg( llvm::Value* pVal ) { return mBuilder.CreateSExt( pVal, mI32Ty ); }
+        llvm::Value* FromArg( llvm::Value* pVal ) { return mBuilder.CreateTrunc( pVal, mI16Ty ); }
+        llvm::Value* UseTemp( llvm::Value* pVal ) { mTempsUsed = true; return pVal; }
+        void ReleaseTemps();
+
+        llvm::Value* EmitExpr( const Expr& expr );
+        llvm::Value* EmitTarget( const VarRef& var );
+        llvm::Value* EmitScalar( const std::string& name, ValueType type );
+        llvm::Value* EmitArray( const std::string& name, ValueType type );
+        llvm::Value* EmitIndices( const std::vector<ExprPtr>& indices );
+        llvm::Value* EmitFnCall( const Expr& expr );
+        llvm::Value* LoadValue( llvm::Value* pPtr, ValueType type );
+        void StoreValue( llvm::Value* pVal, llvm::Value* pPtr, ValueType type );
+
+        void EmitStatement( const Stmt& stmt );
+        void EmitBranch( const Branch& branch );
+        void EmitNext( const std::string& varName, unsigned varId );
+        void EmitGoto( linenum_t line );
+        void EmitResumePoint( unsigned resumePoint );
+        void EmitFunctions();
+
+        void Register( const Stmt& stmt );
+        FnInfo& GetFnInfo( const std::string& name );
+        llvm::BasicBlock* NewBlock( const llvm::Twine& name );
+        void StartDeadBlock() { mBuilder.SetInsertPoint( NewBlock( "dead" ) ); }
+
+    private:
+        const Program& mProgram;
+        State& mState;
+        llvm::LLVMContext& mCtx;
+        llvm::Module& mModule;
+        llvm::IRBuilder<> mBuilder;
+        llvm::IRBuilder<> mEntryBuilder;
+
+        llvm::Type* mVoidTy;
+        llvm::IntegerType* mI16Ty;
+        llvm::IntegerType* mI32Ty;
+        llvm::IntegerType* mI64Ty;
+        llvm::Type* mFloatTy;
+        llvm::PointerType* mPtrTy;
+        llvm::StructType* mForItemTy;
+
+        std::vector<std::pair<std::string, void*>> mSymbols;
+        std::map<linenum_t, llvm::BasicBlock*> mLineBlocks;
+        std::map<std::string, llvm::AllocaInst*> mNumVars;
+        std::map<std::string, unsigned> mForVarIds;
+        std::map<std::string, FnInfo> mFunctions;
+        std::vector<llvm::BasicBlock*> mResumeBlocks;
+
+        llvm::Function* mpMain = nullptr;
+        llvm::BasicBlock* mpEndBlock = nullptr;
+        llvm::BasicBlock* mpDispatchBlock = nullptr;
+        llvm::BasicBlock* mpNextLineBlock = nullptr;
+        llvm::AllocaInst* mpResume = nullptr;
+        llvm::AllocaInst* mpIndices = nullptr;
+        llvm::AllocaInst* mpLoopVal = nullptr;
+        const DefFn* mpCurFn = nullptr;
+        llvm::Value* mpCurFnArg = nullptr;
+        bool mTempsUsed = false;
+
+        static constexpr unsigned MaxIndices = 16;
+    };
+
+    Compiler::Compiler( const Program& program, State& state, llvm::Module& module ) :
+        mProgram{ program }, mState{ state }, mCtx{ module.getContext() }, mModule{ module },
+        mBuilder{ mCtx }, mEntryBuilder{ mCtx },
+        mVoidTy{ mBuilder.getVoidTy() }, mI16Ty{ mBuilder.getInt16Ty() }, mI32Ty{ mBuilder.getInt32Ty() },
+        mI64Ty{ mBuilder.getInt64Ty() }, mFloatTy{ mBuilder.getFloatTy() }, mPtrTy{ mBuilder.getInt8PtrTy() },
+        mForItemTy{ llvm::StructType::create( mCtx, { mI32Ty, mFloatTy, mFloatTy, mI32Ty }, "ForLoopItem" ) }
+    {
+        const auto fnc = []( auto pFnc ) { return reinterpret_cast<void*>(pFnc); };
+        llvm::Type* const f = mFloatTy;
+        llvm::Type* const i = mI32Ty;
+        llvm::Type* const p = mPtrTy;
+        llvm::Type* const v = mVoidTy;
+
+        Declare( "print_int", fnc( &callbacks::PrintInt ), v, { p, i } );
+        Declare( "print_float", fnc( &callbacks::PrintFloat ), v, { p, f } );
+        Declare( "print_str", fnc( &callbacks::PrintStr ), v, { p, p } );
+        Declare( "print_tab", fnc( &callbacks::PrintTab ), v, { p, i } );
+        Declare( "input_int", fnc( &callbacks::InputInt ), v, { p, p, p } );
+        Declare( "input_float", fnc( &callbacks::InputFloat ), v, { p, p, p } );
+        Declare( "input_str", fnc( &callbacks::InputStr ), v, { p, p, p } );
+        Declare( "read_int", fnc( &callbacks::ReadInt ), v, { p, p } );
+        Declare( "read_float", fnc( &callbacks::ReadFloat ), v, { p, p } );
+        Declare( "read_str", fnc( &callbacks::ReadStr ), v, { p, p } );
+        Declare( "restore", fnc( &callbacks::Restore ), v, { p } );
+        Declare( "restore_line", fnc( &callbacks::RestoreLine ), v, { p, mI64Ty } );
+        Declare( "randomize", fnc( &callbacks::Randomize ), v, { p, i } );
+        Declare( "rnd", fnc( &callbacks::Rnd ), f, { p, f } );
+        Declare( "gosub", fnc( &callbacks::Gosub ), v, { p, i } );
+        Declare( "return", fnc( &callbacks::Return ), i, { p } );
+        Declare( "for_loop", fnc( &callbacks::ForLoop ), v, { p, i, f, f, i } );
+        Declare( "next", fnc( &callbacks::Next ), p, { p, i } );
+        Declare( "pop_for_loop", fnc( &callbacks::PopForLoop ), v, { p } );
+        Declare( "on_branch", fnc( &callbacks::OnBranch ), i, { i, i } );
+        Declare( "unknown_line", fnc( &callbacks::UnknownLine ), v, { mI64Ty } );
+        Declare( "unknown_fn", fnc( &callbacks::UnknownFn ), v, { p } );
+        Declare( "release_temps", fnc( &callbacks::ReleaseTemps ), v, { p } );
+        Declare( "str_assign", fnc( &callbacks::StrAssign ), v, { p, p } );
+        Declare( "str_equal", fnc( &callbacks::StrEqual ), i, { p, p } );
+        Declare( "str_to_bool", fnc( &callbacks::StrToBool ), i, { p } );
+        Declare( "concat", fnc( &callbacks::Concat ), p, { p, p, p } );
+        Declare( "left", fnc( &callbacks::Left ), p, { p, p, i } );
+        Declare( "right", fnc( &callbacks::Right ), p, { p, p, i } );
+        Declare( "mid", fnc( &callbacks::Mid ), p, { p, p, i, i } );
+        Declare( "str_of_int", fnc( &callbacks::StrOfInt ), p, { p, i } );
+        Declare( "str_of_float", fnc( &callbacks::StrOfFloat ), p, { p, f } );
+        Declare( "val", fnc( &callbacks::Val ), f, { p } );
+        Declare( "len", fnc( &callbacks::Len ), i, { p } );
+        Declare( "asc", fnc( &callbacks::Asc ), i, { p } );
+        Declare( "chr", fnc( &callbacks::Chr ), p, { p, i } );
+        Declare( "inkey", fnc( &callbacks::Inkey ), p, { p } );
+        Declare( "array_int", fnc( &callbacks::ArrayElement<int_t> ), p, { p, i, p } );
+        Declare( "array_float", fnc( &callbacks::ArrayElement<float_t> ), p, { p, i, p } );
+        Declare( "array_str", fnc( &callbacks::ArrayElement<str_t> ), p, { p, i, p } );
+        Declare( "dim_int", fnc( &callbacks::ArrayDim<int_t> ), v, { p, i, p } );
+        Declare( "dim_float", fnc( &callbacks::ArrayDim<float_t> ), v, { p, i, p } );
+        Declare( "dim_str", fnc( &callbacks::ArrayDim<str_t> ), v, { p, i, p } );
+    }
+
+    void Compiler::Declare( const char* szName, void* pAddress, llvm::Type* pRetType, std::vector<llvm::Type*> args )
+    {
+        const std::string name = std::string( "basic_" ) + szName;
+
+        llvm::Function::Create( llvm::FunctionType::get( pRetType, args, false ), llvm::Function::ExternalLinkage, name, mModule );
+        mSymbols.emplace_back( name, pAddress );
+    }
+
+    llvm::Value* Compiler::Call( const char* szName, std::vector<llvm::Value*> args )
+    {
+        llvm::Function* const pFnc = mModule.getFunction( std::string( "basic_" ) + szName );
+        assert( pFnc );
+
+        return mBuilder.CreateCall( pFnc, args );
+    }
+
+    llvm::Type* Compiler::GetType( ValueType type ) const
+    {
+        switch( type )
+        {
+        case ValueType::Int:
+            return mI16Ty;
+
+        case ValueType::Float:
+            return mFloatTy;
+
+        default:
+            return mPtrTy;
+        }
+    }
+
+    llvm::Value* Compiler::Ptr( const void* p, llvm::Type* pPointee )
+    {
+        llvm::Type* const pType = pPointee ? llvm::PointerType::getUnqual( pPointee ) : mPtrTy;
+
+        return llvm::ConstantExpr::getIntToPtr( mBuilder.getInt64( reinterpret_cast<uintptr_t>(p) ), pType );
+    }
+
+    llvm::BasicBlock* Compiler::NewBlock( const llvm::Twine& name )
+    {
+        return llvm::BasicBlock::Create( mCtx, name, mBuilder.GetInsertBlock()->getParent() );
+    }
+
+    llvm::Value* Compiler::ToFloat( llvm::Value* pVal, ValueType type )
+    {
+        switch( type )
+        {
+        case ValueType::Float:
+            return pVal;
+
+        case ValueType::Int:
+            return mBuilder.CreateSIToFP( pVal, mFloatTy );
+
+        default:
+            throw std::runtime_error( "Cannot be string" );
+        }
+    }
+
+    // The same as static_cast<int_t>() on x86: the conversion goes through int
+    llvm::Value* Compiler::ToInt( llvm::Value* pVal, ValueType type )
+    {
+        switch( type )
+        {
+        case ValueType::Int:
+            return pVal;
+
+        case ValueType::Float:
+            return mBuilder.CreateTrunc( mBuilder.CreateFPToSI( pVal, mI32Ty ), mI16Ty );
+
+        default:
+            throw std::runtime_error( "Cannot be string" );
+        }
+    }
+
+    // Mirrors the conversions of runtime::Runtime::Store()
+    llvm::Value* Compiler::Convert( llvm::Value* pVal, ValueType from, ValueType to )
+    {
+        switch( to )
+        {
+        case ValueType::Int:
+            return ToInt( pVal, from );
+
+        case ValueType::Float:
+            return ToFloat( pVal, from );
+
+        default:
+            if( from != ValueType::Str )
+                throw std::runtime_error( "Expected String variable" );
+
+            return pVal;
+        }
+    }
+
+    llvm::Value* Compiler::ToBool( llvm::Value* pVal, ValueType type )
+    {
+        switch( type )
+        {
+        case ValueType::Int:
+            return mBuilder.CreateICmpNE( pVal, llvm::ConstantInt::get( mI16Ty, 0 ) );
+
+        case ValueType::Float:
+            return mBuilder.CreateFCmpUNE( pVal, llvm::ConstantFP::get( mFloatTy, 0 ) );
+
+        default:
+            return mBuilder.CreateICmpNE( Call( "str_to_bool", { pVal } ), mBuilder.getInt32( 0 ) );
+        }
+    }
+
+    void Compiler::ReleaseTemps()
+    {
+        if( !mTempsUsed || mpCurFn )
+            return;
+
+        Call( "release_temps", { StatePtr() } );
+        mTempsUsed = false;
+    }
+
+    llvm::Value* Compiler::LoadValue( llvm::Value* pPtr, ValueType type )
+    {
+        // Strings are always passed by pointer
+        if( type == ValueType::Str )
+            return pPtr;
+
+        return mBuilder.CreateLoad( GetType( type ), pPtr );
+    }
+
+    void Compiler::StoreValue( llvm::Value* pVal, llvm::Value* pPtr, ValueType type )
+    {
+        if( type == ValueType::Str )
+            Call( "str_assign", { pPtr, pVal } );
+        else
+            mBuilder.CreateStore( pVal, pPtr );
+    }
+
+    llvm::Value* Compiler::EmitScalar( const std::string& name, ValueType type )
+    {
+        if( mpCurFn )
+        {
+            if( name != mpCurFn->varName )
+                throw std::runtime_error( "Unknown variable inside the function body: " + name );
+
+            return mpCurFnArg;
+        }
+
+        if( type == ValueType::Str )
+            return Ptr( &mState.strVars[name] );
+
+        auto it = mNumVars.find( name );
+
+        if( it == mNumVars.end() )
+        {
+            llvm::Type* const pType = GetType( type );
+            llvm::AllocaInst* const pVar = mEntryBuilder.CreateAlloca( pType, nullptr, name );
+
+            mEntryBuilder.CreateStore( llvm::Constant::getNullValue( pType ), pVar );
+            it = mNumVars.emplace( name, pVar ).first;
+        }
+
+        return it->second;
+    }
+
+    llvm::Value* Compiler::EmitArray( const std::string& name, ValueType type )
+    {
+        if( mpCurFn )
+            throw std::runtime_error( "Unknown variable inside the function body: " + name );
+
+        switch( type )
+        {
+        case ValueType::Int:
+            return Ptr( &mState.intArrays[name] );
+
+        case ValueType::Float:
+            return Ptr( &mState.floatArrays[name] );
+
+        default:
+            return Ptr( &mState.strArrays[name] );
+        }
+    }
+
+    // All values are calculated first, because nested array accesses reuse the buffer
+    llvm::Value* Compiler::EmitIndices( const std::vector<ExprPtr>& indices )
+    {
+        if( indices.size() > MaxIndices )
+            throw std::runtime_error( "Too many array dimensions" );
+
+        std::vector<llvm::Value*> values;
+
+        for( const auto& idx : indices )
+            values.push_back( ToInt( EmitExpr( *idx ), idx->type ) );
+
+        for( size_t i = 0; i < values.size(); ++i )
+            mBuilder.CreateStore( values[i], mBuilder.CreateConstInBoundsGEP2_32( mpIndices->getAllocatedType(), mpIndices, 0, static_cast<unsigned>(i) ) );
+
+        return mBuilder.CreateBitCast( mpIndices, mPtrTy );
+    }
+
+    // Returns a pointer to the variable
+    llvm::Value* Compiler::EmitTarget( const VarRef& var )
+    {
+        if( var.indices.empty() )
+        {
+            llvm::Value* const pVar = EmitScalar( var.name, var.type );
+
+            if( mpCurFn )
+                throw std::runtime_error( "Cannot modify the function argument: " + var.name );
+
+            return pVar;
+        }
+
+        static constexpr const char* rgArrayFnc[] = { "array_int", "array_float", "array_str" };
+
+        llvm::Value* const pArray = EmitArray( var.name, var.type );
+        llvm::Value* const pIndices = EmitIndices( var.indices );
+        llvm::Value* const pElem = Call( rgArrayFnc[static_cast<int>(var.type)], { pArray, mBuilder.getInt32( static_cast<unsigned>(var.indices.size()) ), pIndices } );
+
+        return var.type == ValueType::Str ? pElem : mBuilder.CreateBitCast( pElem, llvm::PointerType::getUnqual( GetType( var.type ) ) );
+    }
+
+    Compiler::FnInfo& Compiler::GetFnInfo( const std::string& name )
+    {
+        //A function without any DEF is still callable, it just fails at runtime
+        auto& info = mFunctions.try_emplace( name, FnInfo{ ValueType::Float, {} } ).first->second;
+
+        if( !info.pPtr )
+        {
+            info.pType = llvm::FunctionType::get( GetType( GetFnType( name ) ), { GetType( info.argType ) }, false );
+
+            llvm::PointerType* const pPtrType = llvm::PointerType::getUnqual( info.pType );
+
+            info.pPtr = new llvm::GlobalVariable( mModule, pPtrType, false, llvm::GlobalValue::InternalLinkage,
+                                                  llvm::ConstantPointerNull::get( pPtrType ), "fn_" + name );
+        }
+
+        return info;
+    }
+
+    llvm::Value* Compiler::EmitFnCall( const Expr& expr )
+    {
+        FnInfo& info = GetFnInfo( expr.name );
+        llvm::Value* const pArg = Convert( EmitExpr( *expr.args[0] ), expr.args[0]->type, info.argType );
+        llvm::Value* const pFnc = mBuilder.CreateLoad( info.pPtr->getValueType(), info.pPtr );
+
+        llvm::BasicBlock* const pUnknownBlock = NewBlock( "unknown_fn" );
+        llvm::BasicBlock* const pCallBlock = NewBlock( "call_fn" );
+
+        mBuilder.CreateCondBr( mBuilder.CreateIsNull( pFnc ), pUnknownBlock, pCallBlock );
+
+        mBuilder.SetInsertPoint( pUnknownBlock );
+        Call( "unknown_fn", { mBuilder.CreateGlobalStringPtr( expr.name ) } );
+        mBuilder.CreateUnreachable();
+
+        mBuilder.SetInsertPoint( pCallBlock );
+
+        llvm::Value* const pRes = mBuilder.CreateCall( info.pType, pFnc, { pArg } );
+
+        return GetFnType( expr.name ) == ValueType::Str ? UseTemp( pRes ) : pRes;
+    }
+
+    llvm::Value* Compiler::EmitExpr( const Expr& expr )
+    {
+        const auto& args = expr.args;
+
+        // The interpreter evaluates all operands from left to right
+        std::vector<llvm::Value*> v;
+
+        if( expr.op != Op::Var && expr.op != Op::ArrayElem && expr.op != Op::CallFn )
+            for( const auto& arg : args )
+                v.push_back( EmitExpr( *arg ) );
+
+        const auto f = [&]( size_t i ) { return ToFloat( v[i], args[i]->type ); };
+        const auto i = [&]( size_t i ) { return ToArg( ToInt( v[i], args[i]->type ) ); };
+        const auto isStr = [&]( size_t i ) { return args[i]->type == ValueType::Str; };
+        const auto intrinsic = [&]( llvm::Intrinsic::ID id ) { return llvm::Intrinsic::getDeclaration( &mModule, id, { mFloatTy } ); };
+
+        switch( expr.op )
+        {
+        case Op::Const:
+        {
+            struct Visitor
+            {
+                llvm::Value* operator()( int_t val ) const { return llvm::ConstantInt::get( c.mI16Ty, val, true ); }
+                llvm::Value* operator()( float_t val ) const { return llvm::ConstantFP::get( c.mFloatTy, val ); }
+                llvm::Value* operator()( const str_t& val ) const { return c.StrConst( val ); }
+
+                Compiler& c;
+            };
+
+            return boost::apply_visitor( Visitor{ *this }, expr.value );
+        }
+
+        case Op::Var:
+        {
+            // The function argument is passed by value
+            llvm::Value* const pVar = EmitScalar( expr.name, expr.type );
+            return mpCurFn ? pVar : LoadValue( pVar, expr.type );
+        }
+
+        case Op::ArrayElem:
+            return LoadValue( EmitTarget( VarRef{ expr.name, args, expr.type } ), expr.type );
+
+        case Op::Neg: return mBuilder.CreateFNeg( f( 0 ) );
+        case Op::Not: return FromBool( mBuilder.CreateICmpEQ( ToInt( v[0], args[0]->type ), llvm::ConstantInt::get( mI16Ty, 0 ) ) );
+
+        case Op::Add:
+            if( expr.type == ValueType::Str )
+                return UseTemp( Call( "concat", { StatePtr(), v[0], v[1] } ) );
+
+            return mBuilder.CreateFAdd( f( 0 ), f( 1 ) );
+
+        case Op::Sub: return mBuilder.CreateFSub( f( 0 ), f( 1 ) );
+        case Op::Mul: return mBuilder.CreateFMul( f( 0 ), f( 1 ) );
+        case Op::Div: return mBuilder.CreateFDiv( f( 0 ), f( 1 ) );
+        case Op::Pow: return mBuilder.CreateCall( intrinsic( llvm::Intrinsic::pow ), { f( 0 ), f( 1 ) } );
+
+        case Op::Eq:
+        case Op::NotEq:
+            if( isStr( 0 ) )
+            {
+                llvm::Value* const pEq = mBuilder.CreateICmpNE( Call( "str_equal", { v[0], v[1] } ), mBuilder.getInt32( 0 ) );
+                return FromBool( expr.op == Op::Eq ? pEq : mBuilder.CreateNot( pEq ) );
+            }
+
+            return FromBool( expr.op == Op::Eq ? mBuilder.CreateFCmpOEQ( f( 0 ), f( 1 ) ) : mBuilder.CreateFCmpUNE( f( 0 ), f( 1 ) ) );
+
+        case Op::Less: return FromBool( mBuilder.CreateFCmpOLT( f( 0 ), f( 1 ) ) );
+        case Op::Greater: return FromBool( mBuilder.CreateFCmpOGT( f( 0 ), f( 1 ) ) );
+        case Op::LessEq: return FromBool( mBuilder.CreateFCmpOLE( f( 0 ), f( 1 ) ) );
+        case Op::GreaterEq: return FromBool( mBuilder.CreateFCmpOGE( f( 0 ), f( 1 ) ) );
+
+        case Op::And: return FromBool( mBuilder.CreateAnd( ToBool( v[0], args[0]->type ), ToBool( v[1], args[1]->type ) ) );
+        case Op::Or: return FromBool( mBuilder.CreateOr( ToBool( v[0], args[0]->type ), ToBool( v[1], args[1]->type ) ) );
+
+        case Op::Sqr: return mBuilder.CreateCall( intrinsic( llvm::Intrinsic::sqrt ), { f( 0 ) } );
+        case Op::Abs: return mBuilder.CreateCall( intrinsic( llvm::Intrinsic::fabs ), { f( 0 ) } );
+
+        case Op::Int:
+        {
+            // See runtime::IntImpl()
+            llvm::Value* const pVal = f( 0 );
+            llvm::Value* const pIsNeg = mBuilder.CreateFCmpOLT( pVal, llvm::ConstantFP::get( mFloatTy, 0 ) );
+            llvm::Value* const pAdjusted = mBuilder.CreateFSub( pVal, llvm::ConstantFP::get( mFloatTy, 0.5 ) );
+
+            return ToInt( mBuilder.CreateSelect( pIsNeg, pAdjusted, pVal ), ValueType::Float );
+        }
+
+        case Op::Left: return UseTemp( Call( "left", { StatePtr(), v[0], i( 1 ) } ) );
+        case Op::Right: return UseTemp( Call( "right", { StatePtr(), v[0], i( 1 ) } ) );
+        case Op::Mid: return UseTemp( Call( "mid", { StatePtr(), v[0], i( 1 ), args.size() > 2 ? i( 2 ) : mBuilder.getInt32( -1 ) } ) );
+
+        case Op::Str:
+            switch( args[0]->type )
+            {
+            case ValueType::Int: return UseTemp( Call( "str_of_int", { StatePtr(), i( 0 ) } ) );
+            case ValueType::Float: return UseTemp( Call( "str_of_float", { StatePtr(), v[0] } ) );
+            default: return v[0];
+            }
+
+        case Op::Val: return Call( "val", { v[0] } );
+        case Op::Len: return FromArg( Call( "len", { v[0] } ) );
+        case Op::Asc: return FromArg( Call( "asc", { v[0] } ) );
+        case Op::Chr: return UseTemp( Call( "chr", { StatePtr(), i( 0 ) } ) );
+        case Op::Rnd: return Call( "rnd", { StatePtr(), f( 0 ) } );
+        case Op::Inkey: return UseTemp( Call( "inkey", { StatePtr() } ) );
+
+        case Op::CallFn:
+            return EmitFnCall( expr );
+        }
+
+        throw std::logic_error( "Unknown operation" );
+    }
+
+    void Compiler::EmitGoto( linenum_t line )
+    {
+        const auto it = mLineBlocks.find( line );
+
+        if( it == mLineBlocks.end() )
+        {
+            Call( "unknown_line", { mBuilder.getInt64( line ) } );
+            mBuilder.CreateUnreachable();
+        }
+        else
+        {
+            mBuilder.CreateBr( it->second );
+        }
+
+        StartDeadBlock();
+    }
+
+    void Compiler::EmitResumePoint( unsigned resumePoint )
+    {
+        assert( resumePoint < mResumeBlocks.size() );
+
+        llvm::BasicBlock* const pBlock = mResumeBlocks[resumePoint];
+
+        pBlock->moveAfter( mBuilder.GetInsertBlock() );
+        mBuilder.SetInsertPoint( pBlock );
+    }
+
+    void Compiler::EmitBranch( const Branch& branch )
+    {
+        if( const auto* pLine = std::get_if<linenum_t>( &branch ) )
+            EmitGoto( *pLine );
+        else
+            EmitStatement( *std::get<StmtPtr>( branch ) );
+    }
+
+    // See runtime::Runtime::NextImpl()
+    void Compiler::EmitNext( const std::string& varName, unsigned varId )
+    {
+        llvm::Value* const pItem = mBuilder.CreateBitCast( Call( "next", { StatePtr(), mBuilder.getInt32( varId ) } ), llvm::PointerType::getUnqual( mForItemTy ) );
+        llvm::Value* const pTarget = mBuilder.CreateLoad( mFloatTy, mBuilder.CreateStructGEP( mForItemTy, pItem, 1 ) );
+        llvm::Value* const pStep = mBuilder.CreateLoad( mFloatTy, mBuilder.CreateStructGEP( mForItemTy, pItem, 2 ) );
+
+        const auto step = [&]( const std::string& name ) {
+            const ValueType type = runtime::DetectVarType( name );
+            llvm::Value* const pVar = EmitScalar( name, type );
+            llvm::Value* const pCur = mBuilder.CreateFAdd( ToFloat( mBuilder.CreateLoad( GetType( type ), pVar ), type ), pStep );
+
+            mBuilder.CreateStore( Convert( pCur, ValueType::Float, type ), pVar );
+            mBuilder.CreateStore( pCur, mpLoopVal );
+        };
+
+        if( !varName.empty() )
+        {
+            step( varName );
+        }
+        else
+        {
+            llvm::Value* const pVarId = mBuilder.CreateLoad( mI32Ty, mBuilder.CreateStructGEP( mForItemTy, pItem, 0 ) );
+            llvm::BasicBlock* const pDefault = NewBlock( "next_default" );
+            llvm::BasicBlock* const pMerge = NewBlock( "next_merge" );
+            llvm::SwitchInst* const pSwitch = mBuilder.CreateSwitch( pVarId, pDefault, static_cast<unsigned>(mForVarIds.size()) );
+
+            for( const auto& [name, id] : mForVarIds )
+            {
+                llvm::BasicBlock* const pCase = NewBlock( "next_" + name );
+
+                pSwitch->addCase( mBuilder.getInt32( id ), pCase );
+                mBuilder.SetInsertPoint( pCase );
+                step( name );
+                mBuilder.CreateBr( pMerge );
+            }
+
+            mBuilder.SetInsertPoint( pDefault );
+            mBuilder.CreateUnreachable();
+            mBuilder.SetInsertPoint( pMerge );
+        }
+
+        llvm::Value* const pCur = mBuilder.CreateLoad( mFloatTy, mpLoopVal );
+        llvm::Value* const pContinue = mBuilder.CreateSelect(
+            mBuilder.CreateFCmpOLT( pStep, llvm::ConstantFP::get( mFloatTy, 0 ) ),
+            mBuilder.CreateFCmpOLE( pTarget, pCur ),
+            mBuilder.CreateFCmpOLE( pCur, pTarget )
+        );
+
+        llvm::BasicBlock* const pLoop = NewBlock( "next_loop" );
+        llvm::BasicBlock* const pExit = NewBlock( "next_exit" );
+
+        mBuilder.CreateCondBr( pContinue, pLoop, pExit );
+
+        mBuilder.SetInsertPoint( pLoop );
+        mBuilder.CreateStore( mBuilder.CreateLoad( mI32Ty, mBuilder.CreateStructGEP( mForItemTy, pItem, 3 ) ), mpResume );
+        mBuilder.CreateBr( mpDispatchBlock );
+
+        mBuilder.SetInsertPoint( pExit );
+        Call( "pop_for_loop", { StatePtr() } );
+    }
+
+    void Compiler::EmitStatement( const Stmt& stmtVariant )
+    {
+        struct Visitor
+        {
+            void operator()( const Nop& ) const {}
+
+            void operator()( const Print& stmt ) const
+            {
+                for( const auto& item : stmt.items )
+                {
+                    llvm::Value* const pVal = c.EmitExpr( *item.value );
+
+                    if( item.tab )
+                    {
+                        c.Call( "print_tab", { c.StatePtr(), c.ToArg( c.ToInt( pVal, item.value->type ) ) } );
+                        continue;
+                    }
+
+                    switch( item.value->type )
+                    {
+                    case ValueType::Int: c.Call( "print_int", { c.StatePtr(), c.ToArg( pVal ) } ); break;
+                    case ValueType::Float: c.Call( "print_float", { c.StatePtr(), pVal } ); break;
+                    default: c.Call( "print_str", { c.StatePtr(), pVal } );
+                    }
+                }
+            }
+
+            void operator()( const Input& stmt ) const
+            {
+                static constexpr const char* rgInputFnc[] = { "input_int", "input_float", "input_str" };
+
+                for( const auto& item : stmt.items )
+                {
+                    llvm::Value* const pVar = c.mBuilder.CreateBitCast( c.EmitTarget( item.var ), c.mPtrTy );
+                    c.Call( rgInputFnc[static_cast<int>(item.var.type)], { c.StatePtr(), c.mBuilder.CreateGlobalStringPtr( item.prompt ), pVar } );
+                }
+            }
+
+            void operator()( const Assign& stmt ) const
+            {
+                // Indices are calculated before the value
+                llvm::Value* const pVar = c.EmitTarget( stmt.var );
+                llvm::Value* const pVal = c.Convert( c.EmitExpr( *stmt.value ), stmt.value->type, stmt.var.type );
+
+                c.StoreValue( pVal, pVar, stmt.var.type );
+            }
+
+            void operator()( const Dim& stmt ) const
+            {
+                static constexpr const char* rgDimFnc[] = { "dim_int", "dim_float", "dim_str" };
+
+                for( const auto& item : stmt.items )
+                {
+                    const ValueType type = runtime::DetectVarType( item.name );
+
+                    if( item.dimensions.empty() )
+                    {
+                        llvm::Value* const pVar = c.EmitScalar( item.name, type );
+                        c.StoreValue( type == ValueType::Str ? c.StrConst( {} ) : llvm::Constant::getNullValue( c.GetType( type ) ), pVar, type );
+                        continue;
+                    }
+
+                    llvm::Value* const pArray = c.EmitArray( item.name, type );
+                    llvm::Value* const pDims = c.EmitIndices( item.dimensions );
+
+                    c.Call( rgDimFnc[static_cast<int>(type)], { pArray, c.mBuilder.getInt32( static_cast<unsigned>(item.dimensions.size()) ), pDims } );
+                }
+            }
+
+            void operator()( const Goto& stmt ) const
+            {
+                c.EmitGoto( stmt.line );
+            }
+
+            void operator()( const Gosub& stmt ) const
+            {
+                const unsigned resumePoint = NewResumePoint();
+
+                c.Call( "gosub", { c.StatePtr(), c.mBuilder.getInt32( resumePoint ) } );
+                c.EmitGoto( stmt.line );
+                c.EmitResumePoint( resumePoint );
+            }
+
+            void operator()( const Return& ) const
+            {
+                c.mBuilder.CreateStore( c.Call( "return", { c.StatePtr() } ), c.mpResume );
+                c.mBuilder.CreateBr( c.mpDispatchBlock );
+                c.StartDeadBlock();
+            }
+
+            void operator()( const On& stmt ) const
+            {
+                const unsigned resumePoint = stmt.gosub ? NewResumePoint() : 0;
+                llvm::Value* const pIdx = c.ToArg( c.ToInt( c.EmitExpr( *stmt.index ), stmt.index->type ) );
+                llvm::Value* const pBranch = c.Call( "on_branch", { pIdx, c.mBuilder.getInt32( static_cast<unsigned>(stmt.lines.size()) ) } );
+
+                c.ReleaseTemps();
+
+                llvm::BasicBlock* const pDefault = c.NewBlock( "on_default" );
+                llvm::SwitchInst* const pSwitch = c.mBuilder.CreateSwitch( pBranch, pDefault, static_cast<unsigned>(stmt.lines.size()) );
+
+                for( size_t n = 0; n < stmt.lines.size(); ++n )
+                {
+                    llvm::BasicBlock* const pCase = c.NewBlock( "on_case" );
+
+                    pSwitch->addCase( c.mBuilder.getInt32( static_cast<unsigned>(n + 1) ), pCase );
+                    c.mBuilder.SetInsertPoint( pCase );
+
+                    if( stmt.gosub )
+                        c.Call( "gosub", { c.StatePtr(), c.mBuilder.getInt32( resumePoint ) } );
+
+                    c.EmitGoto( stmt.lines[n] );
+                }
+
+                c.mBuilder.SetInsertPoint( pDefault );
+                c.mBuilder.CreateUnreachable();
+
+                if( stmt.gosub )
+                    c.EmitResumePoint( resumePoint );
+                else
+                    c.StartDeadBlock();
+            }
+
+            void operator()( const If& stmt ) const
+            {
+                llvm::Value* const pCond = c.ToBool( c.EmitExpr( *stmt.cond ), stmt.cond->type );
+
+                c.ReleaseTemps();
+
+                llvm::BasicBlock* const pThen = c.NewBlock( "then" );
+                llvm::BasicBlock* const pElse = c.NewBlock( "else" );
+                llvm::BasicBlock* const pCont = c.NewBlock( "endif" );
+
+                c.mBuilder.CreateCondBr( pCond, pThen, pElse );
+
+                c.mBuilder.SetInsertPoint( pThen );
+                c.EmitBranch( stmt.then );
+                c.ReleaseTemps();
+                c.mBuilder.CreateBr( pCont );
+
+                c.mBuilder.SetInsertPoint( pElse );
+
+                if( stmt.otherwise )
+                {
+                    c.EmitBranch( *stmt.otherwise );
+                    c.ReleaseTemps();
+                    c.mBuilder.CreateBr( pCont );
+                }
+                else
+                {
+                    // A false condition without ELSE skips the rest of the line
+                    c.mBuilder.CreateBr( c.mpNextLineBlock );
+                }
+
+                c.mBuilder.SetInsertPoint( pCont );
+            }
+
+            void operator()( const For& stmt ) const
+            {
+                const unsigned resumePoint = NewResumePoint();
+
+                // Target and step are calculated before the variable is assigned
+                llvm::Value* const pInit = c.Convert( c.EmitExpr( *stmt.initVal ), stmt.initVal->type, stmt.var.type );
+                llvm::Value* const pTarget = c.ToFloat( c.EmitExpr( *stmt.targetVal ), stmt.targetVal->type );
+                llvm::Value* const pStep = c.ToFloat( c.EmitExpr( *stmt.stepVal ), stmt.stepVal->type );
+
+                c.mBuilder.CreateStore( pInit, c.EmitScalar( stmt.var.name, stmt.var.type ) );
+                c.ReleaseTemps();
+                c.Call( "for_loop", { c.StatePtr(), c.mBuilder.getInt32( c.mForVarIds.at( stmt.var.name ) ), pTarget, pStep, c.mBuilder.getInt32( resumePoint ) } );
+                c.mBuilder.CreateBr( c.mResumeBlocks[resumePoint] );
+                c.EmitResumePoint( resumePoint );
+            }
+
+            void operator()( const Next& stmt ) const
+            {
+                if( stmt.varNames.empty() )
+                {
+                    c.EmitNext( {}, native::Runtime::AnyForLoopVar );
+                    return;
+                }
+
+                for( const auto& name : stmt.varNames )
+                {
+                    const auto it = c.mForVarIds.find( name );
+
+                    if( it == c.mForVarIds.end() )
+                    {
+                        // There is no FOR with this variable, so it always fails
+                        c.Call( "next", { c.StatePtr(), c.mBuilder.getInt32( static_cast<unsigned>(c.mForVarIds.size()) ) } );
+                        return;
+                    }
+
+                    c.EmitNext( name, it->second );
+                }
+            }
+
+            void operator()( const End& ) const
+            {
+                c.mBuilder.CreateBr( c.mpEndBlock );
+                c.StartDeadBlock();
+            }
+
+            void operator()( const Read& stmt ) const
+            {
+                static constexpr const char* rgReadFnc[] = { "read_int", "read_float", "read_str" };
+
+                for( const auto& var : stmt.vars )
+                    c.Call( rgReadFnc[static_cast<int>(var.type)], { c.StatePtr(), c.mBuilder.CreateBitCast( c.EmitTarget( var ), c.mPtrTy ) } );
+            }
+
+            void operator()( const Restore& stmt ) const
+            {
+                if( stmt.line == runtime::MaxLineNum )
+                    c.Call( "restore", { c.StatePtr() } );
+                else
+                    c.Call( "restore_line", { c.StatePtr(), c.mBuilder.getInt64( stmt.line ) } );
+            }
+
+            void operator()( const Randomize& stmt ) const
+            {
+                c.Call( "randomize", { c.StatePtr(), c.ToArg( c.ToInt( c.EmitExpr( *stmt.seed ), stmt.seed->type ) ) } );
+            }
+
+            void operator()( const DefFn& stmt ) const
+            {
+                const FnInfo& info = c.mFunctions.at( stmt.name );
+                const auto idx = std::find( info.defs.begin(), info.defs.end(), &stmt ) - info.defs.begin();
+
+                c.mBuilder.CreateStore( info.bodies[idx], info.pPtr );
+            }
+
+            unsigned NewResumePoint() const
+            {
+                c.mResumeBlocks.push_back( llvm::BasicBlock::Create( c.mCtx, "R" + std::to_string( c.mResumeBlocks.size() ), c.mpMain ) );
+                return static_cast<unsigned>(c.mResumeBlocks.size() - 1);
+            }
+
+            Compiler& c;
+        };
+
+        std::visit( Visitor{ *this }, static_cast<const Stmt::variant&>(stmtVariant) );
+        ReleaseTemps();
+    }
+
+    void Compiler::Register( const Stmt& stmt )
+    {
+        if( const auto* pFor = std::get_if<For>( &stmt ) )
+        {
+            mForVarIds.try_emplace( pFor->var.name, static_cast<unsigned>(mForVarIds.size()) );
+        }
+        else if( const auto* pDef = std::get_if<DefFn>( &stmt ) )
+        {
+            const ValueType argType = runtime::DetectVarType( pDef->varName );
+            auto& info = mFunctions.try_emplace( pDef->name, FnInfo{ argType, {} } ).first->second;
+
+            if( info.argType != argType )
+                throw std::runtime_error( "Incompatible redefinition of FN " + pDef->name );
+
+            info.defs.push_back( pDef );
+        }
+    }
+
+    // Function bodies can only refer to their argument and other functions
+    void Compiler::EmitFunctions()
+    {
+        for( auto& [name, info] : mFunctions )
+        {
+            GetFnInfo( name );
+
+            for( size_t n = 0; n < info.defs.size(); ++n )
+            {
+                llvm::Function* const pFnc = llvm::Function::Create( info.pType, llvm::Function::InternalLinkage, "fn_" + name + "_" + std::to_string( n ), mModule );
+
+                pFnc->addFnAttr( llvm::Attribute::UWTable );
+                info.bodies.push_back( pFnc );
+            }
+        }
+
+        for( auto& [name, info] : mFunctions )
+        {
+            for( size_t n = 0; n < info.defs.size(); ++n )
+            {
+                const DefFn& def = *info.defs[n];
+                llvm::Function* const pFnc = info.bodies[n];
+
+                mpCurFn = &def;
+                mpCurFnArg = pFnc->getArg( 0 );
+                mBuilder.SetInsertPoint( llvm::BasicBlock::Create( mCtx, "entry", pFnc ) );
+
+                try
+                {
+                    mBuilder.CreateRet( Convert( EmitExpr( *def.body ), def.body->type, GetFnType( name ) ) );
+                }
+                catch( const std::runtime_error& e )
+                {
+                    throw std::runtime_error( "FN " + name + " " + e.what() );
+                }
+
+                mpCurFn = nullptr;
+                mpCurFnArg = nullptr;
+            }
+        }
+    }
+
+    void Compiler::Compile()
+    {
+        for( const auto& line : mProgram.lines )
+            for( const auto& pStmt : line.statements )
+                ForEachStmt( *pStmt, [this]( const Stmt& stmt ) { Register( stmt ); } );
+
+        EmitFunctions();
+
+        mpMain = llvm::Function::Create( llvm::FunctionType::get( mVoidTy, false ), llvm::Function::ExternalLinkage, MainName, mModule );
+        mpMain->addFnAttr( llvm::Attribute::UWTable );
+
+        llvm::BasicBlock* const pEntry = llvm::BasicBlock::Create( mCtx, "entry", mpMain );
+
+        mEntryBuilder.SetInsertPoint( pEntry );
+        mpResume = mEntryBuilder.CreateAlloca( mI32Ty, nullptr, "resume" );
+        mpIndices = mEntryBuilder.CreateAlloca( llvm::ArrayType::get( mI16Ty, MaxIndices ), nullptr, "indices" );
+        mpLoopVal = mEntryBuilder.CreateAlloca( mFloatTy, nullptr, "loop_val" );
+
+        for( const auto& line : mProgram.lines )
+            mLineBlocks.emplace( line.num, llvm::BasicBlock::Create( mCtx, "L" + std::to_string( line.num ), mpMain ) );
+
+        mpEndBlock = llvm::BasicBlock::Create( mCtx, "L_end", mpMain );
+        mpDispatchBlock = llvm::BasicBlock::Create( mCtx, "dispatch", mpMain );
+
+        for( size_t n = 0; n < mProgram.lines.size(); ++n )
+        {
+            const auto& line = mProgram.lines[n];
+
+            mpNextLineBlock = n + 1 < mProgram.lines.size() ? mLineBlocks.at( mProgram.lines[n + 1].num ) : mpEndBlock;
+            mBuilder.SetInsertPoint( mLineBlocks.at( line.num ) );
+
+            try
+            {
+                for( const auto& pStmt : line.statements )
+                    EmitStatement( *pStmt );
+            }
+            catch( const std::runtime_error& e )
+            {
+                throw std::runtime_error( "Line " + std::to_string( line.num ) + " " + e.what() );
+            }
+
+            mBuilder.CreateBr( mpNextLineBlock );
+        }
+
+        mBuilder.SetInsertPoint( mpEndBlock );
+        mBuilder.CreateRetVoid();
+
+        mBuilder.SetInsertPoint( mpDispatchBlock );
+
+        llvm::BasicBlock* const pBadResume = llvm::BasicBlock::Create( mCtx, "bad_resume", mpMain );
+        llvm::SwitchInst* const pSwitch = mBuilder.CreateSwitch( mBuilder.CreateLoad( mI32Ty, mpResume ), pBadResume, static_cast<unsigned>(mResumeBlocks.size()) );
+
+        for( size_t n = 0; n < mResumeBlocks.size(); ++n )
+            pSwitch->addCase( mBuilder.getInt32( static_cast<unsigned>(n) ), mResumeBlocks[n] );
+
+        mBuilder.SetInsertPoint( pBadResume );
+        mBuilder.CreateUnreachable();
+
+        mEntryBuilder.CreateBr( mProgram.lines.empty() ? mpEndBlock : mLineBlocks.begin()->second );
+
+        // The code after GOTO and alike is never executed
+        for( llvm::BasicBlock& block : *mpMain )
+            if( !block.getTerminator() && llvm::pred_empty( &block ) )
+                llvm::IRBuilder<>( &block ).CreateUnreachable();
+
+        std::string err;
+        llvm::raw_string_ostream os{ err };
+
+        if( llvm::verifyModule( mModule, &os ) )
+            throw std::logic_error( "Invalid LLVM IR: " + os.str() );
+    }
+
+    void Optimize( llvm::Module& module )
+    {
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+        llvm::PassBuilder pb;
+
+        pb.registerModuleAnalyses( mam );
+        pb.registerCGSCCAnalyses( cgam );
+        pb.registerFunctionAnalyses( fam );
+        pb.registerLoopAnalyses( lam );
+        pb.crossRegisterProxies( lam, fam, cgam, mam );
+
+        pb.buildPerModuleDefaultPipeline( llvm::OptimizationLevel::O2 ).run( module, mam );
+    }
+}
+
+int Run( const ast::Program& program, int argc, char* argv[] )
+{
+    static std::once_flag s_initFlag;
+
+    std::call_once( s_initFlag, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+    } );
+
+    State state{ program, argc, argv };
+
+    auto pJit = Check( llvm::orc::LLJITBuilder().create() );
+    auto pCtx = std::make_unique<llvm::LLVMContext>();
+    auto pModule = std::make_unique<llvm::Module>( "basic", *pCtx );
+
+    pModule->setDataLayout( pJit->getDataLayout() );
+    pModule->setTargetTriple( pJit->getTargetTriple().str() );
+
+    Compiler compiler{ program, state, *pModule };
+
+    compiler.Compile();
+    Optimize( *pModule );
+
+    auto& lib = pJit->getMainJITDylib();
+    llvm::orc::SymbolMap symbols;
+
+    for( const auto& [name, pAddress] : compiler.GetSymbols() )
+        symbols[pJit->mangleAndIntern( name )] = llvm::JITEvaluatedSymbol( llvm::pointerToJITTargetAddress( pAddress ), llvm::JITSymbolFlags::Exported );
+
+    Check( lib.define( llvm::orc::absoluteSymbols( std::move( symbols ) ) ) );
+
+    // Math functions like powf() come from the process itself
+    lib.addGenerator( Check( llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess( pJit->getDataLayout().getGlobalPrefix() ) ) );
+
+    Check( pJit->addIRModule( llvm::orc::ThreadSafeModule( std::move( pModule ), std::move( pCtx ) ) ) );
+
+    const auto mainSymbol = Check( pJit->lookup( Compiler::MainName ) );
+    const auto pMain = reinterpret_cast<void ( * )()>(mainSymbol.getAddress());
+
+    try
+    {
+        pMain();
+    }
+    catch( const std::exception& e )
+    {
+        return state.rt.ReportError( e );
+    }
+
+    return 0;
+}
+
+}
+
+#endif // BASIC_INT_WITH_LLVM
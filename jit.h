@@ -0,0 +1,17 @@
+#ifndef BASIC_INT_JIT_H
+#define BASIC_INT_JIT_H
+
+#include "ast.h"
+
+namespace jit
+{
+    // Compiles the program into LLVM IR and runs it through ORC JIT.
+    // Numeric operations and control flow are generated inline, while strings,
+    // I/O, DATA and the loop/subroutine stacks are handled by native::Runtime.
+    // Arguments with the ".input" suffix are used as fake input.
+    // Returns the process exit code; compilation errors are thrown.
+    // Only available when built with BASIC_INT_WITH_LLVM.
+    int Run( const ast::Program& program, int argc, char* argv[] );
+}
+
+#endif // BASIC_INT_JIT_H
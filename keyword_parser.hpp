@@ -0,0 +1,131 @@
+#ifndef BASIC_INT_KEYWORD_PARSER_H
+#define BASIC_INT_KEYWORD_PARSER_H
+
+#include <boost/config/warning_disable.hpp>
+#include <boost/spirit/home/x3.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace runtime
+{
+    namespace x3 = boost::spirit::x3;
+
+    // Matches the longest keyword from the table (case insensitive) and jumps straight
+    // to the parser registered for it, instead of trying a long list of alternatives
+    // one by one. If that parser fails, the input is rewound, so the next alternative
+    // can still treat the text as an identifier, e.g. "LENGTH" or "ONE".
+    //
+    // The table is built on the first parse, so the grammars cost nothing at startup.
+    // The copies of the parser inside the rules share it.
+    template<class ParsersT>
+    struct keyword_parser: x3::parser<keyword_parser<ParsersT>>
+    {
+        using attribute_type = x3::unused_type;
+        static bool const has_attribute = false;
+
+        static constexpr size_t KeywordsCount = std::tuple_size_v<ParsersT>;
+
+        keyword_parser( const std::array<const char*, KeywordsCount>& names, ParsersT parsers ):
+            pKeywords{ std::make_shared<LazyKeywords>( names ) }, parsers{ std::move( parsers ) }
+        {}
+
+        template<class IteratorT, class ContextT, class RContextT, class AttributeT>
+        bool parse( IteratorT& first, IteratorT const& last, ContextT const& context, RContextT& rcontext, AttributeT& ) const
+        {
+            static constexpr auto parseFncs = MakeParseFncs<IteratorT, ContextT, RContextT>( std::make_index_sequence<std::tuple_size_v<ParsersT>>{} );
+
+            const IteratorT save = first;
+            unsigned idx = 0;
+
+            if( !pKeywords->Get().parse( first, last, context, rcontext, idx ) )
+                return false;
+
+            if( parseFncs[idx]( parsers, first, last, context, rcontext ) )
+                return true;
+
+            first = save;
+            return false;
+        }
+
+    private:
+        template<class IteratorT, class ContextT, class RContextT, size_t I>
+        static bool ParseImpl( const ParsersT& parsers, IteratorT& first, IteratorT const& last, ContextT const& context, RContextT& rcontext )
+        {
+            return std::get<I>( parsers ).parse( first, last, context, rcontext, x3::unused );
+        }
+
+        template<class IteratorT, class ContextT, class RContextT, size_t... I>
+        static constexpr auto MakeParseFncs( std::index_sequence<I...> )
+        {
+            return std::array{ &ParseImpl<IteratorT, ContextT, RContextT, I>... };
+        }
+
+        using KeywordsParser = decltype(x3::no_case[std::declval<x3::symbols<unsigned>>()]);
+
+        class LazyKeywords
+        {
+        public:
+            explicit LazyKeywords( const std::array<const char*, KeywordsCount>& names ):
+                mNames{ names }
+            {}
+
+            // Parsing may start on many threads at once, see PreparseParallel().
+            // It's called for every statement, so only the first call locks.
+            const KeywordsParser& Get() const
+            {
+                if( const auto* pParser = mpParser.load( std::memory_order_acquire ) )
+                    return *pParser;
+
+                std::call_once( mBuilt, [this] {
+                    x3::symbols<unsigned> keywords;
+
+                    for( unsigned i = 0; i < KeywordsCount; ++i )
+                        keywords.add( mNames[i], i );
+
+                    mParser.emplace( x3::no_case[keywords] );
+                    mpParser.store( std::addressof( *mParser ), std::memory_order_release );
+                } );
+
+                return *mParser;
+            }
+
+        private:
+            std::array<const char*, KeywordsCount> mNames;
+            mutable std::once_flag mBuilt;
+            mutable std::optional<KeywordsParser> mParser;
+            mutable std::atomic<const KeywordsParser*> mpParser = nullptr;
+        };
+
+        std::shared_ptr<const LazyKeywords> pKeywords;
+        ParsersT parsers;
+    };
+
+    namespace detail
+    {
+        template<class ArgsT, size_t... I>
+        auto MakeKeywordParser( ArgsT&& args, std::index_sequence<I...> )
+        {
+            auto parsers = std::make_tuple( x3::as_parser( std::get<2 * I + 1>( args ) )... );
+
+            return keyword_parser<decltype(parsers)>{ { std::get<2 * I>( args )... }, std::move( parsers ) };
+        }
+    }
+
+    // Takes pairs of a lower case keyword and the parser for the rest of the construct:
+    //   keyword_dispatch( "goto", line_num[goto_op], "end", eps[end_op] )
+    template<class... ArgsT>
+    auto keyword_dispatch( ArgsT&&... args )
+    {
+        static_assert( sizeof...(ArgsT) % 2 == 0, "Expected keyword and parser pairs" );
+
+        return detail::MakeKeywordParser( std::forward_as_tuple( args... ), std::make_index_sequence<sizeof...(ArgsT) / 2>{} );
+    }
+}
+
+#endif // BASIC_INT_KEYWORD_PARSER_H
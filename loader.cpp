@@ -0,0 +1,326 @@
+#include "loader.h"
+#include "grammar.h"
+#include "parse_utils.hpp"
+#include "binary_stream.hpp"
+#include "platform.h"
+#include "thread_pool.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace runtime
+{
+namespace
+{
+    constexpr char ProgramCacheMagic[8] = { 'B', 'A', 'S', 'I', 'C', 'P', 'R', 'G' };
+
+    // Has to be increased on changes of the grammar or Program, they may change the image
+    constexpr uint32_t ProgramCacheVersion = 1;
+
+    // Smaller parts of the listing aren't worth a thread
+    constexpr size_t MinPreparseChunkSize = 128 * 1024;
+
+    uint64_t HashSource( std::string_view text )
+    {
+        // FNV-1a
+        uint64_t res = 14695981039346656037ull;
+
+        for( char c : text )
+        {
+            res ^= static_cast<unsigned char>(c);
+            res *= 1099511628211ull;
+        }
+
+        return res;
+    }
+
+    std::shared_ptr<const std::string_view> ReadText( std::istream& in )
+    {
+        return MakeSharedText( { std::istreambuf_iterator<char>{ in }, std::istreambuf_iterator<char>{} } );
+    }
+
+    void WriteCacheHeader( BinaryWriter& writer, std::string_view source )
+    {
+        writer.WriteBytes( ProgramCacheMagic, sizeof( ProgramCacheMagic ) );
+        writer.Write( ProgramCacheVersion );
+        writer.Write( BinaryByteOrderMark );
+        writer.Write( static_cast<uint64_t>(source.size()) );
+        writer.Write( HashSource( source ) );
+    }
+
+    std::shared_ptr<const Program> ReadCache( const std::string& cacheName, std::string_view source )
+    {
+        auto pCache = MapFile( cacheName.c_str() );
+
+        if( !pCache )
+            return nullptr;
+
+        BinaryWriter expected;
+        WriteCacheHeader( expected, source );
+
+        const auto& header = expected.GetBuffer();
+
+        if( pCache->substr( 0, header.size() ) != header )
+            return nullptr;
+
+        try
+        {
+            // The lines stay in the mapped cache
+            BinaryReader reader{ pCache->substr( header.size() ) };
+            auto pProgram = std::make_shared<Program>();
+            pProgram->AddSource( std::move( pCache ) );
+            pProgram->Deserialize( reader );
+
+            return reader.IsEnd() ? pProgram : nullptr;
+        }
+        catch( const std::exception& )
+        {
+            return nullptr;
+        }
+    }
+
+    void WriteCache( const std::string& cacheName, std::string_view source, const Program& program )
+    {
+        BinaryWriter writer;
+        WriteCacheHeader( writer, source );
+        program.Serialize( writer );
+
+        // A reader never sees a partially written file, other writers of the same cache
+        // have their own temporary files
+        const std::string tmpName = MakeTempFileName( cacheName );
+        const auto& buf = writer.GetBuffer();
+
+        {
+            std::ofstream flOut{ tmpName, std::ios::binary | std::ios::trunc };
+
+            if( !flOut || !flOut.write( buf.data(), static_cast<std::streamsize>(buf.size()) ) )
+                return;
+        }
+
+        if( std::rename( tmpName.c_str(), cacheName.c_str() ) != 0 )
+        {
+            // Windows doesn't replace existing files
+            std::remove( cacheName.c_str() );
+
+            if( std::rename( tmpName.c_str(), cacheName.c_str() ) != 0 )
+                std::remove( tmpName.c_str() );
+        }
+    }
+
+    bool PreparseLines( std::string_view text, Runtime& runtime )
+    {
+        while( !text.empty() )
+        {
+            const size_t lineEnd = text.find( '\n' );
+            std::string_view str = text.substr( 0, lineEnd );
+            text.remove_prefix( lineEnd != std::string_view::npos ? lineEnd + 1 : text.size() );
+
+            if( !str.empty() && str.back() == '\r' )
+                str.remove_suffix( 1 );
+
+            boost::spirit::x3::unused_type res{};
+            std::string err{};
+
+            const auto parseFnc = [&runtime, &res]( auto& args )
+            {
+                return phrase_parse( args.cur, args.end, args.MakeFullParser(runtime, preparse::line_rule()), args.spaceParser, res );
+            };
+
+            if( !ParseSingle( str, 0, err, parseFnc ) )
+            {
+                auto& errOut = runtime.Err();
+                errOut << "\033[91m" "-------------------------\n";
+                errOut << "Preparse failed\n" << str << "\n";
+                errOut << "Error: \"" << err << "\"\n";
+                errOut << "-------------------------\n" "\033[0m";
+
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Splits the text at line boundaries. A ':' line continues the previous one, so it
+    // never starts a chunk, and neither do the empty lines before it.
+    std::vector<std::string_view> SplitIntoChunks( std::string_view text, size_t count )
+    {
+        constexpr auto npos = std::string_view::npos;
+
+        const size_t chunkSize = text.size() / count + 1;
+        std::vector<std::string_view> res;
+
+        while( !text.empty() )
+        {
+            size_t end = chunkSize < text.size() ? text.find( '\n', chunkSize ) : npos;
+
+            while( end != npos )
+            {
+                const size_t next = text.find_first_not_of( " \t\r\v\f", end + 1 );
+
+                if( next == npos || (text[next] != ':' && text[next] != '\n') )
+                    break;
+
+                end = text.find( '\n', next );
+            }
+
+            end = end != npos ? end + 1 : text.size();
+            res.push_back( text.substr( 0, end ) );
+            text.remove_prefix( end );
+        }
+
+        return res;
+    }
+
+    // Every chunk is preparsed on its own runtime, the parts are appended in order, so the
+    // DATA pool and the line index are the same as after the sequential preparse. Nothing
+    // is reported here, nullopt on any error and the sequential preparse reports it.
+    std::optional<Program> PreparseParallel( const std::shared_ptr<const std::string_view>& pText, unsigned threadsCount )
+    {
+        const auto chunks = SplitIntoChunks( *pText, std::min<size_t>( threadsCount, pText->size() / MinPreparseChunkSize ) );
+        std::vector<Program> parts( chunks.size() );
+        std::vector<char> success( chunks.size() );
+
+        RunParallel( chunks.size(), threadsCount, [&]( size_t idx ) {
+            std::istringstream in;
+            std::ostringstream err;
+            Runtime runtime;
+            runtime.SetStreams( in, err, err );
+            runtime.AddProgramSource( pText );
+
+            success[idx] = PreparseLines( chunks[idx], runtime );
+            parts[idx] = runtime.TakeProgram();
+        } );
+
+        if( std::find( success.begin(), success.end(), false ) != success.end() )
+            return std::nullopt;
+
+        Program res;
+
+        try
+        {
+            for( auto& part : parts )
+                res.Append( std::move( part ) );
+        }
+        catch( const std::exception& )
+        {
+            return std::nullopt;
+        }
+
+        return res;
+    }
+}
+
+bool Preparse( std::shared_ptr<const std::string_view> pText, Runtime& runtime, unsigned threadsCount )
+{
+    if( threadsCount == 0 )
+        threadsCount = std::thread::hardware_concurrency();
+
+    if( pText->size() >= 2 * MinPreparseChunkSize && threadsCount > 1 )
+    {
+        if( auto program = PreparseParallel( pText, threadsCount ) )
+        {
+            try
+            {
+                runtime.AppendProgram( std::move( *program ) );
+                return true;
+            }
+            catch( const std::exception& )
+            {
+                // Out of order with the lines the runtime already has
+            }
+        }
+    }
+
+    const std::string_view text = *pText;
+    runtime.AddProgramSource( std::move( pText ) );
+
+    return PreparseLines( text, runtime );
+}
+
+bool Preparse( std::istream& in, Runtime& runtime )
+{
+    return Preparse( ReadText( in ), runtime );
+}
+
+std::shared_ptr<const Program> LoadProgram( std::shared_ptr<const std::string_view> pText, std::ostream& err, unsigned threadsCount )
+{
+    std::istringstream in;
+    Runtime runtime;
+    runtime.SetStreams( in, err, err );
+
+    return Preparse( std::move( pText ), runtime, threadsCount ) ? runtime.GetSharedProgram() : nullptr;
+}
+
+std::shared_ptr<const Program> LoadProgram( std::istream& in, std::ostream& err )
+{
+    return LoadProgram( ReadText( in ), err );
+}
+
+bool PreparseLine( std::string_view str, linenum_t& line, Program& part, std::ostream& err )
+{
+    const size_t begin = str.find_first_not_of( " \t" );
+    const char* pBegin = str.data() + (begin != std::string_view::npos ? begin : str.size());
+    const auto [pEnd, ec] = std::from_chars( pBegin, str.data() + str.size(), line );
+
+    if( ec != std::errc{} )
+    {
+        err << "\033[91m" "-------------------------\n";
+        err << "Preparse failed\n" << str << "\n";
+        err << "Error: \"Wrong line number\"\n";
+        err << "-------------------------\n" "\033[0m";
+
+        return false;
+    }
+
+    part.Clear();
+
+    if( std::string_view{ pEnd, static_cast<size_t>(str.data() + str.size() - pEnd) }.find_first_not_of( " \t\r" ) == std::string_view::npos )
+        return true;
+
+    std::istringstream in;
+    Runtime runtime;
+    runtime.SetStreams( in, err, err );
+
+    if( !Preparse( MakeSharedText( std::string{ str } ), runtime, 1 ) )
+        return false;
+
+    part = runtime.TakeProgram();
+
+    return true;
+}
+
+std::string GetProgramCacheName( const std::string& fileName )
+{
+    return boost::algorithm::iends_with( fileName, ".bas" ) ? fileName + 'c' : fileName + ".basc";
+}
+
+std::shared_ptr<const Program> LoadProgramCached( const std::string& fileName, std::ostream& err )
+{
+    auto pSource = MapFile( fileName.c_str() );
+
+    if( !pSource )
+        return LoadProgram( std::make_shared<const std::string_view>(), err );
+
+    const std::string cacheName = GetProgramCacheName( fileName );
+
+    if( auto pProgram = ReadCache( cacheName, *pSource ) )
+        return pProgram;
+
+    auto pProgram = LoadProgram( pSource, err );
+
+    if( pProgram )
+        WriteCache( cacheName, *pSource, *pProgram );
+
+    return pProgram;
+}
+}
@@ -0,0 +1,36 @@
+#ifndef BASIC_INT_LOADER_H
+#define BASIC_INT_LOADER_H
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "runtime.h"
+
+namespace runtime
+{
+    // Adds the lines of the listing to the program of the runtime, the errors are printed to runtime.Err().
+    // The program references the lines inside the text, e.g. a file from MapFile(), instead of copying them.
+    // Large listings are split into chunks preparsed on threadsCount threads (0 - one per core).
+    bool Preparse( std::shared_ptr<const std::string_view> pText, Runtime& runtime, unsigned threadsCount = 0 );
+    bool Preparse( std::istream& in, Runtime& runtime );
+
+    // Loads the listing into a program which can be shared by many runtimes, nullptr on errors
+    std::shared_ptr<const Program> LoadProgram( std::shared_ptr<const std::string_view> pText, std::ostream& err, unsigned threadsCount = 0 );
+    std::shared_ptr<const Program> LoadProgram( std::istream& in, std::ostream& err );
+
+    // Preparses a single numbered line, e.g. typed in the interactive mode, into a separate
+    // program for Runtime::PatchLine(). A line with only the number gives an empty program,
+    // i.e. deletes the line. False on errors, they are printed to err.
+    bool PreparseLine( std::string_view str, linenum_t& line, Program& part, std::ostream& err );
+
+    // Like LoadProgram() but keeps the preparsed program in a cache file next to the source,
+    // "game.bas" -> "game.basc". The cache is used while the hash of the source and the
+    // format version match, otherwise it's written again. Failing to write it isn't an error.
+    std::shared_ptr<const Program> LoadProgramCached( const std::string& fileName, std::ostream& err );
+
+    std::string GetProgramCacheName( const std::string& fileName );
+}
+
+#endif // BASIC_INT_LOADER_H
@@ -0,0 +1,250 @@
+#include "native_runtime.h"
+#include "platform.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+namespace native
+{
+namespace
+{
+    template<class T>
+    void PrintNumberImpl( T val )
+    {
+        // See runtime::Runtime::PrintNumberImpl()
+        if( val >= 0 )
+            std::cout << ' ';
+
+        std::cout << val << ' ';
+    }
+}
+
+Runtime::Runtime( int argc, char* argv[], std::vector<value_t> data, std::map<linenum_t, size_t> lineToDataPos ) :
+    mData{ std::move( data ) }, mLineToDataPos{ std::move( lineToDataPos ) }
+{
+    EnableConsoleColors();
+
+    for( int i = 1; i < argc; ++i )
+    {
+        if( !boost::algorithm::ends_with( argv[i], ".input" ) )
+            continue;
+
+        std::ifstream flIn( argv[i] );
+        std::string str;
+
+        while( std::getline( flIn, str ) )
+            mFakeInput.push_back( std::move( str ) );
+    }
+
+    //We need a deterministic rand() for automation
+    Randomize( mFakeInput.empty() ? (unsigned int)std::time( 0 ) : 0 );
+}
+
+void Runtime::Print( int_t val ) const
+{
+    PrintNumberImpl( val );
+}
+
+void Runtime::Print( float_t val ) const
+{
+    PrintNumberImpl( val );
+}
+
+void Runtime::Print( const str_t& val ) const
+{
+    std::cout << val;
+}
+
+void Runtime::PrintTab( int_t count ) const
+{
+    Print( str_t( count, ' ' ) );
+}
+
+std::string Runtime::NextInput( const char* szPrompt )
+{
+    const std::string_view prompt{ szPrompt };
+    std::string str;
+
+    std::cout << prompt;
+
+    if( prompt.empty() || prompt.back() != '?' )
+        std::cout << '?';
+
+    std::cout << ' ';
+
+    if( mFakeInput.empty() )
+    {
+        RestoreConsoleInput();
+
+        if( !std::getline( std::cin, str ) )
+            throw std::runtime_error( "std::getline() error" );
+
+        if( !mInputLog.is_open() )
+            mInputLog.open( "input.log" );
+
+        mInputLog << str << std::endl;
+    }
+    else
+    {
+        str = std::move( mFakeInput.front() );
+        mFakeInput.pop_front();
+        std::cout << str << std::endl;
+    }
+
+    return str;
+}
+
+void Runtime::Input( const char* szPrompt, str_t& var )
+{
+    var = NextInput( szPrompt );
+}
+
+void Runtime::Input( const char* szPrompt, int_t& var )
+{
+    for( ;; )
+    {
+        const std::string str = NextInput( szPrompt );
+        char* pLast = nullptr;
+        const long res = std::strtol( str.c_str(), &pLast, 10 );
+
+        if( pLast == str.c_str() + str.size() )
+        {
+            var = static_cast<int_t>(res);
+            return;
+        }
+
+        std::cout << "?REENTER" << std::endl;
+    }
+}
+
+void Runtime::Input( const char* szPrompt, float_t& var )
+{
+    for( ;; )
+    {
+        const std::string str = NextInput( szPrompt );
+        char* pLast = nullptr;
+        const float_t res = std::strtof( str.c_str(), &pLast );
+
+        if( pLast == str.c_str() + str.size() )
+        {
+            var = res;
+            return;
+        }
+
+        std::cout << "?REENTER" << std::endl;
+    }
+}
+
+str_t Runtime::Inkey()
+{
+    if( mFakeInput.empty() )
+    {
+        const int key = PollKbKey();
+        return key != 0 ? std::string( 1, (char)key ) : std::string( "" );
+    }
+
+    std::string res{ std::move( mFakeInput.front() ) };
+
+    mFakeInput.pop_front();
+
+    return res;
+}
+
+const value_t& Runtime::NextData()
+{
+    if( mCurDataIdx >= mData.size() )
+        throw std::runtime_error( "Out of DATA" );
+
+    return mData[mCurDataIdx++];
+}
+
+void Runtime::Read( str_t& var )
+{
+    const value_t& val = NextData();
+    const str_t* pS = boost::get<str_t>( &val );
+
+    if( !pS )
+        throw std::runtime_error( "Expected String variable" );
+
+    var = *pS;
+}
+
+void Runtime::Read( int_t& var )
+{
+    var = runtime::ForceInt( NextData() );
+}
+
+void Runtime::Read( float_t& var )
+{
+    var = runtime::ForceFloat( NextData() );
+}
+
+void Runtime::Restore()
+{
+    mCurDataIdx = 0;
+}
+
+void Runtime::Restore( linenum_t line )
+{
+    const auto it = mLineToDataPos.find( line );
+
+    if( it == mLineToDataPos.end() )
+        throw std::runtime_error( "Unknown line " + std::to_string( line ) );
+
+    mCurDataIdx = it->second;
+}
+
+void Runtime::Randomize( unsigned int n )
+{
+    mRandom.Seed( n );
+}
+
+unsigned Runtime::Return()
+{
+    if( mGosubStack.empty() )
+        throw std::runtime_error( "Mismatched GOSUB/RETURN statement" );
+
+    const unsigned res = mGosubStack.back();
+    mGosubStack.pop_back();
+
+    return res;
+}
+
+const Runtime::ForLoopItem& Runtime::Next( unsigned varId )
+{
+    for( ;; )
+    {
+        if( mForLoopStack.empty() )
+            throw std::runtime_error( "Mismatched FOR/NEXT statement" );
+
+        if( varId == AnyForLoopVar || varId == mForLoopStack.back().varId )
+            break;
+
+        mForLoopStack.pop_back();
+    }
+
+    return mForLoopStack.back();
+}
+
+int_t Runtime::OnBranch( int_t num, int_t count )
+{
+    if( num <= 0 || num > count )
+        throw std::runtime_error( "ON statement incorrect branch #" + std::to_string( num ) );
+
+    return num;
+}
+
+int Runtime::ReportError( const std::exception& e ) const
+{
+    std::cout << std::flush;
+    std::cerr << "\033[91m" "-------------------------\n";
+    std::cerr << "Execute failed\n";
+    std::cerr << "Error: " << e.what() << "\n";
+    std::cerr << "-------------------------\n" "\033[0m";
+
+    return 1;
+}
+
+}
@@ -0,0 +1,200 @@
+#ifndef BASIC_INT_NATIVE_RUNTIME_H
+#define BASIC_INT_NATIVE_RUNTIME_H
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "value.h"
+
+// Support library for the C++ code generated by `basic_int --emit-cpp`.
+// It mirrors the behavior of runtime::Runtime, but all variables are
+// resolved at compile time and live in the generated code.
+namespace native
+{
+    using runtime::value_t;
+    using runtime::int_t;
+    using runtime::float_t;
+    using runtime::str_t;
+    using runtime::linenum_t;
+
+    // The interpreter allows to access any array element, even outside of DIM
+    // boundaries. The elements inside of the boundaries are stored densely,
+    // and the rest of them go to the sparse storage.
+    template<class T>
+    class Array
+    {
+    public:
+        void Dim( std::vector<int_t> dimensions )
+        {
+            size_t size = 1;
+
+            for( auto d : dimensions )
+            {
+                if( d < 0 )
+                    throw std::runtime_error( "Illegal DIM size" );
+
+                if( size > SIZE_MAX / sizeof( T ) / (static_cast<size_t>(d) + 1) )
+                    throw std::runtime_error( "Array too large" );
+
+                size *= static_cast<size_t>(d) + 1;
+            }
+
+            mDimensions = std::move( dimensions );
+            mElements.assign( size, T{} );
+        }
+
+        template<class... I>
+        T& At( I... indices )
+        {
+            const std::array<int_t, sizeof...(I)> idx{ static_cast<int_t>(indices)... };
+
+            return Element( idx.data(), idx.size() );
+        }
+
+        template<class... I>
+        T Get( I... indices ) const
+        {
+            const std::array<int_t, sizeof...(I)> idx{ static_cast<int_t>(indices)... };
+
+            if( const T* const p = const_cast<Array*>(this)->FindDense( idx.data(), idx.size() ) )
+                return *p;
+
+            const auto it = mSparse.find( std::vector<int_t>( idx.begin(), idx.end() ) );
+
+            return it != mSparse.end() ? it->second : T{};
+        }
+
+        T& Element( const int_t* pIndices, size_t count )
+        {
+            if( T* const p = FindDense( pIndices, count ) )
+                return *p;
+
+            return mSparse[std::vector<int_t>( pIndices, pIndices + count )];
+        }
+
+    private:
+        T* FindDense( const int_t* pIndices, size_t count )
+        {
+            if( count != mDimensions.size() )
+                return nullptr;
+
+            size_t pos = 0;
+
+            for( size_t i = 0; i < count; ++i )
+            {
+                if( pIndices[i] < 0 || pIndices[i] > mDimensions[i] )
+                    return nullptr;
+
+                pos = pos * (static_cast<size_t>(mDimensions[i]) + 1) + pIndices[i];
+            }
+
+            return &mElements[pos];
+        }
+
+    private:
+        std::vector<int_t> mDimensions;
+        std::vector<T> mElements;
+        std::map<std::vector<int_t>, T> mSparse;
+    };
+
+    class Runtime
+    {
+    public:
+        static constexpr unsigned AnyForLoopVar = ~0u;
+
+        struct ForLoopItem
+        {
+            unsigned varId;
+            float_t targetVal;
+            float_t stepVal;
+            unsigned resumePoint;
+
+            bool IsContinue( float_t curVal ) const
+            {
+                return stepVal < 0 ? targetVal <= curVal : curVal <= targetVal;
+            }
+        };
+
+        // All arguments with the ".input" suffix are used as fake input
+        Runtime( int argc, char* argv[], std::vector<value_t> data, std::map<linenum_t, size_t> lineToDataPos );
+
+        void Print( int_t val ) const;
+        void Print( float_t val ) const;
+        void Print( const str_t& val ) const;
+        void PrintTab( int_t count ) const;
+
+        void Input( const char* szPrompt, str_t& var );
+        void Input( const char* szPrompt, int_t& var );
+        void Input( const char* szPrompt, float_t& var );
+
+        str_t Inkey();
+
+        void Read( str_t& var );
+        void Read( int_t& var );
+        void Read( float_t& var );
+
+        void Restore();
+        void Restore( linenum_t line );
+
+        void Randomize( unsigned int n );
+
+        float_t Rnd( float_t val )
+        {
+            return runtime::RndImpl( val, mRandom );
+        }
+
+        void Gosub( unsigned resumePoint )
+        {
+            mGosubStack.push_back( resumePoint );
+        }
+
+        unsigned Return();
+
+        void ForLoop( unsigned varId, float_t targetVal, float_t stepVal, unsigned resumePoint )
+        {
+            mForLoopStack.push_back( { varId, targetVal, stepVal, resumePoint } );
+        }
+
+        const ForLoopItem& Next( unsigned varId );
+
+        void PopForLoop()
+        {
+            mForLoopStack.pop_back();
+        }
+
+        static int_t OnBranch( int_t num, int_t count );
+
+        template<class FncT>
+        static FncT CheckFn( FncT pFnc, const char* szName )
+        {
+            if( !pFnc )
+                throw std::runtime_error( std::string( "Unknown function name " ) + szName );
+
+            return pFnc;
+        }
+
+        int ReportError( const std::exception& e ) const;
+
+    private:
+        const value_t& NextData();
+        std::string NextInput( const char* szPrompt );
+
+    private:
+        std::vector<ForLoopItem> mForLoopStack;
+        std::vector<unsigned> mGosubStack;
+        std::deque<std::string> mFakeInput;
+        std::vector<value_t> mData;
+        std::map<linenum_t, size_t> mLineToDataPos;
+        size_t mCurDataIdx = 0;
+        runtime::Random mRandom;
+        std::ofstream mInputLog;
+    };
+}
+
+#endif // BASIC_INT_NATIVE_RUNTIME_H
@@ -0,0 +1,88 @@
+#ifndef BASIC_INT_OUTPUT_STREAM_H
+#define BASIC_INT_OUTPUT_STREAM_H
+
+#include <array>
+#include <functional>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+
+namespace runtime
+{
+    // An output stream for Runtime::SetStreams() which passes the text to a callback
+    // instead of a console or a string. The text is collected in a small buffer and
+    // handed over as views into it, big writes are passed as they are. The views are
+    // only valid during the call. flush() or std::endl pass the rest of the buffer.
+    class OutputStream : public std::ostream
+    {
+    public:
+        using Callback = std::function<void( std::string_view text )>;
+
+        explicit OutputStream( Callback callback ) :
+            std::ostream{ &mBuf }, mBuf{ std::move( callback ) }
+        {}
+
+    private:
+        class CallbackBuf : public std::streambuf
+        {
+        public:
+            explicit CallbackBuf( Callback callback ) : mCallback{ std::move( callback ) }
+            {
+                setp( mBuf.data(), mBuf.data() + mBuf.size() );
+            }
+
+        protected:
+            int_type overflow( int_type ch ) override
+            {
+                Flush();
+
+                if( !traits_type::eq_int_type( ch, traits_type::eof() ) )
+                {
+                    *pptr() = traits_type::to_char_type( ch );
+                    pbump( 1 );
+                }
+
+                return traits_type::not_eof( ch );
+            }
+
+            std::streamsize xsputn( const char* pStr, std::streamsize count ) override
+            {
+                if( count <= epptr() - pptr() )
+                {
+                    traits_type::copy( pptr(), pStr, static_cast<size_t>(count) );
+                    pbump( static_cast<int>(count) );
+                }
+                else
+                {
+                    Flush();
+                    mCallback( { pStr, static_cast<size_t>(count) } );
+                }
+
+                return count;
+            }
+
+            int sync() override
+            {
+                Flush();
+                return 0;
+            }
+
+        private:
+            void Flush()
+            {
+                if( pptr() != pbase() )
+                    mCallback( { pbase(), static_cast<size_t>(pptr() - pbase()) } );
+
+                setp( mBuf.data(), mBuf.data() + mBuf.size() );
+            }
+
+        private:
+            Callback mCallback;
+            std::array<char, 1024> mBuf;
+        };
+
+        CallbackBuf mBuf;
+    };
+}
+
+#endif // BASIC_INT_OUTPUT_STREAM_H
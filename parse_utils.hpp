@@ -7,6 +7,9 @@
 #include <boost/config/warning_disable.hpp>
 #include <boost/spirit/home/x3.hpp>
 
+#include <algorithm>
+#include <iterator>
+
 namespace runtime
 {
     struct ParseArgs
@@ -157,6 +160,9 @@ namespace runtime
 
             TStateQueue stateQueue{ State::SkipHeadSeparator, State::ParseStatement, State::SkipTailSeparator };
 
+            // The statement suspended in THEN branches skips their ELSE parts after the resume
+            stateQueue.insert( std::prev( stateQueue.end() ), runtime.TakeSkipElseOnResume(), State::SkipElse );
+
             for(;;)
             {
                 if( stateQueue.empty() )
@@ -175,6 +181,11 @@ namespace runtime
 
                         if( !runtime.IsExpectedToContinueLineExecution() )
                         {
+                            const auto itNotSkipElse = std::find_if( stateQueue.begin(), stateQueue.end(), []( State state ) {
+                                return state != State::SkipElse;
+                            } );
+
+                            runtime.SetSkipElseOnResume( static_cast<unsigned>(itNotSkipElse - stateQueue.begin()) );
                             args.cur = args.end;
                             return true;
                         }
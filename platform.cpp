@@ -1,10 +1,105 @@
 #include "platform.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <utility>
+
 #ifdef _WIN32
 #include <Windows.h>
 #include <conio.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // A loop spending less than this between the polls does nothing else
+    constexpr auto BusyPollPeriod = std::chrono::milliseconds( 1 );
+    constexpr unsigned BusyPollsBeforeWait = 100;
+    constexpr int IdleWaitMs = 10;
+
+    // Smaller zeroed blocks come from the heap, a mapping per block would waste pages and syscalls
+    constexpr size_t MinMappedSize = 64 * 1024;
+
+#ifndef _WIN32
+    bool gRawMode = false;
+    termios gSavedTermios{};
+
+    // Ctrl+C must not leave the terminal without echo
+    void RestoreAndRaise( int sig )
+    {
+        RestoreConsoleInput();
+        std::signal( sig, SIG_DFL );
+        std::raise( sig );
+    }
+
+    bool EnableRawMode()
+    {
+        if( gRawMode )
+            return true;
+
+        if( !isatty( STDIN_FILENO ) || tcgetattr( STDIN_FILENO, &gSavedTermios ) != 0 )
+            return false;
+
+        static const bool registered = [] {
+            std::signal( SIGINT, RestoreAndRaise );
+            std::signal( SIGTERM, RestoreAndRaise );
+            return std::atexit( RestoreConsoleInput ) == 0;
+        }();
+        (void)registered;
+
+        termios raw = gSavedTermios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+
+        gRawMode = tcsetattr( STDIN_FILENO, TCSANOW, &raw ) == 0;
+
+        return gRawMode;
+    }
 #endif
 
+    bool WaitForKbKey( int timeoutMs )
+    {
+#ifdef _WIN32
+        WaitForSingleObject( GetStdHandle( STD_INPUT_HANDLE ), static_cast<DWORD>(timeoutMs) );
+        return _kbhit() != 0;
+#else
+        if( !EnableRawMode() )
+            return false;
+
+        pollfd fd{ STDIN_FILENO, POLLIN, 0 };
+        return poll( &fd, 1, timeoutMs ) > 0;
+#endif
+    }
+
+    std::shared_ptr<const std::string_view> ReadFile( const char* szFileName )
+    {
+        std::ifstream flIn{ szFileName, std::ios::binary };
+
+        if( !flIn )
+            return nullptr;
+
+        auto pBuf = std::make_shared<std::pair<std::string, std::string_view>>();
+        pBuf->first.assign( std::istreambuf_iterator<char>{ flIn }, std::istreambuf_iterator<char>{} );
+        pBuf->second = pBuf->first;
+
+        return { pBuf, &pBuf->second };
+    }
+}
+
 void EnableConsoleColors()
 {
     //List of codes: https://stackoverflow.com/a/33206814/3415353
@@ -19,8 +114,205 @@ void EnableConsoleColors()
 int GetPressedKbKey()
 {
 #ifdef _WIN32
-    return _kbhit();
+    return _kbhit() ? _getch() : 0;
 #else
-    return 0;
+    if( !WaitForKbKey( 0 ) )
+        return 0;
+
+    unsigned char c = 0;
+    return read( STDIN_FILENO, &c, 1 ) == 1 ? c : 0;
+#endif
+}
+
+int PollKbKey()
+{
+    static unsigned busyPolls = 0;
+    static auto lastPollTime = std::chrono::steady_clock::time_point{};
+
+    const auto now = std::chrono::steady_clock::now();
+    busyPolls = now - lastPollTime < BusyPollPeriod ? busyPolls + 1 : 0;
+
+    if( busyPolls >= BusyPollsBeforeWait )
+        WaitForKbKey( IdleWaitMs );
+
+    const int key = GetPressedKbKey();
+
+    if( key != 0 )
+        busyPolls = 0;
+
+    lastPollTime = std::chrono::steady_clock::now();
+
+    return key;
+}
+
+void RestoreConsoleInput()
+{
+#ifndef _WIN32
+    if( gRawMode )
+    {
+        tcsetattr( STDIN_FILENO, TCSANOW, &gSavedTermios );
+        gRawMode = false;
+    }
 #endif
-}
\ No newline at end of file
+}
+
+std::shared_ptr<const std::string_view> MapFile( const char* szFileName )
+{
+#ifdef _WIN32
+    const HANDLE hFile = CreateFileA( szFileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+
+    if( hFile == INVALID_HANDLE_VALUE )
+        return nullptr;
+
+    LARGE_INTEGER size{};
+    const HANDLE hMapping = GetFileSizeEx( hFile, &size ) && size.QuadPart > 0 ?
+        CreateFileMappingA( hFile, nullptr, PAGE_READONLY, 0, 0, nullptr ) : nullptr;
+    const void* pData = hMapping ? MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 ) : nullptr;
+
+    //The view keeps the file open
+    if( hMapping )
+        CloseHandle( hMapping );
+
+    CloseHandle( hFile );
+
+    if( !pData )
+        return ReadFile( szFileName );
+
+    return std::shared_ptr<const std::string_view>(
+        new std::string_view( static_cast<const char*>(pData), static_cast<size_t>(size.QuadPart) ),
+        []( const std::string_view* pView ) {
+            UnmapViewOfFile( pView->data() );
+            delete pView;
+        } );
+#else
+    const int fd = open( szFileName, O_RDONLY | O_CLOEXEC );
+
+    if( fd < 0 )
+        return nullptr;
+
+    struct stat st{};
+    void* pData = fstat( fd, &st ) == 0 && st.st_size > 0 ?
+        mmap( nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0 ) : MAP_FAILED;
+
+    //The mapping keeps the file open
+    close( fd );
+
+    if( pData == MAP_FAILED )
+        return ReadFile( szFileName );
+
+    return std::shared_ptr<const std::string_view>(
+        new std::string_view( static_cast<const char*>(pData), static_cast<size_t>(st.st_size) ),
+        []( const std::string_view* pView ) {
+            munmap( const_cast<char*>(pView->data()), pView->size() );
+            delete pView;
+        } );
+#endif
+}
+
+std::string MakeTempFileName( const std::string& fileName )
+{
+    static std::atomic<unsigned> counter{ 0 };
+
+#ifdef _WIN32
+    const unsigned long pid = GetCurrentProcessId();
+#else
+    const unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+
+    return fileName + "." + std::to_string( pid ) + "." + std::to_string( counter++ ) + ".tmp";
+}
+
+ZeroedMemory::ZeroedMemory( size_t size ) :
+    mSize{ size }
+{
+    if( size == 0 )
+        return;
+
+    if( size < MinMappedSize )
+    {
+        mpData = std::calloc( size, 1 );
+    }
+    else
+    {
+#ifdef _WIN32
+        //Committed pages are zero and backed on the first access
+        mpData = VirtualAlloc( nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+#else
+        void* pData = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        mpData = pData != MAP_FAILED ? pData : nullptr;
+#endif
+    }
+
+    if( !mpData )
+        throw std::bad_alloc{};
+}
+
+ZeroedMemory::ZeroedMemory( const ZeroedMemory& other ) :
+    ZeroedMemory( other.mSize )
+{
+    CopyFrom( other.mpData, other.mSize );
+}
+
+ZeroedMemory::ZeroedMemory( ZeroedMemory&& other ) noexcept :
+    mpData{ std::exchange( other.mpData, nullptr ) },
+    mSize{ std::exchange( other.mSize, 0 ) }
+{
+}
+
+ZeroedMemory& ZeroedMemory::operator=( ZeroedMemory other ) noexcept
+{
+    std::swap( mpData, other.mpData );
+    std::swap( mSize, other.mSize );
+
+    return *this;
+}
+
+ZeroedMemory::~ZeroedMemory()
+{
+    if( !mpData )
+        return;
+
+    if( mSize < MinMappedSize )
+        std::free( mpData );
+    else
+#ifdef _WIN32
+        VirtualFree( mpData, 0, MEM_RELEASE );
+#else
+        munmap( mpData, mSize );
+#endif
+}
+
+void ZeroedMemory::CopyFrom( const void* pSrc, size_t size, size_t offset )
+{
+    const char* pFrom = static_cast<const char*>(pSrc);
+    char* pTo = static_cast<char*>(mpData) + offset;
+
+    for( size_t offset = 0; offset < size; offset += PageSize )
+    {
+        const size_t count = std::min( PageSize, size - offset );
+
+        //Reading a page which was never written doesn't back it
+        if( !IsZero( pFrom + offset, count ) )
+            std::memcpy( pTo + offset, pFrom + offset, count );
+    }
+}
+
+size_t ZeroedMemory::GetUsedSize() const
+{
+    if( mSize < MinMappedSize )
+        return mSize;
+
+    size_t res = 0;
+
+    ForEachUsedPage( [&res]( size_t, size_t size ) {
+        res += size;
+    } );
+
+    return res;
+}
+
+bool ZeroedMemory::IsZero( const char* pData, size_t size )
+{
+    //Every byte is equal to the next one and the first one is zero
+    return size == 0 || (pData[0] == 0 && std::memcmp( pData, pData + 1, size - 1 ) == 0);
+}
@@ -1,10 +1,91 @@
 #ifndef BASIC_INT_PLATFORM_H
 #define BASIC_INT_PLATFORM_H
 
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
 void EnableConsoleColors();
+
+// The code of a pressed key or 0, never waits. On Linux the terminal is switched
+// to the raw mode for that, until RestoreConsoleInput() or the exit.
 int GetPressedKbKey();
 
+// GetPressedKbKey() for INKEY$. A program polling INKEY$ in a tight loop is idle,
+// so after many empty polls in a row every poll waits for a key a few milliseconds
+// instead of burning the core. A key press still returns at once.
+int PollKbKey();
 
-#endif // BASIC_INT_PLATFORM_H
+// Line input is edited by the terminal, so INPUT has to call it before reading
+void RestoreConsoleInput();
+
+// The whole file, mapped into memory or read if it can't be mapped. The data lives
+// while the pointer or its copies exist and the file must not be truncated until then.
+// nullptr if the file can't be opened.
+std::shared_ptr<const std::string_view> MapFile( const char* szFileName );
+
+// A name of a temporary file next to the file, no other process or thread gets the same
+// one, so they can write their versions of the file at once and rename them over it
+std::string MakeTempFileName( const std::string& fileName );
+
+// A zero-filled block. Large blocks are mapped from the OS, their pages take memory only
+// when they are written, so the size costs nothing until it's used. Copies skip the pages
+// which are still zero. Throws std::bad_alloc if there is no address space left.
+class ZeroedMemory
+{
+public:
+    static constexpr size_t PageSize = 4096;
+
+    ZeroedMemory() = default;
+    explicit ZeroedMemory( size_t size );
+    ZeroedMemory( const ZeroedMemory& other );
+    ZeroedMemory( ZeroedMemory&& other ) noexcept;
+    ZeroedMemory& operator=( ZeroedMemory other ) noexcept;
+    ~ZeroedMemory();
+
+    void* data()
+    {
+        return mpData;
+    }
+
+    const void* data() const
+    {
+        return mpData;
+    }
 
+    size_t size() const
+    {
+        return mSize;
+    }
 
+    // Copies size bytes of pSrc to the block at offset, the block has to be zero there.
+    // The zero pages of pSrc are skipped.
+    void CopyFrom( const void* pSrc, size_t size, size_t offset = 0 );
+
+    // Calls fnc( offset, size ) for every page which isn't zero
+    template<class FncT>
+    void ForEachUsedPage( FncT&& fnc ) const
+    {
+        for( size_t offset = 0; offset < mSize; offset += PageSize )
+        {
+            const size_t size = std::min( PageSize, mSize - offset );
+
+            if( !IsZero( static_cast<const char*>(mpData) + offset, size ) )
+                fnc( offset, size );
+        }
+    }
+
+    // The pages which aren't zero, an estimate of the memory the block takes
+    size_t GetUsedSize() const;
+
+private:
+    static bool IsZero( const char* pData, size_t size );
+
+    void* mpData = nullptr;
+    size_t mSize = 0;
+};
+
+
+#endif // BASIC_INT_PLATFORM_H
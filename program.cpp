@@ -0,0 +1,422 @@
+#include "program.h"
+#include "binary_stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+
+namespace runtime
+{
+std::shared_ptr<const std::string_view> MakeSharedText( std::string str )
+{
+    auto pBuf = std::make_shared<std::pair<std::string, std::string_view>>( std::move( str ), std::string_view{} );
+    pBuf->second = pBuf->first;
+
+    return { pBuf, &pBuf->second };
+}
+
+void DataPool::Add( int_t val )
+{
+    mItems.push_back( { ItemType::Int, static_cast<uint16_t>(val) } );
+}
+
+void DataPool::Add( float_t val )
+{
+    uint32_t bits = 0;
+    std::memcpy( &bits, &val, sizeof( bits ) );
+    mItems.push_back( { ItemType::Float, bits } );
+}
+
+void DataPool::Add( std::string_view str )
+{
+    mItems.push_back( { ItemType::Str, static_cast<uint32_t>(mStrings.size()) } );
+    mStrings.push_back( str );
+}
+
+value_t DataPool::operator[]( size_t idx ) const
+{
+    const Item& item = mItems[idx];
+
+    switch( item.type )
+    {
+    case ItemType::Int:
+        return value_t{ static_cast<int_t>(item.value) };
+
+    case ItemType::Float:
+    {
+        float_t res = 0;
+        std::memcpy( &res, &item.value, sizeof( res ) );
+        return value_t{ res };
+    }
+
+    default:
+        return value_t{ str_t{ mStrings[item.value] } };
+    }
+}
+
+void DataPool::Append( DataPool&& other )
+{
+    const auto stringsOffset = static_cast<uint32_t>(mStrings.size());
+
+    mItems.reserve( mItems.size() + other.mItems.size() );
+
+    for( auto item : other.mItems )
+    {
+        if( item.type == ItemType::Str )
+            item.value += stringsOffset;
+
+        mItems.push_back( item );
+    }
+
+    mStrings.insert( mStrings.end(), other.mStrings.begin(), other.mStrings.end() );
+    other.clear();
+}
+
+void DataPool::Insert( size_t pos, DataPool&& other )
+{
+    const auto stringsOffset = static_cast<uint32_t>(mStrings.size());
+
+    for( auto& item : other.mItems )
+        if( item.type == ItemType::Str )
+            item.value += stringsOffset;
+
+    mItems.insert( mItems.begin() + pos, other.mItems.begin(), other.mItems.end() );
+    mStrings.insert( mStrings.end(), other.mStrings.begin(), other.mStrings.end() );
+    other.clear();
+}
+
+void DataPool::Erase( size_t first, size_t last )
+{
+    mItems.erase( mItems.begin() + first, mItems.begin() + last );
+}
+
+void DataPool::clear()
+{
+    mItems.clear();
+    mStrings.clear();
+}
+
+size_t DataPool::GetMemoryUsage() const
+{
+    return mItems.capacity() * sizeof( Item ) + mStrings.capacity() * sizeof( std::string_view );
+}
+
+bool DataPool::operator==( const DataPool& other ) const
+{
+    if( size() != other.size() )
+        return false;
+
+    for( size_t i = 0; i < size(); ++i )
+        if( !((*this)[i] == other[i]) )
+            return false;
+
+    return true;
+}
+
+void Program::AddSource( std::shared_ptr<const std::string_view> pText )
+{
+    mSources.push_back( std::move( pText ) );
+}
+
+std::string_view Program::StoreText( std::string_view str )
+{
+    const std::less_equal<const char*> lessEqual;
+
+    if( str.empty() )
+        return {};
+
+    for( const auto& pText : mSources )
+        if( lessEqual( pText->data(), str.data() ) && lessEqual( str.data() + str.size(), pText->data() + pText->size() ) )
+            return str;
+
+    mOwnedTexts.push_back( std::make_shared<const std::string>( str ) );
+
+    return *mOwnedTexts.back();
+}
+
+void Program::AddLine( linenum_t line, std::string_view str )
+{
+    if( !mLines.empty() && line <= mLines.rbegin()->first )
+        throw std::runtime_error( "Line is in the wrong order " + std::to_string( line ) );
+
+    const auto &[_, success] = mLines.emplace( line, StoreText( str ) );
+
+    if( !success )
+        throw std::runtime_error( "Line was redefined " + std::to_string( line ) );
+
+    mCurParseLine = line;
+}
+
+void Program::AppendToPrevLine( std::string_view str )
+{
+    const auto it = mLines.find( mCurParseLine );
+
+    if( it == mLines.end() )
+        throw std::runtime_error( "Previous line is unavailable" );
+
+    std::string joined{ it->second };
+    joined.append( " : " );
+    joined.append( str );
+
+    it->second = StoreText( joined );
+}
+
+void Program::AddDataPos()
+{
+    // Lines are preparsed in order, so it's almost always the last one
+    if( mLineToDataPos.empty() || mLineToDataPos.back().first < mCurParseLine )
+    {
+        mLineToDataPos.emplace_back( mCurParseLine, mData.size() );
+        return;
+    }
+
+    const auto it = std::lower_bound( mLineToDataPos.begin(), mLineToDataPos.end(), std::pair{ mCurParseLine, size_t{ 0 } } );
+
+    if( it->first != mCurParseLine )
+        mLineToDataPos.emplace( it, mCurParseLine, mData.size() );
+}
+
+void Program::AddData( int_t val )
+{
+    AddDataPos();
+    mData.Add( val );
+}
+
+void Program::AddData( float_t val )
+{
+    AddDataPos();
+    mData.Add( val );
+}
+
+void Program::AddData( std::string_view str )
+{
+    AddDataPos();
+    mData.Add( StoreText( str ) );
+}
+
+void Program::AddData( const value_t& value )
+{
+    if( const auto* pInt = boost::get<int_t>( &value.get() ) )
+        AddData( *pInt );
+    else if( const auto* pFloat = boost::get<float_t>( &value.get() ) )
+        AddData( *pFloat );
+    else
+        AddData( std::string_view{ boost::get<str_t>( value.get() ) } );
+}
+
+std::optional<size_t> Program::FindDataPos( linenum_t line ) const
+{
+    const auto it = std::lower_bound( mLineToDataPos.begin(), mLineToDataPos.end(), std::pair{ line, size_t{ 0 } } );
+
+    if( it == mLineToDataPos.end() || it->first != line )
+        return std::nullopt;
+
+    return it->second;
+}
+
+std::pair<size_t, size_t> Program::GetDataRange( linenum_t line ) const
+{
+    const auto it = std::lower_bound( mLineToDataPos.begin(), mLineToDataPos.end(), std::pair{ line, size_t{ 0 } } );
+
+    if( it == mLineToDataPos.end() )
+        return { mData.size(), mData.size() };
+
+    if( it->first != line )
+        return { it->second, it->second };
+
+    return { it->second, std::next( it ) != mLineToDataPos.end() ? std::next( it )->second : mData.size() };
+}
+
+void Program::Clear()
+{
+    mLines.clear();
+    mSources.clear();
+    mOwnedTexts.clear();
+    mData.clear();
+    mLineToDataPos.clear();
+    mCurParseLine = 0;
+}
+
+void Program::Append( Program&& other )
+{
+    if( !other.mLines.empty() && !mLines.empty() && other.mLines.begin()->first <= mLines.rbegin()->first )
+        throw std::runtime_error( "Line is in the wrong order " + std::to_string( other.mLines.begin()->first ) );
+
+    while( !other.mLines.empty() )
+        mLines.insert( mLines.end(), other.mLines.extract( other.mLines.begin() ) );
+
+    AdoptTexts( other );
+
+    // The lines are after the ones of this program, so the index stays sorted
+    for( const auto& [line, pos] : other.mLineToDataPos )
+        mLineToDataPos.emplace_back( line, mData.size() + pos );
+
+    mData.Append( std::move( other.mData ) );
+
+    if( !mLines.empty() )
+        mCurParseLine = mLines.rbegin()->first;
+
+    other.Clear();
+}
+
+void Program::ReplaceLine( linenum_t line, Program&& part )
+{
+    const auto& newLines = part.mLines;
+
+    if( newLines.size() > 1 || (!newLines.empty() && newLines.begin()->first != line) )
+        throw std::runtime_error( "Only line " + std::to_string( line ) + " can be replaced" );
+
+    auto itPos = std::lower_bound( mLineToDataPos.begin(), mLineToDataPos.end(), std::pair{ line, size_t{ 0 } } );
+
+    if( itPos != mLineToDataPos.end() && itPos->first == line )
+    {
+        const auto [first, last] = GetDataRange( line );
+
+        mData.Erase( first, last );
+        itPos = mLineToDataPos.erase( itPos );
+
+        for( auto it = itPos; it != mLineToDataPos.end(); ++it )
+            it->second -= last - first;
+    }
+
+    mLines.erase( line );
+
+    if( newLines.empty() )
+        return;
+
+    mLines.insert( part.mLines.extract( part.mLines.begin() ) );
+    AdoptTexts( part );
+
+    if( !part.mData.empty() )
+    {
+        const size_t pos = itPos != mLineToDataPos.end() ? itPos->second : mData.size();
+        const size_t count = part.mData.size();
+
+        mData.Insert( pos, std::move( part.mData ) );
+        itPos = mLineToDataPos.emplace( itPos, line, pos );
+
+        for( ++itPos; itPos != mLineToDataPos.end(); ++itPos )
+            itPos->second += count;
+    }
+
+    part.Clear();
+}
+
+void Program::AdoptTexts( Program& other )
+{
+    for( auto& pText : other.mSources )
+        if( std::find( mSources.begin(), mSources.end(), pText ) == mSources.end() )
+            mSources.push_back( std::move( pText ) );
+
+    mOwnedTexts.insert( mOwnedTexts.end(), std::make_move_iterator( other.mOwnedTexts.begin() ), std::make_move_iterator( other.mOwnedTexts.end() ) );
+    other.mSources.clear();
+    other.mOwnedTexts.clear();
+}
+
+uint64_t Program::GetHash() const
+{
+    uint64_t res = 14695981039346656037ull;
+
+    const auto addBytes = [&res]( const void* pData, size_t size ) {
+        for( size_t i = 0; i < size; ++i )
+        {
+            res ^= static_cast<const unsigned char*>(pData)[i];
+            res *= 1099511628211ull;
+        }
+    };
+
+    for( const auto& [line, str] : mLines )
+    {
+        const uint64_t num = line;
+        const uint64_t length = str.size();
+
+        addBytes( &num, sizeof( num ) );
+        addBytes( &length, sizeof( length ) );
+        addBytes( str.data(), str.size() );
+    }
+
+    return res;
+}
+
+size_t Program::GetMemoryUsage() const
+{
+    constexpr size_t NodeSize = 4 * sizeof( void* );
+
+    size_t res = sizeof( *this );
+
+    res += mLines.size() * (NodeSize + sizeof( linenum_t ) + sizeof( std::string_view ));
+    res += mSources.capacity() * sizeof( mSources[0] );
+    res += mOwnedTexts.capacity() * sizeof( mOwnedTexts[0] );
+
+    for( const auto& pStr : mOwnedTexts )
+        res += NodeSize + sizeof( *pStr ) + pStr->capacity();
+
+    res += mData.GetMemoryUsage();
+    res += mLineToDataPos.capacity() * sizeof( mLineToDataPos[0] );
+
+    return res;
+}
+
+void Program::Serialize( BinaryWriter& writer ) const
+{
+    writer.WriteCount( mLines.size() );
+
+    for( const auto& [line, str] : mLines )
+    {
+        writer.Write( static_cast<uint64_t>(line) );
+        writer.WriteStr( str );
+    }
+
+    writer.WriteCount( mData.size() );
+
+    for( size_t i = 0; i < mData.size(); ++i )
+        writer.WriteValue( mData[i] );
+
+    writer.WriteCount( mLineToDataPos.size() );
+
+    for( const auto& [line, pos] : mLineToDataPos )
+    {
+        writer.Write( static_cast<uint64_t>(line) );
+        writer.Write( static_cast<uint64_t>(pos) );
+    }
+}
+
+void Program::Deserialize( BinaryReader& reader )
+{
+    for( size_t count = reader.ReadCount( 12 ); count > 0; --count )
+    {
+        const auto line = static_cast<linenum_t>(reader.Read<uint64_t>());
+        mLines.emplace_hint( mLines.end(), line, StoreText( reader.ReadStrView() ) );
+    }
+
+    // See BinaryWriter::WriteValue(), the strings stay in the image
+    for( size_t count = reader.ReadCount( 3 ); count > 0; --count )
+    {
+        switch( reader.Read<uint8_t>() )
+        {
+        case 0: mData.Add( reader.Read<int_t>() ); break;
+        case 1: mData.Add( reader.Read<float_t>() ); break;
+        case 2: mData.Add( StoreText( reader.ReadStrView() ) ); break;
+        default:
+            throw std::runtime_error( "Binary data is broken" );
+        }
+    }
+
+    for( size_t count = reader.ReadCount( 16 ); count > 0; --count )
+    {
+        const auto line = static_cast<linenum_t>(reader.Read<uint64_t>());
+        const auto pos = static_cast<size_t>(reader.Read<uint64_t>());
+
+        if( pos > mData.size() )
+            throw std::runtime_error( "Binary data is broken" );
+
+        mLineToDataPos.emplace_back( line, pos );
+    }
+
+    std::sort( mLineToDataPos.begin(), mLineToDataPos.end() );
+
+    mCurParseLine = mLines.empty() ? 0 : mLines.rbegin()->first;
+}
+}
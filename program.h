@@ -0,0 +1,159 @@
+#ifndef BASIC_INT_PROGRAM_H
+#define BASIC_INT_PROGRAM_H
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "value.h"
+
+namespace runtime
+{
+    class BinaryWriter;
+    class BinaryReader;
+
+    // A text which owns its string, for Program::AddSource() and the input scripts
+    std::shared_ptr<const std::string_view> MakeSharedText( std::string str );
+
+    // DATA items in the order of the listing. Numbers are stored decoded in 8 byte items,
+    // strings as views of the literals kept alive by the Program, so a value_t with its
+    // own string is only made when READ reaches the item.
+    class DataPool
+    {
+    public:
+        void Add( int_t val );
+        void Add( float_t val );
+        void Add( std::string_view str );
+
+        value_t operator[]( size_t idx ) const;
+
+        size_t size() const
+        {
+            return mItems.size();
+        }
+
+        bool empty() const
+        {
+            return mItems.empty();
+        }
+
+        void Append( DataPool&& other );
+
+        // Moves the items of other before the item pos. The strings of erased items stay
+        // in the pool, they are only views.
+        void Insert( size_t pos, DataPool&& other );
+        void Erase( size_t first, size_t last );
+
+        void clear();
+
+        size_t GetMemoryUsage() const;
+
+        bool operator==( const DataPool& other ) const;
+
+    private:
+        // The same order as in value_t
+        enum class ItemType : uint8_t { Int, Float, Str };
+
+        struct Item
+        {
+            ItemType type;
+            uint32_t value;     // The number bits or the index in mStrings
+        };
+
+        std::vector<Item> mItems;
+        std::vector<std::string_view> mStrings;
+    };
+
+    // The loaded program: numbered lines and the DATA pool filled by the preparse.
+    // It's built once and then only read, so a single instance can be shared
+    // between any number of runtimes, including ones running on other threads.
+    // Everything that changes during execution stays in Runtime.
+    //
+    // Lines and DATA strings are views. A text inside one of the sources, e.g. a mapped
+    // file, is referenced in place, the rest (texts from other strings and the lines
+    // joined by AppendToPrevLine()) are copied into separate immutable strings. Copies
+    // of the program share both.
+    class Program
+    {
+    public:
+        // Lines and DATA added from inside the text are not copied, the pointer keeps it alive
+        void AddSource( std::shared_ptr<const std::string_view> pText );
+
+        void AddLine( linenum_t line, std::string_view str );
+        void AppendToPrevLine( std::string_view str );
+
+        void UpdateCurParseLine( linenum_t line )
+        {
+            mCurParseLine = line;
+        }
+
+        // DATA of the current parse line
+        void AddData( int_t val );
+        void AddData( float_t val );
+        void AddData( std::string_view str );
+        void AddData( const value_t& value );
+
+        void Clear();
+
+        // Adds the lines and DATA of the next part of the listing preparsed separately,
+        // see Preparse(). Throws and leaves both programs as they are if its first line
+        // isn't after the last one of this program.
+        void Append( Program&& other );
+
+        // Replaces the line with the only line of part, which is preparsed separately, or
+        // deletes it if part is empty. Only the DATA of the line is replaced, the positions
+        // of the lines after it are shifted, so a single edit doesn't rebuild the program.
+        void ReplaceLine( linenum_t line, Program&& part );
+
+        const std::map<linenum_t, std::string_view>& GetLines() const
+        {
+            return mLines;
+        }
+
+        const DataPool& GetData() const
+        {
+            return mData;
+        }
+
+        // Sorted by line
+        const std::vector<std::pair<linenum_t, size_t>>& GetLineToDataPos() const
+        {
+            return mLineToDataPos;
+        }
+
+        // The first DATA item of the line for RESTORE
+        std::optional<size_t> FindDataPos( linenum_t line ) const;
+
+        // The DATA items of the line, an empty range where they would be for a line without them
+        std::pair<size_t, size_t> GetDataRange( linenum_t line ) const;
+
+        // FNV-1a of the line numbers and texts, identifies the program in checkpoints
+        uint64_t GetHash() const;
+
+        // Approximate heap usage in bytes, the sources aren't included
+        size_t GetMemoryUsage() const;
+
+        // The image for the program cache, see LoadProgramCached(). It's loaded into
+        // an empty program, lines inside a source added before are referenced.
+        void Serialize( BinaryWriter& writer ) const;
+        void Deserialize( BinaryReader& reader );
+
+    private:
+        std::string_view StoreText( std::string_view str );
+        void AddDataPos();
+        void AdoptTexts( Program& other );
+
+        std::map<linenum_t, std::string_view> mLines;
+        std::vector<std::shared_ptr<const std::string_view>> mSources;
+        std::vector<std::shared_ptr<const std::string>> mOwnedTexts;
+        DataPool mData;
+        std::vector<std::pair<linenum_t, size_t>> mLineToDataPos;   // The first DATA item of the line
+        linenum_t mCurParseLine = 0;
+    };
+}
+
+#endif // BASIC_INT_PROGRAM_H
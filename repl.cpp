@@ -0,0 +1,187 @@
+#include "repl.h"
+#include "loader.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <string>
+
+namespace runtime
+{
+namespace
+{
+    std::string_view Trim( std::string_view str )
+    {
+        while( !str.empty() && std::isspace( static_cast<unsigned char>(str.front()) ) )
+            str.remove_prefix( 1 );
+
+        while( !str.empty() && std::isspace( static_cast<unsigned char>(str.back()) ) )
+            str.remove_suffix( 1 );
+
+        return str;
+    }
+
+    // Removes the number from the beginning of str
+    std::optional<linenum_t> ParseLineNum( std::string_view& str )
+    {
+        linenum_t res = 0;
+        const auto [pEnd, ec] = std::from_chars( str.data(), str.data() + str.size(), res );
+
+        if( ec != std::errc{} )
+            return std::nullopt;
+
+        str.remove_prefix( pEnd - str.data() );
+
+        return res;
+    }
+
+    void PrintError( std::ostream& errOut, std::string_view title, std::string_view str, std::string_view error )
+    {
+        errOut << "\033[91m" "-------------------------\n";
+        errOut << title << "\n" << str << "\n";
+        errOut << "Error: " << error << "\n";
+        errOut << "-------------------------\n" "\033[0m";
+    }
+}
+
+bool Repl::Execute( std::string_view str )
+{
+    const std::string_view cmd = Trim( str );
+
+    if( cmd.empty() )
+        return true;
+
+    if( std::isdigit( static_cast<unsigned char>(cmd.front()) ) )
+        return EditLine( cmd );
+
+    size_t wordEnd = 0;
+
+    while( wordEnd < cmd.size() && std::isalpha( static_cast<unsigned char>(cmd[wordEnd]) ) )
+        ++wordEnd;
+
+    const std::string_view word = cmd.substr( 0, wordEnd );
+    std::string_view args = Trim( cmd.substr( wordEnd ) );
+
+    if( boost::algorithm::iequals( word, "new" ) && args.empty() )
+    {
+        mRuntime.ClearProgram();
+        mRuntime.ClearVars();
+        return true;
+    }
+
+    if( boost::algorithm::iequals( word, "list" ) && args.find_first_not_of( "0123456789- " ) == std::string_view::npos )
+    {
+        List( args );
+        return true;
+    }
+
+    if( boost::algorithm::iequals( word, "run" ) )
+    {
+        const auto line = ParseLineNum( args );
+
+        if( args.empty() )
+        {
+            mRuntime.ClearVars();
+            mRuntime.Start();
+
+            try
+            {
+                if( line )
+                    mRuntime.Goto( *line );
+            }
+            catch( const std::exception& e )
+            {
+                PrintError( mRuntime.Err(), "Run failed", cmd, e.what() );
+                return false;
+            }
+
+            return Run();
+        }
+    }
+
+    // The variables and the program stay, the expressions and statements are parsed when executed
+    mRuntime.StartDirect( std::string{ cmd } );
+
+    return Run( cmd );
+}
+
+bool Repl::EditLine( std::string_view str )
+{
+    // Only the new line is preparsed, the rest of the program isn't touched
+    linenum_t line = 0;
+    Program part;
+
+    if( !PreparseLine( str, line, part, mRuntime.Err() ) )
+        return false;
+
+    try
+    {
+        mRuntime.PatchLine( line, std::move( part ) );
+    }
+    catch( const std::exception& e )
+    {
+        PrintError( mRuntime.Err(), "Edit failed", str, e.what() );
+        return false;
+    }
+
+    return true;
+}
+
+bool Repl::Run( std::string_view directLine )
+{
+    using RunStatus = Runtime::RunStatus;
+
+    for(;;)
+    {
+        const auto status = mRuntime.Run( std::numeric_limits<size_t>::max() );
+
+        if( status == RunStatus::Finished )
+            return true;
+
+        if( status == RunStatus::Error )
+        {
+            const auto& step = mRuntime.GetLastStep();
+            std::ostringstream str;
+
+            if( step.line == Runtime::DirectLine )
+                str << directLine;
+            else
+                str << step.line << '\t' << mRuntime.GetProgram().at( step.line );
+
+            PrintError( mRuntime.Err(), "Execute failed", str.str(), step.error );
+            return false;
+        }
+    }
+}
+
+void Repl::List( std::string_view range ) const
+{
+    linenum_t first = 0;
+    linenum_t last = MaxLineNum;
+
+    range = Trim( range );
+
+    if( const auto line = ParseLineNum( range ) )
+        first = last = *line;
+
+    range = Trim( range );
+
+    if( !range.empty() && range.front() == '-' )
+    {
+        range = Trim( range.substr( 1 ) );
+        const auto line = ParseLineNum( range );
+        last = line ? *line : MaxLineNum;
+    }
+
+    const auto& lines = mRuntime.GetProgram();
+    auto& out = mRuntime.Out();
+
+    for( auto it = lines.lower_bound( first ); it != lines.end() && it->first <= last; ++it )
+        out << it->first << ' ' << it->second << '\n';
+
+    out.flush();
+}
+}
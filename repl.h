@@ -0,0 +1,36 @@
+#ifndef BASIC_INT_REPL_H
+#define BASIC_INT_REPL_H
+
+#include <string_view>
+
+#include "runtime.h"
+
+namespace runtime
+{
+    // The interactive mode. A numbered line is preparsed alone and replaces the line of
+    // the program, see Runtime::PatchLine(), a bare number deletes it. Other lines are
+    // executed at once with the variables left by the previous ones, see Runtime::StartDirect().
+    // The editor commands:
+    //   RUN [line]     clears the variables and runs the program
+    //   LIST [a[-b]]   prints the lines, DATA and REM-only lines have no text after the preparse
+    //   NEW            clears the program and the variables
+    class Repl
+    {
+    public:
+        explicit Repl( Runtime& runtime ) :
+            mRuntime{ runtime }
+        {}
+
+        // Output and errors go to the streams of the runtime, false if the line failed
+        bool Execute( std::string_view str );
+
+    private:
+        bool EditLine( std::string_view str );
+        bool Run( std::string_view directLine = {} );
+        void List( std::string_view range ) const;
+
+        Runtime& mRuntime;
+    };
+}
+
+#endif // BASIC_INT_REPL_H
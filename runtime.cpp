@@ -2,24 +2,196 @@
 #include "parse_utils.hpp"
 #include "grammar.h"
 #include "platform.h"
+#include "ast.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string_view>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 namespace runtime
 {
-static std::ofstream g_flInputLog;
+// Returns false if the expression uses RND, INKEY$, an array or a variable other than
+// the argument, the result depends on more than the argument then
+static bool CollectFunctionCalls( const ast::Expr& expr, std::string_view varName, std::vector<std::string>& calls )
+{
+    if( expr.op == ast::Op::Rnd || expr.op == ast::Op::Inkey || expr.op == ast::Op::ArrayElem )
+        return false;
+
+    if( expr.op == ast::Op::Var && expr.name != varName )
+        return false;
+
+    if( expr.op == ast::Op::CallFn )
+        calls.push_back( expr.name );
+
+    for( const auto& arg : expr.args )
+        if( !CollectFunctionCalls( *arg, varName, calls ) )
+            return false;
+
+    return true;
+}
+
+Runtime::Runtime( const Runtime& other ) :
+    mFunctions{ other.mFunctions },
+    mpProgram{ other.mpProgram },
+    mForLoopStack{ other.mForLoopStack },
+    mGosubStack{ other.mGosubStack },
+    mpDirectLine{ other.mpDirectLine },
+    mFakeInput{ other.mFakeInput },
+    mProgramCounter{ other.mProgramCounter },
+    mCurDataIdx{ other.mCurDataIdx },
+    mpIn{ other.mpIn },
+    mpOut{ other.mpOut },
+    mpErr{ other.mpErr },
+    mRandom{ other.mRandom },
+    mLastStep{ other.mLastStep },
+    mBlockingInput{ other.mBlockingInput },
+    mStaticallyChecked{ other.mStaticallyChecked },
+    mWaitingForInput{ other.mWaitingForInput },
+    mWaitingForKey{ other.mWaitingForKey },
+    mInputPromptShown{ other.mInputPromptShown },
+    mResumingInput{ other.mResumingInput },
+    mInputItemsDone{ other.mInputItemsDone },
+    mInputItemsToSkip{ other.mInputItemsToSkip },
+    mStatementOffset{ other.mStatementOffset },
+    mSkipElseOnResume{ other.mSkipElseOnResume }
+{
+    CopyVars( other );
+}
+
+Runtime& Runtime::operator=( const Runtime& other )
+{
+    if( this == &other )
+        return *this;
+
+    mFunctions = other.mFunctions;
+    mpProgram = other.mpProgram;
+    mForLoopStack = other.mForLoopStack;
+    mGosubStack = other.mGosubStack;
+    mpDirectLine = other.mpDirectLine;
+    mFakeInput = other.mFakeInput;
+    mProgramCounter = other.mProgramCounter;
+    mCurDataIdx = other.mCurDataIdx;
+    mpIn = other.mpIn;
+    mpOut = other.mpOut;
+    mpErr = other.mpErr;
+    mRandom = other.mRandom;
+    mLastStep = other.mLastStep;
+    mBlockingInput = other.mBlockingInput;
+    mStaticallyChecked = other.mStaticallyChecked;
+    mWaitingForInput = other.mWaitingForInput;
+    mWaitingForKey = other.mWaitingForKey;
+    mInputPromptShown = other.mInputPromptShown;
+    mResumingInput = other.mResumingInput;
+    mInputItemsDone = other.mInputItemsDone;
+    mInputItemsToSkip = other.mInputItemsToSkip;
+    mStatementOffset = other.mStatementOffset;
+    mSkipElseOnResume = other.mSkipElseOnResume;
+
+    CopyVars( other );
+
+    return *this;
+}
+
+// The keys are views into mVarNames, so they are interned again
+void Runtime::CopyVars( const Runtime& other )
+{
+    mVars.clear();
+    mArrays.clear();
+    mVarNames.clear();
+
+    mVars.reserve( other.mVars.size() );
+    mArrays.reserve( other.mArrays.size() );
 
-void Runtime::Store( std::string name, value_t val )
+    for( const auto& [name, val] : other.mVars )
+        mVars.emplace( InternName( name ), val );
+
+    for( const auto& [name, pArray] : other.mArrays )
+        mArrays.emplace( InternName( name ), pArray );
+}
+
+void Runtime::Store( const VarName& var, value_t val )
 {
-    if( name.empty() )
+    if( var.name.empty() )
         throw std::runtime_error( "variable name cannot be empty" );
 
-    boost::algorithm::to_lower( name );
+    value_t res = ConvertForStore( var.name, std::move( val ) );
 
-    value_t res;
+    if( var.indices.empty() )
+    {
+        const auto itVar = mVars.find( var.name );
+
+        if( itVar != mVars.end() )
+            itVar->second = std::move( res );
+        else
+            AddVar( var, std::move( res ) );
+
+        return;
+    }
+
+    const auto itArray = mArrays.find( var.name );
+
+    if( itArray != mArrays.end() )
+    {
+        ArrayVar& array = MutableArray( itArray->second );
+
+        if( const auto pos = GetElementPos( array, var.indices ) )
+        {
+            SetElement( array, *pos, std::move( res ) );
+            return;
+        }
+
+        const auto itElem = array.outOfRange.find( var.indices );
+
+        if( itElem != array.outOfRange.end() )
+        {
+            itElem->second = std::move( res );
+            return;
+        }
+    }
+
+    if( IsReportedOnAccess( var ) )
+        *mpErr << "\033[93m" "WARNING: Write array element before DIM: " << FormatVarName( var ) << ", line: " << mProgramCounter.line << "\033[0m" "\n";
+
+    AddVar( var, std::move( res ) );
+}
+
+value_t Runtime::Load( const VarName& var ) const
+{
+    if( var.name.empty() )
+        throw std::runtime_error( "variable name cannot be empty" );
+
+    if( var.indices.empty() )
+    {
+        const auto itVar = mVars.find( var.name );
+
+        if( itVar != mVars.end() )
+            return itVar->second;
+    }
+    else if( auto val = FindElement( var ) )
+    {
+        return std::move( *val );
+    }
+
+    auto val = GetDefaultValue( var.name );
+
+    if( !IsReportedOnAccess( var ) )
+        return val;
+
+    *mpErr << "\033[93m" "WARNING: Access var before init: "  << FormatVarName( var ) << ", line: " << mProgramCounter.line << "\033[0m" "\n";
+
+    //Prevents more than one warning about the same var
+    const_cast<Runtime *>(this)->AddVar( var, val );
+
+    return val;
+}
+
+value_t Runtime::ConvertForStore( std::string_view name, value_t val )
+{
     const str_t* pS = boost::get<str_t>( &val );
 
     switch( DetectVarType( name ) )
@@ -28,102 +200,278 @@ void Runtime::Store( std::string name, value_t val )
         if( !pS )
             throw std::runtime_error( "Expected String variable" );
 
-        res = std::move( val );
+        return val;
+
+    case ValueType::Int:
+        return value_t{ ForceInt( val ) };
+
+    default:
+        return value_t{ ForceFloat( val ) };
+    };
+}
+
+std::string_view Runtime::InternName( std::string_view name )
+{
+    std::string& res = mVarNames.emplace_back( name );
+    boost::algorithm::to_lower( res );
+
+    return res;
+}
+
+std::optional<value_t> Runtime::FindElement( const VarName& var ) const
+{
+    const auto itArray = mArrays.find( var.name );
+
+    if( itArray == mArrays.end() )
+        return std::nullopt;
+
+    const ArrayVar& array = *itArray->second;
+
+    if( const auto pos = GetElementPos( array, var.indices ) )
+        return GetElement( array, *pos );
+
+    const auto itElem = array.outOfRange.find( var.indices );
+
+    return itElem != array.outOfRange.end() ? std::optional{ itElem->second } : std::nullopt;
+}
+
+std::shared_ptr<Runtime::ArrayVar> Runtime::MakeArray( std::string_view name )
+{
+    auto res = std::make_shared<ArrayVar>();
+    res->type = DetectVarType( name );
+
+    return res;
+}
+
+// The position within the DIM ranges
+std::optional<size_t> Runtime::GetElementPos( const ArrayVar& array, const ArrayIndices& indices )
+{
+    if( indices.size() != array.dimensions.size() )
+        return std::nullopt;
+
+    size_t pos = 0;
+
+    for( size_t i = 0; i < indices.size(); ++i )
+    {
+        const int_t idx = indices[i];
+        const int_t dim = array.dimensions[i];
+
+        if( idx < 0 || idx > dim )
+            return std::nullopt;
+
+        pos = pos * (dim + 1) + idx;
+    }
+
+    return pos;
+}
+
+value_t Runtime::GetElement( const ArrayVar& array, size_t pos )
+{
+    switch( array.type )
+    {
+    case ValueType::Str:
+    {
+        const auto itStr = array.strings.find( pos );
+        return value_t{ itStr != array.strings.end() ? itStr->second : str_t{} };
+    }
+
+    case ValueType::Int:
+        return value_t{ static_cast<const int_t*>(array.numbers.data())[pos] };
+
+    default:
+        return value_t{ static_cast<const float_t*>(array.numbers.data())[pos] };
+    }
+}
+
+// The value is already converted to the type of the array
+void Runtime::SetElement( ArrayVar& array, size_t pos, value_t val )
+{
+    switch( array.type )
+    {
+    case ValueType::Str:
+    {
+        str_t& str = boost::get<str_t>( val.get() );
+
+        if( str.empty() )
+            array.strings.erase( pos );
+        else
+            array.strings.insert_or_assign( pos, std::move( str ) );
+
         break;
+    }
 
     case ValueType::Int:
-        res = ForceInt( val );
+        static_cast<int_t*>(array.numbers.data())[pos] = boost::get<int_t>( val.get() );
         break;
 
     default:
-        res = ForceFloat( val );
-    };
+        static_cast<float_t*>(array.numbers.data())[pos] = boost::get<float_t>( val.get() );
+        break;
+    }
+}
 
-    const auto itVar = mVars.find( name );
+size_t Runtime::GetNumberSize( ValueType type )
+{
+    switch( type )
+    {
+    case ValueType::Str:
+        return 0;
 
-    if( itVar == mVars.end() && IsArrayVar(name) )
-        std::cerr << "\033[93m" "WARNING: Write array element before DIM: " << name << ", line: " << mProgramCounter.line << "\033[0m" << std::endl;
+    case ValueType::Int:
+        return sizeof( int_t );
 
-    mVars.insert_or_assign( itVar, std::move(name), std::move(res) );
+    default:
+        return sizeof( float_t );
+    }
 }
 
-value_t Runtime::Load( std::string name ) const
+size_t Runtime::GetElementsCount( const std::vector<int_t>& dimensions, ValueType type )
 {
-    if( name.empty() )
-        throw std::runtime_error( "variable name cannot be empty" );
+    // The numbers take count * size bytes, neither product may wrap around
+    const size_t elemSize = std::max<size_t>( GetNumberSize( type ), 1 );
+    size_t count = 1;
 
-    boost::algorithm::to_lower( name );
+    for( auto dim : dimensions )
+    {
+        const size_t dimSize = static_cast<size_t>(std::max( dim + 1, 0 ));
 
-    const auto itVar = mVars.find( name );
+        if( dimSize != 0 && count > SIZE_MAX / elemSize / dimSize )
+            throw std::runtime_error( "Array too large" );
 
-    if( itVar != mVars.end() )
-        return itVar->second;
+        count *= dimSize;
+    }
 
-    std::cerr << "\033[93m" "WARNING: Access var before init: "  << name << ", line: " << mProgramCounter.line << "\033[0m" << std::endl;
+    return count;
+}
 
-    const auto val = GetDefaultValue( name );
+ArrayIndices Runtime::GetElementIndices( const ArrayVar& array, size_t pos )
+{
+    ArrayIndices res( array.dimensions.size() );
 
-    //Prevents more than one warning about the same var
-    const_cast<Runtime *>(this)->mVars[std::move(name)] = val;
+    for( size_t i = res.size(); i-- > 0; )
+    {
+        const size_t size = static_cast<size_t>(array.dimensions[i]) + 1;
 
-    return val;
+        res[i] = static_cast<int_t>(pos % size);
+        pos /= size;
+    }
+
+    return res;
 }
 
-void Runtime::Dim( std::string baseVarName, const std::vector<int_t>& dimentions )
+Runtime::ArrayVar& Runtime::MutableArray( std::shared_ptr<ArrayVar>& pArray )
 {
-    if( baseVarName.empty() )
-        throw std::runtime_error( "variable name cannot be empty" );
+    // Copy on write, the array may be shared with copies of the runtime
+    if( pArray.use_count() != 1 )
+        pArray = std::make_shared<ArrayVar>( *pArray );
 
-    boost::algorithm::to_lower( baseVarName );
+    return *pArray;
+}
 
-    if( dimentions.empty() )
+// The variable must not exist yet
+void Runtime::AddVar( const VarName& var, value_t val )
+{
+    if( var.indices.empty() )
     {
-        mVars[std::move(baseVarName)] = GetDefaultValue(baseVarName);
+        mVars.emplace( InternName( var.name ), std::move( val ) );
         return;
     }
 
-    ListAllArrayElements(dimentions, [baseVarName = std::move(baseVarName), this]( const auto &indices ) {
-        std::string varName{ baseVarName };
+    auto itArray = mArrays.find( var.name );
 
-        varName += '(';
+    if( itArray == mArrays.end() )
+        itArray = mArrays.emplace( InternName( var.name ), MakeArray( var.name ) ).first;
 
-        for( auto i: indices)
-        {
-            varName += std::to_string(i);
-            varName += ',';
-        }
+    MutableArray( itArray->second ).outOfRange.emplace( var.indices, std::move( val ) );
+}
+
+// The accesses found by the static check were reported before the start, see SetStaticallyChecked()
+bool Runtime::IsReportedOnAccess( const VarName& var ) const
+{
+    if( !mStaticallyChecked )
+        return true;
+
+    if( var.indices.empty() )
+        return false;
 
-        varName.back() = ')';
+    const auto itArray = mArrays.find( var.name );
 
-        mVars[std::move(varName)] = GetDefaultValue( baseVarName );
-    });
+    return itArray != mArrays.end() && !itArray->second->dimensions.empty();
 }
 
-ValueType Runtime::DetectVarType( std::string_view name )
+std::string Runtime::FormatVarName( const VarName& var )
 {
-    if( name.empty() )
-        throw std::runtime_error( "variable name cannot be empty" );
+    std::string res{ var.name };
+
+    boost::algorithm::to_lower( res );
 
-    for( char c : name )
+    if( var.indices.empty() )
+        return res;
+
+    res += '(';
+
+    for( auto i : var.indices )
     {
-        switch( c )
-        {
-        case '$': return ValueType::Str;
-        case '%': return ValueType::Int;
-        case '(': return ValueType::Float;
-        }
+        res += std::to_string( i );
+        res += ',';
     }
 
-    return ValueType::Float;
+    res.back() = ')';
+
+    return res;
 }
 
-bool Runtime::IsArrayVar( std::string_view name )
+void Runtime::Dim( std::string_view baseVarName, const std::vector<int_t>& dimentions )
 {
-    for( char c : name )
-        if( c == '(' )
-            return true;
+    if( baseVarName.empty() )
+        throw std::runtime_error( "variable name cannot be empty" );
 
-    return false;
+    if( dimentions.empty() )
+    {
+        Store( VarName{ baseVarName }, GetDefaultValue( baseVarName ) );
+        return;
+    }
+
+    const size_t count = GetElementsCount( dimentions, DetectVarType( baseVarName ) );
+    auto itArray = mArrays.find( baseVarName );
+
+    if( itArray == mArrays.end() )
+        itArray = mArrays.emplace( InternName( baseVarName ), MakeArray( baseVarName ) ).first;
+
+    ArrayVar& array = MutableArray( itArray->second );
+
+    // After re-DIM the elements out of the new ranges keep their values. Only the written
+    // pages are visited, the elements still holding the default value are dropped as if
+    // they were never written.
+    const auto keepElement = [&array]( size_t pos ) {
+        array.outOfRange.emplace( GetElementIndices( array, pos ), GetElement( array, pos ) );
+    };
+
+    if( array.type == ValueType::Str )
+    {
+        for( const auto& [pos, str] : array.strings )
+            keepElement( pos );
+    }
+    else
+    {
+        const size_t elemSize = GetNumberSize( array.type );
+        const char* pData = static_cast<const char*>(array.numbers.data());
+        const char zero[std::max( sizeof( int_t ), sizeof( float_t ) )] = {};
+
+        array.numbers.ForEachUsedPage( [&]( size_t offset, size_t size ) {
+            for( size_t pos = offset / elemSize; pos < (offset + size) / elemSize; ++pos )
+                if( std::memcmp( pData + pos * elemSize, zero, elemSize ) != 0 )
+                    keepElement( pos );
+        } );
+    }
+
+    array.dimensions = dimentions;
+    array.count = count;
+    array.strings.clear();
+    array.numbers = ZeroedMemory{ count * GetNumberSize( array.type ) };
+
+    for( auto it = array.outOfRange.begin(); it != array.outOfRange.end(); )
+        it = GetElementPos( array, it->first ) ? array.outOfRange.erase( it ) : std::next( it );
 }
 
 value_t Runtime::GetDefaultValue( std::string_view name )
@@ -141,44 +489,174 @@ value_t Runtime::GetDefaultValue( std::string_view name )
     };
 }
 
-void Runtime::AddLine( linenum_t line, std::string_view str )
+void Runtime::SetProgram( std::shared_ptr<const Program> pProgram )
+{
+    mpProgram = std::move( pProgram );
+    mStaticallyChecked = false;
+    mForLoopStack.clear();
+    mGosubStack.clear();
+    mProgramCounter = {};
+    mCurDataIdx = 0;
+}
+
+Program& Runtime::MutableProgram()
+{
+    // Copy on write: a program shared with other runtimes is never modified
+    if( mpProgram.use_count() != 1 )
+        mpProgram = std::make_shared<Program>( *mpProgram );
+
+    return const_cast<Program&>( *mpProgram );
+}
+
+Program Runtime::TakeProgram()
+{
+    Program res = std::move( MutableProgram() );
+    ClearProgram();
+
+    return res;
+}
+
+void Runtime::PatchLine( linenum_t line, Program&& part )
 {
-    if( !mProgram.empty() && line <= mProgram.rbegin()->first )
-        throw std::runtime_error( "Line is in the wrong order " + std::to_string( line ) );
+    const auto itOld = mpProgram->GetLines().find( line );
+
+    // The old text stays in the program, only the line refers to another one
+    const std::string_view oldStr = itOld != mpProgram->GetLines().end() ? itOld->second : std::string_view{};
+    const auto [first, last] = mpProgram->GetDataRange( line );
+    const size_t oldDataSize = mpProgram->GetData().size();
+
+    MutableProgram().ReplaceLine( line, std::move( part ) );
+    mStaticallyChecked = false;
 
-    const auto &[_, success] =  mProgram.emplace( line, str );
+    if( PatchPC( mProgramCounter, line, oldStr ) )
+        ResetInputState();
 
-    if( !success )
-        throw std::runtime_error( "Line was redefined " + std::to_string( line ) );
+    for( auto& pc : mGosubStack )
+        PatchPC( pc, line, oldStr );
 
-    mProgramCounter.line = line;
+    for( auto& item : mForLoopStack )
+        PatchPC( item.startBodyPC, line, oldStr );
+
+    const size_t newCount = mpProgram->GetData().size() + (last - first) - oldDataSize;
+
+    if( mCurDataIdx >= last && mCurDataIdx > first )
+        mCurDataIdx = mCurDataIdx - (last - first) + newCount;
+    else if( mCurDataIdx > first )
+        mCurDataIdx = first + std::min( mCurDataIdx - first, newCount );
 }
 
-void Runtime::AppendToPrevLine( std::string_view str )
+// The positions of the ':' separating the statements of the line and the end of the line.
+// Separators inside string literals don't count, the text after REM is one statement.
+static std::vector<size_t> FindStatementEnds( std::string_view str )
 {
-    const auto it = mProgram.find( mProgramCounter.line );
+    std::vector<size_t> res;
+    bool quoted = false;
+    bool statementStart = true;
+
+    for( size_t pos = 0; pos < str.size(); ++pos )
+    {
+        const char c = str[pos];
+
+        if( statementStart && !std::isspace( static_cast<unsigned char>(c) ) )
+        {
+            statementStart = false;
+
+            if( boost::algorithm::iequals( str.substr( pos, 3 ), "rem" ) )
+                break;
+        }
+
+        if( c == '"' )
+            quoted = !quoted;
+        else if( c == ':' && !quoted )
+        {
+            res.push_back( pos );
+            statementStart = true;
+        }
+    }
 
-    if( it == mProgram.end() )
-        throw std::runtime_error( "Previous line is unavailable" );
+    res.push_back( str.size() );
 
-    it->second.append(" : ");
-    it->second.append( str );
+    return res;
 }
 
-void Runtime::UpdateCurParseLine( linenum_t line )
+bool Runtime::PatchPC( ProgramCounter& pc, linenum_t line, std::string_view oldStr ) const
 {
-    mProgramCounter.line = line;
+    if( pc.line != line || pc.lineOffset == 0 )
+        return false;
+
+    const auto& lines = mpProgram->GetLines();
+    const auto it = lines.find( line );
+
+    // The rest of the line after the end of the execution isn't interesting
+    if( it != lines.end() && pc.lineOffset == ProgramCounter::ContinueExecution )
+        return false;
+
+    if( it != lines.end() && pc.lineOffset <= oldStr.size() )
+    {
+        // GOSUB and FOR continue after the end of their statement, it's found by the index,
+        // so editing the text of the statements doesn't matter
+        const size_t offset = pc.lineOffset;
+
+        if( offset <= it->second.size() && oldStr.substr( 0, offset ) == it->second.substr( 0, offset ) )
+            return false;
+
+        const auto oldEnds = FindStatementEnds( oldStr );
+        const size_t idx = std::lower_bound( oldEnds.begin(), oldEnds.end(), offset ) - oldEnds.begin();
+        const auto rest = oldStr.substr( offset, oldEnds[idx] - offset );
+
+        if( std::all_of( rest.begin(), rest.end(), []( char c ) { return std::isspace( static_cast<unsigned char>(c) ) != 0; } ) )
+        {
+            const std::string_view newStr = it->second;
+            const auto newEnds = FindStatementEnds( newStr );
+
+            if( idx < newEnds.size() )
+            {
+                size_t newOffset = newEnds[idx];
+
+                while( newOffset > 0 && std::isspace( static_cast<unsigned char>(newStr[newOffset - 1]) ) )
+                    --newOffset;
+
+                // The offset of a statement that has become empty would be the one of the previous
+                if( newOffset > (idx == 0 ? 0 : newEnds[idx - 1] + 1) )
+                {
+                    const bool moved = newOffset != offset;
+                    pc.lineOffset = static_cast<unsigned>(newOffset);
+
+                    return moved;
+                }
+            }
+        }
+    }
+
+    // The offset of a deleted line would be used for the next one
+    pc = { line + 1, 0 };
+
+    return true;
 }
 
-std::tuple<const std::string*, linenum_t, unsigned> Runtime::GetNextLine()
+std::tuple<const std::string_view*, linenum_t, unsigned> Runtime::GetNextLine()
 {
-    decltype(mProgram)::const_iterator it{};
-    
+    const auto& lines = mpProgram->GetLines();
+
     for(;;)
     {
-        it = mProgram.lower_bound( mProgramCounter.line );
+        if( mProgramCounter.line == DirectLine && mpDirectLine )
+        {
+            const std::string_view& str = *mpDirectLine;
+
+            for( unsigned offset = mProgramCounter.lineOffset; offset < str.length(); ++offset )
+                if( !std::isspace( str[offset] ) )
+                {
+                    GotoImpl( { DirectLine, ProgramCounter::ContinueExecution } );
+                    return { &str, DirectLine, offset };
+                }
+
+            return {};
+        }
+
+        const auto it = lines.lower_bound( mProgramCounter.line );
 
-        if( it == mProgram.end() )
+        if( it == lines.end() )
             return {};
 
         for( unsigned offset = mProgramCounter.lineOffset; offset < it->second.length(); ++offset )
@@ -194,42 +672,44 @@ std::tuple<const std::string*, linenum_t, unsigned> Runtime::GetNextLine()
 
 void Runtime::Goto( linenum_t line )
 {
-    if( line != MaxLineNum && mProgram.find(line) == mProgram.end() )
+    if( line != MaxLineNum && mpProgram->GetLines().count( line ) == 0 )
         throw std::runtime_error("Unknown line " + std::to_string( line ) );
 
     GotoImpl( { line, 0 } );
 }
 
-void Runtime::ForLoop( std::string varName, value_t initVal, value_t targetVal, value_t stepVal, unsigned currentLineOffset )
+void Runtime::ForLoop( const VarName& var, value_t initVal, value_t targetVal, value_t stepVal, unsigned currentLineOffset )
 {
-    Store( varName, std::move( initVal ) );
+    Store( var, std::move( initVal ) );
 
     const ProgramCounter pc{ mProgramCounter.line, currentLineOffset };
 
+    std::string varName{ var.name };
     boost::algorithm::to_lower( varName );
 
-    mForLoopStack.push_back( { std::move( varName ), std::move( targetVal ), std::move( stepVal ), pc } );
+    mForLoopStack.push_back( { std::move( varName ), var.indices, std::move( targetVal ), std::move( stepVal ), pc } );
 }
 
-bool Runtime::NextImpl( std::string varName )
+bool Runtime::NextImpl( const VarName* pVar )
 {
-    boost::algorithm::to_lower( varName );
-
     for( ;; )
     {
         if( mForLoopStack.empty() )
             throw std::runtime_error( "Mismatched FOR/NEXT statement" );
 
-        if( varName.empty() || varName == mForLoopStack.back().varName )
+        const auto& item = mForLoopStack.back();
+
+        if( !pVar || (CaseInsensitiveEqual{}( pVar->name, item.varName ) && pVar->indices == item.indices) )
             break;
 
         mForLoopStack.pop_back();
     }
 
     auto& cur = mForLoopStack.back();
-    auto curVal = Load( cur.varName );
+    const VarName var{ cur.varName, cur.indices };
+    auto curVal = Load( var );
     curVal = AddImpl( curVal, cur.stepVal );
-    Store( cur.varName, curVal );
+    Store( var, curVal );
 
     const int_t eqRes = ForceFloat( cur.stepVal ) < 0 ?
         LessEqImpl( cur.targetVal, curVal ) :
@@ -247,38 +727,102 @@ bool Runtime::NextImpl( std::string varName )
     }
 }
 
-void Runtime::Next( std::vector<std::string> varNames )
+void Runtime::DefineFuntion( std::string_view fncName, std::string_view varName, std::string exprStr )
 {
-    if( varNames.empty() )
-    {
-        NextImpl( {} );
+    auto fncNameLower = boost::algorithm::to_lower_copy( std::string{ fncName } );
+    auto varNameLower = boost::algorithm::to_lower_copy( std::string{ varName } );
+
+    // DEF inside a loop is executed many times, keep the cache in this case
+    const auto it = mFunctions.find( fncNameLower );
+
+    if( it != mFunctions.end() && it->second.varName == varNameLower && it->second.exprStr == exprStr )
         return;
+
+    FunctionInfo info{ std::move( varNameLower ), std::move( exprStr ) };
+
+    // Errors inside the body are reported when the function is called
+    try
+    {
+        info.impureBody = !CollectFunctionCalls( *ast::ParseExpression( info.exprStr ), info.varName, info.calls );
+    }
+    catch( const std::exception& )
+    {
+        info.calls.clear();
     }
 
-    for( auto &varName : varNames )
-        if( NextImpl( std::move(varName) ) )
-            return;
+    // Functions calling this one may change their purity or results
+    for( auto& [_, other] : mFunctions )
+    {
+        other.pure.reset();
+        other.cache.clear();
+    }
+
+    mFunctions.insert_or_assign( std::move( fncNameLower ), std::move( info ) );
 }
 
-void Runtime::DefineFuntion( std::string fncName, std::string varName, std::string exprStr )
+bool Runtime::IsPureFunction( const FunctionInfo& info ) const
 {
-    boost::algorithm::to_lower( fncName );
-    boost::algorithm::to_lower( varName );
+    if( info.pure )
+        return *info.pure;
+
+    // Breaks recursion, such functions never finish anyway
+    info.pure = false;
+
+    bool res = !info.impureBody;
+
+    for( const auto& name : info.calls )
+    {
+        if( !res )
+            break;
+
+        const auto it = mFunctions.find( name );
+        res = it != mFunctions.end() && IsPureFunction( it->second );
+    }
+
+    info.pure = res;
 
-    mFunctions.insert_or_assign( std::move( fncName ), FunctionInfo{ std::move( varName ), std::move( exprStr ) } );
+    return res;
 }
 
-value_t Runtime::CallFuntion( std::string fncName, value_t arg ) const
+value_t Runtime::CallFuntion( std::string_view fncName, value_t arg ) const
 {
-    boost::algorithm::to_lower( fncName );
+    const auto it = mFunctions.find( fncName );
+
+    if( it == mFunctions.end() )
+        throw std::runtime_error("Unknown function name " + boost::algorithm::to_lower_copy( std::string{ fncName } ) );
+
+    const FunctionInfo& info = it->second;
+
+    if( !IsPureFunction( info ) )
+        return FunctionRuntime::Calculate( *this, info.exprStr, info.varName, std::move( arg ) );
+
+    if( const auto itRes = info.cache.find( arg ); itRes != info.cache.end() )
+    {
+        ++info.stats.hits;
+        return itRes->second;
+    }
+
+    ++info.stats.misses;
+
+    auto res = FunctionRuntime::Calculate( *this, info.exprStr, info.varName, arg );
+
+    if( info.cache.size() < MaxFunctionCacheSize )
+        info.cache.emplace( std::move( arg ), res );
 
+    return res;
+}
+
+FunctionCacheStats Runtime::GetFunctionCacheStats( std::string_view fncName ) const
+{
     const auto it = mFunctions.find( fncName );
 
     if( it == mFunctions.end() )
-        throw std::runtime_error("Unknown function name " + fncName );
+        throw std::runtime_error( "Unknown function name " + boost::algorithm::to_lower_copy( std::string{ fncName } ) );
 
+    FunctionCacheStats res = it->second.stats;
+    res.pure = IsPureFunction( it->second );
 
-    return FunctionRuntime::Calculate( *this, it->second.exprStr, it->second.varName, std::move(arg) );
+    return res;
 }
 
 template<class T>
@@ -288,9 +832,9 @@ inline void Runtime::PrintNumberImpl( T val ) const
     //  Positive numbers are preceded by a space.
     //  Negative numbers are preceded by a minus sign."
     if( val >= 0 )
-        std::cout << ' ';
+        *mpOut << ' ';
 
-    std::cout << val << ' ';
+    *mpOut << val << ' ';
 }
 
 void Runtime::Print( int_t val ) const
@@ -305,48 +849,77 @@ void Runtime::Print( float_t val ) const
 
 void Runtime::Print( const str_t& val ) const
 {
-    std::cout << val;
+    *mpOut << val;
 }
 
-void Runtime::Input( const std::string& prompt, const std::string& name )
+void Runtime::Input( const std::string& prompt, const VarName& var )
 {
-    if( name.empty() )
+    if( var.name.empty() )
         throw std::runtime_error( "variable name cannot be empty" );
 
+    // The rest of the statement is executed after the input arrives
+    if( mWaitingForInput )
+        return;
+
+    if( mInputItemsToSkip > 0 )
+    {
+        --mInputItemsToSkip;
+        return;
+    }
+
     value_t res;
     std::string str;
 
     for( ;; )
     {
-        std::cout << prompt;
+        if( !mInputPromptShown )
+        {
+            *mpOut << prompt;
+
+            if( prompt.empty() || prompt.back() != '?' )
+                *mpOut << '?';
+
+            *mpOut << ' ';
+        }
 
-        if( prompt.empty() || prompt.back() != '?' )
-            std::cout << '?';
+        mInputPromptShown = false;
 
-        std::cout << ' ';
+        if( mFakeInput.empty() && !mBlockingInput )
+        {
+            mWaitingForInput = true;
+            mInputPromptShown = true;
+            mResumingInput = true;
+            GotoImpl( { mProgramCounter.line, mStatementOffset } );
+            return;
+        }
 
         if( mFakeInput.empty() )
         {
-            if( !std::getline( std::cin, str ) )
+            if( mpIn == &std::cin )
+                RestoreConsoleInput();
+
+            if( !std::getline( *mpIn, str ) )
                 throw std::runtime_error( "std::getline() error" );
 
-            if( !g_flInputLog.is_open() )
-                g_flInputLog.open("input.log");
+            if( !mInputLog.is_open() )
+                mInputLog.open("input.log");
 
-            g_flInputLog << str << std::endl;
+            mInputLog << str << std::endl;
         }
         else
         {
-            str = std::move( mFakeInput.front() );
-            mFakeInput.pop_front();
-            std::cout << str << std::endl;
+            auto input = PopFakeInput();
+            str = std::move( input.str );
+
+            if( input.echo )
+                *mpOut << str << std::endl;
         }
 
         const char* const pBeg = str.data();
         const char* const pEnd = pBeg + str.size();
         char* pLast = nullptr;
 
-        switch( DetectVarType( name ) )
+        switch( DetectVarType( var.name ) )
         {
         case ValueType::Str:
             res = std::move( str );
@@ -364,40 +937,120 @@ void Runtime::Input( const std::string& prompt, const std::string& name )
         if( pLast == pEnd )
             break;
 
-        std::cout << "?REENTER" << std::endl;
+        *mpOut << "?REENTER" << std::endl;
     }
 
-    Store( name, res );
+    Store( var, res );
+    ++mInputItemsDone;
+}
+
+void Runtime::BeginStatement( unsigned offset )
+{
+    mStatementOffset = offset;
+    mInputItemsToSkip = mResumingInput ? mInputItemsDone : 0;
+    mInputItemsDone = mInputItemsToSkip;
+    mResumingInput = false;
+}
+
+Runtime::RunStatus Runtime::Run( size_t maxSteps, std::chrono::steady_clock::time_point deadline )
+{
+    const bool checkDeadline = deadline != std::chrono::steady_clock::time_point::max();
+
+    mWaitingForInput = false;
+    mWaitingForKey = false;
+
+    for( size_t step = 0; step < maxSteps; ++step )
+    {
+        if( checkDeadline && step != 0 && std::chrono::steady_clock::now() >= deadline )
+            return RunStatus::Yielded;
+
+        const auto [pStr, lineNum, offset] = GetNextLine();
+
+        if( !pStr )
+            return RunStatus::Finished;
+
+        mLastStep.line = lineNum;
+        mLastStep.offset = offset;
+
+        value_t res{};
+
+        if( !ParseSequence( *pStr, offset, main_pass::statement_rule(), *this, res, mLastStep.error ) )
+            return RunStatus::Error;
+
+        if( mWaitingForInput )
+            return RunStatus::WaitingForInput;
+
+        if( mWaitingForKey )
+            return RunStatus::WaitingForKey;
+    }
+
+    return RunStatus::Yielded;
 }
 
 runtime::value_t Runtime::Inkey()
 {
+    if( mFakeInput.empty() && !mBlockingInput )
+    {
+        mWaitingForKey = true;
+        return value_t{ std::string( "" ) };
+    }
+
     if( mFakeInput.empty() )
     {
-        const int key = GetPressedKbKey();
+        // The console output is buffered, see main()
+        if( mpIn == &std::cin )
+            mpOut->flush();
+
+        const int key = mpIn == &std::cin ? PollKbKey() : 0;
         return value_t{ key != 0 ? std::string( 1, (char)key ) : std::string( "" ) };
     }
 
-    std::string res{ std::move( mFakeInput.front() ) };
-
-    mFakeInput.pop_front();
+    return value_t{ PopFakeInput().str };
+}
 
-    return value_t{res};
+void Runtime::AddFakeInputScript( std::shared_ptr<const std::string_view> pText )
+{
+    if( !pText->empty() )
+        mFakeInput.push_back( { {}, true, std::move( pText ) } );
 }
 
-void Runtime::Read( std::string name )
+Runtime::InputLine Runtime::PopFakeInput()
 {
-    if( mCurDataIdx >= mData.size() )
-        throw std::runtime_error( "Out of DATA" );
+    auto& front = mFakeInput.front();
 
-    Store( std::move( name ), mData[mCurDataIdx] );
-    ++mCurDataIdx;
+    if( !front.pScript )
+    {
+        InputLine res = std::move( front );
+        mFakeInput.pop_front();
+        return res;
+    }
+
+    // The same lines as std::getline() gives, a script is removed after the last one
+    const std::string_view text = *front.pScript;
+    const size_t lineEnd = std::min( text.find( '\n', front.scriptPos ), text.size() );
+    std::string_view line = text.substr( front.scriptPos, lineEnd - front.scriptPos );
+
+    if( !line.empty() && line.back() == '\r' )
+        line.remove_suffix( 1 );
+
+    InputLine res{ std::string{ line }, front.echo };
+    front.scriptPos = lineEnd + 1;
+
+    if( front.scriptPos >= text.size() )
+        mFakeInput.pop_front();
+
+    return res;
 }
 
-void Runtime::AddDataImpl( value_t value )
+void Runtime::Read( const VarName& var )
 {
-    mLineToDataPos.try_emplace( mProgramCounter.line, mData.size() );
-    mData.push_back( std::move(value) );
+    const auto& data = mpProgram->GetData();
+
+    if( mCurDataIdx >= data.size() )
+        throw std::runtime_error( "Out of DATA" );
+
+    Store( var, data[mCurDataIdx] );
+    ++mCurDataIdx;
 }
 
 void Runtime::Start()
@@ -405,12 +1058,93 @@ void Runtime::Start()
     //We need a deterministic rand() for automation
     Randomize( mFakeInput.empty() ? (unsigned int)std::time(0): 0 );
     mProgramCounter = {};
+    ResetInputState();
+}
+
+void Runtime::StartDirect( std::string str )
+{
+    mpDirectLine = MakeSharedText( std::move( str ) );
+    mProgramCounter = { DirectLine, 0 };
+    ResetInputState();
+}
+
+void Runtime::ResetInputState()
+{
+    mWaitingForInput = false;
+    mWaitingForKey = false;
+    mInputPromptShown = false;
+    mResumingInput = false;
+    mInputItemsDone = 0;
+    mInputItemsToSkip = 0;
+    mSkipElseOnResume = 0;
 }
 
 void Runtime::PrintVars( std::ostream& os ) const
 {
     for ( auto &v: mVars)
         os << ' ' << v.first << '=' << v.second;
+
+    for( auto& [name, pArray] : mArrays )
+    {
+        const ArrayVar& array = *pArray;
+        size_t pos = 0;
+
+        ListAllArrayElements( array.dimensions, [&, name = name]( const auto& indices ) {
+            os << ' ' << FormatVarName( { name, ArrayIndices( indices.begin(), indices.end() ) } ) << '=' << GetElement( array, pos++ );
+        } );
+
+        for( auto& [indices, val] : array.outOfRange )
+            os << ' ' << FormatVarName( { name, indices } ) << '=' << val;
+    }
+}
+
+size_t Runtime::GetMemoryUsage() const
+{
+    // Rough estimate: the payload and a node per container element, allocator overheads are ignored
+    constexpr size_t NodeSize = 4 * sizeof( void* );
+
+    const auto valueSize = []( const value_t& val ) {
+        const auto* pStr = boost::get<str_t>( &val.get() );
+        return sizeof( value_t ) + (pStr ? pStr->capacity() : 0);
+    };
+
+    size_t res = sizeof( *this );
+
+    for( const auto& name : mVarNames )
+        res += sizeof( name ) + name.capacity();
+
+    for( const auto& [name, val] : mVars )
+        res += NodeSize + sizeof( name ) + valueSize( val );
+
+    // Arrays shared with copies of the runtime are counted in each of them
+    for( const auto& [name, pArray] : mArrays )
+    {
+        const ArrayVar& array = *pArray;
+        res += NodeSize + sizeof( name ) + sizeof( array ) + array.dimensions.capacity() * sizeof( int_t );
+        res += array.numbers.GetUsedSize();
+
+        for( const auto& [pos, str] : array.strings )
+            res += NodeSize + sizeof( pos ) + sizeof( str ) + str.capacity();
+
+        for( const auto& [indices, val] : array.outOfRange )
+            res += NodeSize + sizeof( indices ) + valueSize( val );
+    }
+
+    for( const auto& [name, info] : mFunctions )
+    {
+        res += NodeSize + sizeof( name ) + name.capacity() + sizeof( info ) + info.varName.capacity() + info.exprStr.capacity();
+
+        for( const auto& [arg, val] : info.cache )
+            res += NodeSize + valueSize( arg ) + valueSize( val );
+    }
+
+    // Scripts may be shared and are usually mapped, they aren't included
+    for( const auto& input : mFakeInput )
+        res += sizeof( input ) + input.str.capacity();
+
+    res += mForLoopStack.capacity() * sizeof( ForLoopItem ) + mGosubStack.capacity() * sizeof( ProgramCounter );
+
+    return res;
 }
 
 void Runtime::Restore()
@@ -420,23 +1154,35 @@ void Runtime::Restore()
 
 void Runtime::Restore( linenum_t line )
 {
-    const auto it = mLineToDataPos.find(line);
+    const auto pos = mpProgram->FindDataPos( line );
 
-    if( it == mLineToDataPos.end() )
+    if( !pos )
         throw std::runtime_error( "Unknown line " + std::to_string( line ) );
 
-    mCurDataIdx = it->second;
+    mCurDataIdx = *pos;
 }
 
 void Runtime::Randomize( unsigned int n )
 {
-    std::srand( n );
+    mRandom.Seed( n );
+}
+
+float_t Runtime::Rnd( float_t val ) const
+{
+    return RndImpl( val, mRandom );
+}
+
+void Runtime::SetStreams( std::istream& in, std::ostream& out, std::ostream& err )
+{
+    mpIn = &in;
+    mpOut = &out;
+    mpErr = &err;
 }
 
 void Runtime::ClearProgram()
 {
-    mProgram.clear();
-    mLineToDataPos.clear();
+    mpProgram = std::make_shared<Program>();
+    mStaticallyChecked = false;
     mForLoopStack.clear();
     mGosubStack.clear();
     mProgramCounter = {};
@@ -445,10 +1191,19 @@ void Runtime::ClearProgram()
 void Runtime::Clear()
 {
     ClearProgram();
+    ClearVars();
+    mFakeInput.clear();  
+    ResetInputState();
+}
+
+void Runtime::ClearVars()
+{
     mVars.clear();
+    mArrays.clear();
+    mVarNames.clear();
     mFunctions.clear();
-    mFakeInput.clear();  
-    mData.clear();
+    mForLoopStack.clear();
+    mGosubStack.clear();
     mCurDataIdx = 0;
 }
 
@@ -466,22 +1221,21 @@ value_t FunctionRuntime::Calculate( const Runtime& rootRuntime, std::string_view
 
     if( !ParseSingle( exprStr, 0, err, parseFnc ) )
     {
-        std::cerr << "\033[91m" "-------------------------\n";
-        std::cerr << "Function execution failed\n" << exprStr << "\n";
-        std::cerr << "Error: " << err << "\n";
-        std::cerr << "-------------------------\n" "\033[0m";
+        auto& errOut = rootRuntime.Err();
+        errOut << "\033[91m" "-------------------------\n";
+        errOut << "Function execution failed\n" << exprStr << "\n";
+        errOut << "Error: " << err << "\n";
+        errOut << "-------------------------\n" "\033[0m";
         throw std::runtime_error( "Function execution failed" );
     }
 
     return res;
 }
 
-main_pass::value_t FunctionRuntime::Load( std::string name ) const
+main_pass::value_t FunctionRuntime::Load( const VarName& var ) const
 {
-    boost::to_lower(name);
-
-    if( name != mVarName )
-        throw std::runtime_error( "Unknown variable inside the function body: " + name );
+    if( !var.indices.empty() || !CaseInsensitiveEqual{}( var.name, mVarName ) )
+        throw std::runtime_error( "Unknown variable inside the function body: " + boost::algorithm::to_lower_copy( std::string{ var.name } ) );
 
     return mVarValue;
 }
@@ -1,13 +1,24 @@
 #ifndef BASIC_INT_RUNTIME_H
 #define BASIC_INT_RUNTIME_H
 
+#include <algorithm>
+#include <cctype>
 #include <string>
 #include <map>
 #include <deque>
+#include <optional>
 #include <unordered_map>
 #include <sstream>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <utility>
+#include <boost/container/small_vector.hpp>
 
 #include "value.h"
+#include "program.h"
+#include "platform.h"
 
 
 namespace runtime
@@ -25,19 +36,135 @@ namespace runtime
         SkipElse
     };
 
+    // Arrays rarely have more than a few dimensions, so the indices don't allocate
+    using ArrayIndices = boost::container::small_vector<int_t, 4>;
+
+    // A variable as it's written in the program. The name points into the line
+    // being parsed and is only valid until the statement is executed.
+    struct VarName
+    {
+        std::string_view name;
+        ArrayIndices indices;       // Empty for scalar variables
+    };
+
+    struct CaseInsensitiveHash
+    {
+        size_t operator()( std::string_view str ) const noexcept
+        {
+            // FNV-1a
+            size_t res = 14695981039346656037ull;
+
+            for( char c : str )
+            {
+                res ^= static_cast<size_t>(std::tolower( static_cast<unsigned char>(c) ));
+                res *= 1099511628211ull;
+            }
+
+            return res;
+        }
+    };
+
+    struct CaseInsensitiveEqual
+    {
+        bool operator()( std::string_view s1, std::string_view s2 ) const noexcept
+        {
+            if( s1.size() != s2.size() )
+                return false;
+
+            for( size_t i = 0; i < s1.size(); ++i )
+                if( std::tolower( static_cast<unsigned char>(s1[i]) ) != std::tolower( static_cast<unsigned char>(s2[i]) ) )
+                    return false;
+
+            return true;
+        }
+    };
+
+    struct CaseInsensitiveLess
+    {
+        using is_transparent = void;
+
+        bool operator()( std::string_view s1, std::string_view s2 ) const noexcept
+        {
+            return std::lexicographical_compare( s1.begin(), s1.end(), s2.begin(), s2.end(), []( char c1, char c2 ) {
+                return std::tolower( static_cast<unsigned char>(c1) ) < std::tolower( static_cast<unsigned char>(c2) );
+            } );
+        }
+    };
+
+    struct FunctionCacheStats
+    {
+        bool pure = false;
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
     class Runtime
     {
     public:
-        void Store( std::string name, value_t val );
-        value_t Load( std::string name ) const;
+        Runtime() = default;
 
-        void AddLine( linenum_t line, std::string_view str );
-        void AppendToPrevLine( std::string_view str );
-        void UpdateCurParseLine( linenum_t line );
+        // A copy is a snapshot of the whole execution state: variables, FOR and GOSUB
+        // stacks, DATA cursor, RNG, pending input and the program counter, so e.g. a
+        // search can fork the game at a prompt and run every branch on its own copy.
+        // The program and the arrays are shared copy-on-write, the rest is copied.
+        // The streams are shared as well, the input log isn't.
+        Runtime( const Runtime& other );
+        Runtime& operator=( const Runtime& other );
 
-        std::tuple<const std::string*, linenum_t, unsigned> GetNextLine();
+        void Store( const VarName& var, value_t val );
+        value_t Load( const VarName& var ) const;
 
-        void Dim( std::string baseVarName, const std::vector<int_t> &dimentions );
+        // See Program::AddSource()
+        void AddProgramSource( std::shared_ptr<const std::string_view> pText )
+        {
+            MutableProgram().AddSource( std::move( pText ) );
+        }
+
+        void AddLine( linenum_t line, std::string_view str )
+        {
+            MutableProgram().AddLine( line, str );
+        }
+
+        void AppendToPrevLine( std::string_view str )
+        {
+            MutableProgram().AppendToPrevLine( str );
+        }
+
+        void UpdateCurParseLine( linenum_t line )
+        {
+            MutableProgram().UpdateCurParseLine( line );
+        }
+
+        // Runs an already loaded program, which may be shared with other runtimes.
+        // Call Start() afterwards.
+        void SetProgram( std::shared_ptr<const Program> pProgram );
+
+        std::shared_ptr<const Program> GetSharedProgram() const
+        {
+            return mpProgram;
+        }
+
+        // Moves the program out, the runtime is left with an empty one. A program
+        // shared with other runtimes is copied.
+        Program TakeProgram();
+
+        // See Program::Append()
+        void AppendProgram( Program&& part )
+        {
+            MutableProgram().Append( std::move( part ) );
+        }
+
+        // Replaces, inserts or deletes a line of the program between the Run() calls, e.g.
+        // to fix a session without restarting it, see PreparseLine() and Program::ReplaceLine().
+        // The variables, functions and the rest of the program stay. The counter, FOR and
+        // GOSUB frames pointing into the line keep their place if the text before it is the
+        // same, otherwise they go to the next line. READ continues after the items of the line
+        // already read. A program shared with other runtimes is copied, they aren't changed.
+        void PatchLine( linenum_t line, Program&& part );
+
+        std::tuple<const std::string_view*, linenum_t, unsigned> GetNextLine();
+
+        void Dim( std::string_view baseVarName, const std::vector<int_t> &dimentions );
 
         void Goto( linenum_t line );
 
@@ -63,43 +190,66 @@ namespace runtime
             mGosubStack.pop_back();
         }
 
-        void ForLoop( std::string varName, value_t initVal, value_t targetVal, value_t stepVal, unsigned currentLineOffset );
+        void ForLoop( const VarName& var, value_t initVal, value_t targetVal, value_t stepVal, unsigned currentLineOffset );
+
+        void Next()
+        {
+            NextImpl( nullptr );
+        }
+
+        void Next( const VarName& var )
+        {
+            NextImpl( &var );
+        }
 
-        void Next( std::vector<std::string> varNames );
+        void DefineFuntion( std::string_view fncName, std::string_view varName, std::string exprStr );
 
-        void DefineFuntion( std::string fncName, std::string varName, std::string exprStr );
+        value_t CallFuntion( std::string_view fncName, value_t arg ) const;
 
-        value_t CallFuntion( std::string fncName, value_t arg ) const;
+        FunctionCacheStats GetFunctionCacheStats( std::string_view fncName ) const;
 
         void Print( int_t val ) const;
         void Print( float_t val ) const;
         void Print( const str_t &val ) const;
 
-        void Input( const std::string& prompt, const std::string& name );
+        void Input( const std::string& prompt, const VarName& var );
 
         value_t Inkey();
 
+        // Automation, the lines are printed as if they were typed
         void AddFakeInput( std::string str )
         {
-            mFakeInput.push_back( std::move( str ) );
+            mFakeInput.push_back( { std::move( str ), true } );
         }
 
+        // A line or a key from the host, it's already echoed by the user's terminal
+        void AddInput( std::string str )
+        {
+            mFakeInput.push_back( { std::move( str ), false } );
+        }
+
+        // Automation from a script, e.g. an ".input" file from MapFile(). The lines are
+        // taken one by one when the program asks for them, the text isn't copied and
+        // may be shared by any number of runtimes.
+        void AddFakeInputScript( std::shared_ptr<const std::string_view> pText );
+
         void AddData( int v )
         {
-            AddDataImpl( value_t{ static_cast<int_t>(v) } );
+            MutableProgram().AddData( static_cast<int_t>(v) );
         }
 
         void AddData( float v )
         {
-            AddDataImpl( value_t{ float_t{v} } );
+            MutableProgram().AddData( float_t{ v } );
         }
 
-        void AddData( str_t v )
+        // A string inside the program source is referenced, see Program::AddSource()
+        void AddData( std::string_view v )
         {
-            AddDataImpl( value_t{ std::move( v ) } );
+            MutableProgram().AddData( v );
         }
 
-        void Read( std::string name );
+        void Read( const VarName& var );
 
         void Restore();
 
@@ -107,12 +257,98 @@ namespace runtime
 
         void Randomize( unsigned int n );
 
+        float_t Rnd( float_t val ) const;
+
+        // The console by default. Runtimes working in parallel get their own streams,
+        // no keyboard is available for INKEY$ then.
+        void SetStreams( std::istream& in, std::ostream& out, std::ostream& err );
+
+        std::ostream& Out() const
+        {
+            return *mpOut;
+        }
+
+        std::ostream& Err() const
+        {
+            return *mpErr;
+        }
+
         void ClearProgram();
         
         void Clear();
 
+        // Variables, arrays, functions and the loop stacks, the program stays
+        void ClearVars();
+
         void Start();
 
+        // The line typed without a number in the interactive mode. It's executed like
+        // a line after the end of the program, so GOTO and GOSUB go into the program,
+        // RETURN comes back to it and the execution finishes after it. The variables
+        // stay. Call Run() afterwards.
+        void StartDirect( std::string str );
+
+        static constexpr linenum_t DirectLine = (MaxLineNum >> 16) - 1;
+
+        enum class RunStatus
+        {
+            Yielded,            // The budget is over, Run() continues from the same place
+            WaitingForInput,    // Run() continues after AddInput()
+            WaitingForKey,      // INKEY$ returned nothing, Run() continues after AddInput() or a timeout
+            Finished,
+            Error               // See GetLastStep()
+        };
+
+        struct StepInfo
+        {
+            linenum_t line = 0;
+            unsigned offset = 0;
+            std::string error;
+        };
+
+        // Executes at most maxSteps steps, i.e. lines or their rests after jumps, starting
+        // from the current program counter. Start() has to be called before the first run.
+        // The deadline is checked between the steps.
+        RunStatus Run( size_t maxSteps, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max() );
+
+        const StepInfo& GetLastStep() const
+        {
+            return mLastStep;
+        }
+
+        // Without blocking, only the host provides the input. When there is none,
+        // INPUT suspends Run() and is executed again on the next run, INKEY$ returns
+        // an empty string and Run() stops after the current step. So a session
+        // waiting for a user doesn't hold a thread.
+        void SetBlockingInput( bool blocking )
+        {
+            mBlockingInput = blocking;
+        }
+
+        // The program was checked by analysis::AnalyzeProgram() and its diagnostics were
+        // reported before the start, so reading a variable before any assignment and accessing
+        // an array without DIM get the default value silently. Elements out of the DIM ranges
+        // are still reported. Setting or patching the program resets it.
+        void SetStaticallyChecked( bool checked )
+        {
+            mStaticallyChecked = checked;
+        }
+
+        void BeginStatement( unsigned offset );
+
+        // ParseSequence() passes the ELSE parts it still had to skip when a statement left
+        // the line. Only the statement suspended by INPUT keeps them, the THEN branch it was
+        // in is parsed from that statement on the resume.
+        void SetSkipElseOnResume( unsigned count )
+        {
+            mSkipElseOnResume = mResumingInput ? count : 0;
+        }
+
+        unsigned TakeSkipElseOnResume()
+        {
+            return std::exchange( mSkipElseOnResume, 0 );
+        }
+
         bool IsExpectedToContinueLineExecution() const
         {
             return mProgramCounter.lineOffset == ProgramCounter::ContinueExecution;
@@ -120,6 +356,34 @@ namespace runtime
 
         void PrintVars( std::ostream &os ) const;
 
+        // Writes the execution state to a versioned binary checkpoint tagged with the hash
+        // of the program. The streams, the blocking mode and the FN caches aren't saved.
+        void SaveCheckpoint( std::ostream& os ) const;
+
+        // Restores the state written by SaveCheckpoint(), Run() continues from where the
+        // saved runtime stopped. The same program has to be loaded, throws std::runtime_error
+        // if it's another one or the checkpoint is broken. The runtime is unchanged then.
+        void LoadCheckpoint( std::istream& is );
+
+        // Approximate heap usage of the execution state in bytes. The program isn't
+        // included, it may be shared, see Program::GetMemoryUsage().
+        size_t GetMemoryUsage() const;
+
+        const std::map<linenum_t, std::string_view>& GetProgram() const
+        {
+            return mpProgram->GetLines();
+        }
+
+        const DataPool& GetData() const
+        {
+            return mpProgram->GetData();
+        }
+
+        const std::vector<std::pair<linenum_t, size_t>>& GetLineToDataPos() const
+        {
+            return mpProgram->GetLineToDataPos();
+        }
+
         static value_t GetDefaultValue( std::string_view name );
 
     private:
@@ -134,61 +398,149 @@ namespace runtime
 
         static_assert( sizeof(ProgramCounter) == sizeof(linenum_t) );
 
+        // The next line is the end, it's what MaxLineNum becomes in the counter
+        static_assert( DirectLine == (MaxLineNum >> ProgramCounter::LineOffsetBits) - 1 );
+
         struct ForLoopItem
         {
-            std::string varName;
+            std::string varName;        // Lower case
+            ArrayIndices indices;
             value_t targetVal;
             value_t stepVal;
             ProgramCounter startBodyPC;
         };
 
+        struct ValueLess
+        {
+            bool operator()( const value_t& v1, const value_t& v2 ) const
+            {
+                return v1.get() < v2.get();
+            }
+        };
+
+        // Results of pure functions are cached, the cache stops growing when it's full
+        static constexpr size_t MaxFunctionCacheSize = 64;
+
         struct FunctionInfo
         {
             std::string varName;
             std::string exprStr;
+            bool impureBody = true;             // RND, INKEY$, globals or an unparsable body
+            std::vector<std::string> calls;     // Names of FN called from the body
+            mutable std::optional<bool> pure;   // Depends on other functions, see IsPureFunction()
+            mutable std::map<value_t, value_t, ValueLess> cache;
+            mutable FunctionCacheStats stats;
+        };
+
+        // Elements within the DIM ranges are addressed in the row-major order, the rest are
+        // the ones accessed without DIM. Numbers of the array type are kept in zero-filled
+        // memory, so DIM costs the same for any size and only the pages written take memory.
+        // Strings are kept only when they aren't empty.
+        struct ArrayVar
+        {
+            ValueType type = ValueType::Float;
+            std::vector<int_t> dimensions;
+            size_t count = 0;                               // Within the DIM ranges
+            ZeroedMemory numbers;                           // count of int_t or float_t
+            std::unordered_map<size_t, str_t> strings;      // By the position
+            std::map<ArrayIndices, value_t> outOfRange;
         };
 
+        template<class T>
+        using CaseInsensitiveMap = std::unordered_map<std::string_view, T, CaseInsensitiveHash, CaseInsensitiveEqual>;
+
         void GotoImpl( ProgramCounter pc )
         {
             mProgramCounter = pc;
         }
 
-        bool NextImpl( std::string varName );
-        void AddDataImpl( value_t value ); 
-
-        static ValueType DetectVarType( std::string_view name );
-        static bool IsArrayVar( std::string_view name );
+        bool PatchPC( ProgramCounter& pc, linenum_t line, std::string_view oldStr ) const;
+        bool NextImpl( const VarName* pVar );
+        bool IsPureFunction( const FunctionInfo& info ) const;
+        void ResetInputState();
+        Program& MutableProgram();
+
+        std::string_view InternName( std::string_view name );
+        std::optional<value_t> FindElement( const VarName& var ) const;
+        void AddVar( const VarName& var, value_t val );
+        bool IsReportedOnAccess( const VarName& var ) const;
+        void CopyVars( const Runtime& other );
+
+        static std::shared_ptr<ArrayVar> MakeArray( std::string_view name );
+        static std::optional<size_t> GetElementPos( const ArrayVar& array, const ArrayIndices& indices );
+        static value_t GetElement( const ArrayVar& array, size_t pos );
+        static void SetElement( ArrayVar& array, size_t pos, value_t val );
+        static ArrayIndices GetElementIndices( const ArrayVar& array, size_t pos );
+        static size_t GetNumberSize( ValueType type );     // 0 for strings
+        static size_t GetElementsCount( const std::vector<int_t>& dimensions, ValueType type );
+        static ArrayVar& MutableArray( std::shared_ptr<ArrayVar>& pArray );
+
+        static value_t ConvertForStore( std::string_view name, value_t val );
+        static std::string FormatVarName( const VarName& var );
 
         template<class T>
         void PrintNumberImpl( T val ) const;
 
     private:
-        std::unordered_map<std::string, value_t> mVars;
-        std::map<std::string, FunctionInfo, std::less<>> mFunctions;
-        std::map<linenum_t, std::string> mProgram;
-        std::unordered_map<linenum_t, size_t> mLineToDataPos;
+        CaseInsensitiveMap<value_t> mVars;
+        CaseInsensitiveMap<std::shared_ptr<ArrayVar>> mArrays;     // Shared between the copies until changed
+        std::deque<std::string> mVarNames;      // Owns the keys of mVars and mArrays
+        std::map<std::string, FunctionInfo, CaseInsensitiveLess> mFunctions;
+        std::shared_ptr<const Program> mpProgram = std::make_shared<Program>();
         std::vector<ForLoopItem> mForLoopStack;
         std::vector<ProgramCounter> mGosubStack;
-        std::deque<std::string> mFakeInput;
+        std::shared_ptr<const std::string_view> mpDirectLine;     // See StartDirect()
+        struct InputLine
+        {
+            std::string str;
+            bool echo;
+            std::shared_ptr<const std::string_view> pScript = nullptr;    // The rest of the script from scriptPos instead of str
+            size_t scriptPos = 0;
+        };
+
+        InputLine PopFakeInput();
+
+        std::deque<InputLine> mFakeInput;
         ProgramCounter mProgramCounter = {};
-        std::vector<value_t> mData;
         size_t mCurDataIdx = 0;
+        std::istream* mpIn = &std::cin;
+        std::ostream* mpOut = &std::cout;
+        std::ostream* mpErr = &std::cerr;
+        std::ofstream mInputLog;
+        mutable Random mRandom;             // RND may be called from a const FN body
+        StepInfo mLastStep;
+        bool mBlockingInput = true;
+        bool mStaticallyChecked = false;
+        bool mWaitingForInput = false;
+        bool mWaitingForKey = false;
+        bool mInputPromptShown = false;
+        // INPUT A, B suspended on B is executed again, but A is not read twice
+        bool mResumingInput = false;
+        unsigned mInputItemsDone = 0;
+        unsigned mInputItemsToSkip = 0;
+        unsigned mStatementOffset = 0;
+        unsigned mSkipElseOnResume = 0;
     };
 
     class FunctionRuntime
     {
     public:
         static value_t Calculate( const Runtime& rootRuntime, std::string_view exprStr, std::string_view varName, value_t varValue );
-        value_t Load( std::string name ) const;
-        value_t CallFuntion( std::string fncName, value_t arg ) const 
+        value_t Load( const VarName& var ) const;
+        value_t CallFuntion( std::string_view fncName, value_t arg ) const 
         { 
-            return mRootRuntime.CallFuntion( std::move(fncName), std::move(arg) );
+            return mRootRuntime.CallFuntion( fncName, std::move(arg) );
         }
 
         value_t Inkey()
         {
             return value_t{};
         }
+
+        float_t Rnd( float_t val ) const
+        {
+            return mRootRuntime.Rnd( val );
+        }
         
         bool IsExpectedToContinueLineExecution() const
         {
@@ -207,25 +559,30 @@ namespace runtime
 
     class SkipStatementRuntime
     {
-        using TStrArg = const std::string&;
+        using TStrArg = std::string_view;
+        using TVarArg = const VarName&;
         using TValueArg = const value_t&;
 
     public:
-        void Store( TStrArg name, TValueArg val ) { /*Nothing*/ }
-        value_t Load( TStrArg name ) const { return Runtime::GetDefaultValue(name); }
+        void Store( TVarArg var, TValueArg val ) { /*Nothing*/ }
+        value_t Load( TVarArg var ) const { return Runtime::GetDefaultValue(var.name); }
         void Dim( TStrArg baseVarName, const std::vector<int_t>& dimentions ) { /*Nothing*/ }
         void Goto( linenum_t line ) { /*Nothing*/ }
         void GotoNextLine() { /*Nothing*/ }
         void Gosub( linenum_t line, unsigned currentLineOffset ) { /*Nothing*/ }
         void Return() { /*Nothing*/ }
-        void ForLoop( TStrArg varName, TValueArg initVal, TValueArg targetVal, TValueArg stepVal, unsigned currentLineOffset ) { /*Nothing*/ }
-        void Next( const std::vector<std::string> &varNames ) { /*Nothing*/ }
-        void DefineFuntion( TStrArg fncName, TStrArg varName, TStrArg exprStr ) { /*Nothing*/ }
+        void ForLoop( TVarArg var, TValueArg initVal, TValueArg targetVal, TValueArg stepVal, unsigned currentLineOffset ) { /*Nothing*/ }
+        void Next() { /*Nothing*/ }
+        void Next( TVarArg var ) { /*Nothing*/ }
+        void BeginStatement( unsigned offset ) { /*Nothing*/ }
+        bool IsExpectedToContinueLineExecution() const { return true; }
+        void DefineFuntion( TStrArg fncName, TStrArg varName, const std::string& exprStr ) { /*Nothing*/ }
         value_t CallFuntion( TStrArg fncName, TValueArg arg ) const { return value_t{}; }
         template<class T> void Print( T&& val ) const { /*Nothing*/ }
-        void Input( TStrArg prompt, TStrArg name ) { /*Nothing*/ }
+        void Input( const std::string& prompt, TVarArg var ) { /*Nothing*/ }
         value_t Inkey() { return value_t{}; }
-        void Read( TStrArg name ) { /*Nothing*/ }
+        float_t Rnd( float_t val ) const { return float_t{}; }
+        void Read( TVarArg var ) { /*Nothing*/ }
         void Restore() { /*Nothing*/ }
         void Restore( linenum_t line ) { /*Nothing*/ }
         void Randomize( unsigned int n ) { /*Nothing*/ }
@@ -0,0 +1,694 @@
+#include "server.h"
+#include "runtime.h"
+
+#include <stdexcept>
+
+#ifdef __linux__
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace server
+{
+#ifdef __linux__
+namespace
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    uint64_t ThreadCpuTimeNs()
+    {
+        timespec ts{};
+        clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    void ThrowSystemError( const char* szWhat )
+    {
+        throw std::runtime_error( std::string( szWhat ) + " failed, errno " + std::to_string( errno ) );
+    }
+
+    // Only sockets are removed, a regular file given by mistake is kept
+    bool IsSocketFile( const std::string& path )
+    {
+        struct stat st{};
+
+        return lstat( path.c_str(), &st ) == 0 && S_ISSOCK( st.st_mode );
+    }
+
+    struct Session
+    {
+        explicit Session( int fd, unsigned id ): id{ id }, fd{ fd }
+        {
+            runtime.SetStreams( noInput, out, out );
+            runtime.SetBlockingInput( false );
+        }
+
+        const unsigned id;
+
+        // Only the worker executing the session touches these
+        std::istringstream noInput;
+        std::ostringstream out;
+        runtime::Runtime runtime;
+        bool loaded = false;
+
+        // Only the event loop touches it
+        std::string partialLine;
+
+        // Guarded by ioMutex. The socket is closed by the event loop, so fd is -1 after that
+        std::mutex ioMutex;
+        int fd = -1;
+        std::string outBuf;
+        std::vector<std::string> pendingInput;
+        bool waitingForWrite = false;
+        bool finished = false;
+
+        // Guarded by Server::mQueueMutex
+        bool queued = false;
+        bool running = false;
+        bool rerun = false;
+        bool stalled = false;       // Yielded while the client doesn't read the output
+
+        std::atomic<uint64_t> cpuNs{ 0 };
+        std::atomic<uint64_t> slices{ 0 };
+        std::atomic<uint64_t> bytesIn{ 0 };
+        std::atomic<uint64_t> bytesOut{ 0 };
+        std::atomic<size_t> memory{ 0 };
+        std::atomic<RunStatus> status{ RunStatus::Yielded };
+    };
+
+    using SessionPtr = std::shared_ptr<Session>;
+
+    class Server
+    {
+    public:
+        Server( const Options& options, const ProgramLoader& loader ):
+            mOptions{ options }, mLoader{ loader }
+        {}
+
+        ~Server()
+        {
+            for( int fd : { mListenFd, mSignalFd, mWakeFd, mEpollFd } )
+                if( fd >= 0 )
+                    close( fd );
+
+            if( mBound && IsSocketFile( mOptions.socketPath ) )
+                unlink( mOptions.socketPath.c_str() );
+        }
+
+        int Run();
+
+    private:
+        void Setup();
+        void Accept();
+        void Read( const SessionPtr& pSession );
+        void Close( SessionPtr pSession );
+        void Flush( Session& session );
+        void Schedule( const SessionPtr& pSession );
+        bool ScheduleLocked( const SessionPtr& pSession );
+        void ResumeKeyWaiters();
+        void Worker();
+        RunStatus RunSlice( Session& session );
+        void PrintStats();
+
+    private:
+        const Options& mOptions;
+        const ProgramLoader& mLoader;
+
+        int mEpollFd = -1;
+        int mListenFd = -1;
+        int mSignalFd = -1;
+        int mWakeFd = -1;                                   // Wakes the event loop up to poll the key waiters
+        bool mBound = false;                                // The socket file is ours
+        unsigned mNextSessionId = 1;
+        std::unordered_map<int, SessionPtr> mSessions;      // Event loop only
+
+        std::mutex mQueueMutex;
+        std::condition_variable mQueueCv;
+        std::deque<SessionPtr> mQueue;
+        std::vector<std::weak_ptr<Session>> mKeyWaiters;
+        bool mStopping = false;
+    };
+
+    void Server::Setup()
+    {
+        if( mOptions.socketPath.size() >= sizeof( sockaddr_un::sun_path ) )
+            throw std::runtime_error( "Socket path is too long" );
+
+        // A socket left by a previous run is replaced
+        if( struct stat st{}; lstat( mOptions.socketPath.c_str(), &st ) == 0 )
+        {
+            if( !S_ISSOCK( st.st_mode ) )
+                throw std::runtime_error( mOptions.socketPath + " exists and isn't a socket" );
+
+            unlink( mOptions.socketPath.c_str() );
+        }
+
+        //Signals are received by the event loop only, the workers inherit the mask
+        sigset_t mask;
+        sigemptyset( &mask );
+        sigaddset( &mask, SIGINT );
+        sigaddset( &mask, SIGTERM );
+        sigaddset( &mask, SIGUSR1 );
+
+        if( pthread_sigmask( SIG_BLOCK, &mask, nullptr ) != 0 )
+            ThrowSystemError( "pthread_sigmask()" );
+
+        if( (mSignalFd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC )) < 0 )
+            ThrowSystemError( "signalfd()" );
+
+        if( (mListenFd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) < 0 )
+            ThrowSystemError( "socket()" );
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        mOptions.socketPath.copy( addr.sun_path, sizeof( addr.sun_path ) - 1 );
+
+        if( bind( mListenFd, reinterpret_cast<const sockaddr*>(&addr), sizeof( addr ) ) != 0 )
+            ThrowSystemError( "bind()" );
+
+        mBound = true;
+
+        if( listen( mListenFd, SOMAXCONN ) != 0 )
+            ThrowSystemError( "listen()" );
+
+        if( (mWakeFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )) < 0 )
+            ThrowSystemError( "eventfd()" );
+
+        if( (mEpollFd = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+            ThrowSystemError( "epoll_create1()" );
+
+        for( int fd : { mListenFd, mSignalFd, mWakeFd } )
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+
+            if( epoll_ctl( mEpollFd, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+                ThrowSystemError( "epoll_ctl()" );
+        }
+    }
+
+    int Server::Run()
+    {
+        Setup();
+
+        const unsigned threadsCount = mOptions.threadsCount != 0 ? mOptions.threadsCount : std::max( 1u, std::thread::hardware_concurrency() );
+
+        std::vector<std::thread> workers;
+
+        for( unsigned i = 0; i < threadsCount; ++i )
+            workers.emplace_back( &Server::Worker, this );
+
+        std::cerr << "Listening on " << mOptions.socketPath << ", " << threadsCount << " worker(s)" << std::endl;
+
+        std::vector<epoll_event> events( 256 );
+        auto nextKeyPoll = std::chrono::steady_clock::now();
+
+        for( bool stop = false; !stop; )
+        {
+            bool keyWaiters = false;
+
+            {
+                const std::lock_guard lock( mQueueMutex );
+                keyWaiters = !mKeyWaiters.empty();
+            }
+
+            const int timeout = keyWaiters ? static_cast<int>(mOptions.inkeyPollPeriod.count()) : -1;
+            const int count = epoll_wait( mEpollFd, events.data(), static_cast<int>(events.size()), timeout );
+
+            if( count < 0 && errno != EINTR )
+                ThrowSystemError( "epoll_wait()" );
+
+            for( int i = 0; i < count; ++i )
+            {
+                const int fd = events[i].data.fd;
+
+                if( fd == mListenFd )
+                {
+                    Accept();
+                    continue;
+                }
+
+                if( fd == mWakeFd )
+                {
+                    eventfd_t value;
+                    eventfd_read( mWakeFd, &value );
+                    continue;
+                }
+
+                if( fd == mSignalFd )
+                {
+                    signalfd_siginfo info{};
+
+                    while( read( mSignalFd, &info, sizeof( info ) ) == sizeof( info ) )
+                    {
+                        if( info.ssi_signo == SIGUSR1 )
+                            PrintStats();
+                        else
+                            stop = true;
+                    }
+
+                    continue;
+                }
+
+                const auto it = mSessions.find( fd );
+
+                if( it == mSessions.end() )
+                    continue;
+
+                const SessionPtr pSession = it->second;
+
+                if( events[i].events & EPOLLOUT )
+                {
+                    const std::lock_guard lock( pSession->ioMutex );
+                    Flush( *pSession );
+
+                    // The output is sent, a session stopped by the worker may continue
+                    if( !pSession->waitingForWrite )
+                    {
+                        bool notify = false;
+
+                        {
+                            const std::lock_guard queueLock( mQueueMutex );
+
+                            if( pSession->stalled )
+                                notify = ScheduleLocked( pSession );
+                        }
+
+                        if( notify )
+                            mQueueCv.notify_one();
+                    }
+                }
+
+                if( events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) )
+                    Read( pSession );
+            }
+
+            if( keyWaiters && std::chrono::steady_clock::now() >= nextKeyPoll )
+            {
+                nextKeyPoll = std::chrono::steady_clock::now() + mOptions.inkeyPollPeriod;
+                ResumeKeyWaiters();
+            }
+        }
+
+        {
+            const std::lock_guard lock( mQueueMutex );
+            mStopping = true;
+        }
+
+        mQueueCv.notify_all();
+
+        for( auto& worker : workers )
+            worker.join();
+
+        PrintStats();
+
+        while( !mSessions.empty() )
+            Close( mSessions.begin()->second );
+
+        return 0;
+    }
+
+    void Server::Accept()
+    {
+        for( ;; )
+        {
+            const int fd = accept4( mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+            if( fd < 0 )
+                return;
+
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+
+            if( epoll_ctl( mEpollFd, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+            {
+                close( fd );
+                continue;
+            }
+
+            auto pSession = std::make_shared<Session>( fd, mNextSessionId++ );
+            mSessions.emplace( fd, pSession );
+
+            // The program is loaded by a worker, so a big one doesn't stall the event loop
+            Schedule( pSession );
+        }
+    }
+
+    void Server::Read( const SessionPtr& pSession )
+    {
+        std::vector<std::string> lines;
+        char buf[4096];
+
+        for( ;; )
+        {
+            const ssize_t size = recv( pSession->fd, buf, sizeof( buf ), 0 );
+
+            if( size == 0 || (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) )
+            {
+                Close( pSession );
+                return;
+            }
+
+            if( size < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+
+                break;
+            }
+
+            pSession->bytesIn += static_cast<uint64_t>(size);
+
+            for( const char c : std::string_view( buf, static_cast<size_t>(size) ) )
+            {
+                if( c == '\n' )
+                {
+                    lines.push_back( std::move( pSession->partialLine ) );
+                    pSession->partialLine.clear();
+                }
+                else if( c != '\r' )
+                    pSession->partialLine += c;
+            }
+        }
+
+        if( lines.empty() )
+            return;
+
+        {
+            const std::lock_guard lock( pSession->ioMutex );
+
+            for( auto& line : lines )
+                pSession->pendingInput.push_back( std::move( line ) );
+        }
+
+        Schedule( pSession );
+    }
+
+    void Server::Close( SessionPtr pSession )
+    {
+        // By value, the reference may point to the map entry being erased
+        {
+            const std::lock_guard lock( pSession->ioMutex );
+
+            if( pSession->fd < 0 )
+                return;
+
+            mSessions.erase( pSession->fd );
+            epoll_ctl( mEpollFd, EPOLL_CTL_DEL, pSession->fd, nullptr );
+            close( pSession->fd );
+            pSession->fd = -1;
+        }
+
+        // A running or queued session is dropped by the worker
+    }
+
+    // ioMutex must be locked
+    void Server::Flush( Session& session )
+    {
+        if( session.fd < 0 )
+            return;
+
+        size_t sent = 0;
+
+        while( sent < session.outBuf.size() )
+        {
+            const ssize_t size = send( session.fd, session.outBuf.data() + sent, session.outBuf.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+            if( size < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+
+                // On errors the event loop gets EPOLLERR or EPOLLHUP and closes the session
+                break;
+            }
+
+            sent += static_cast<size_t>(size);
+        }
+
+        session.bytesOut += sent;
+        session.outBuf.erase( 0, sent );
+
+        const bool waitForWrite = !session.outBuf.empty();
+
+        if( waitForWrite != session.waitingForWrite )
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP | (waitForWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+            ev.data.fd = session.fd;
+
+            epoll_ctl( mEpollFd, EPOLL_CTL_MOD, session.fd, &ev );
+            session.waitingForWrite = waitForWrite;
+        }
+
+        //The client sees EOF after the whole output
+        if( !waitForWrite && session.finished )
+            shutdown( session.fd, SHUT_RDWR );
+    }
+
+    void Server::Schedule( const SessionPtr& pSession )
+    {
+        bool notify = false;
+
+        {
+            const std::lock_guard lock( mQueueMutex );
+            notify = ScheduleLocked( pSession );
+        }
+
+        if( notify )
+            mQueueCv.notify_one();
+    }
+
+    // mQueueMutex must be locked, returns true if a worker should be notified
+    bool Server::ScheduleLocked( const SessionPtr& pSession )
+    {
+        pSession->stalled = false;
+
+        if( pSession->running )
+        {
+            pSession->rerun = true;
+            return false;
+        }
+
+        if( pSession->queued )
+            return false;
+
+        pSession->queued = true;
+        mQueue.push_back( pSession );
+
+        return true;
+    }
+
+    void Server::ResumeKeyWaiters()
+    {
+        std::vector<std::weak_ptr<Session>> keyWaiters;
+
+        {
+            const std::lock_guard lock( mQueueMutex );
+            keyWaiters.swap( mKeyWaiters );
+        }
+
+        for( const auto& pWeak : keyWaiters )
+            if( const auto pSession = pWeak.lock() )
+                Schedule( pSession );
+    }
+
+    void Server::Worker()
+    {
+        for( ;; )
+        {
+            SessionPtr pSession;
+
+            {
+                std::unique_lock lock( mQueueMutex );
+                mQueueCv.wait( lock, [this] { return mStopping || !mQueue.empty(); } );
+
+                if( mStopping )
+                    return;
+
+                pSession = std::move( mQueue.front() );
+                mQueue.pop_front();
+                pSession->queued = false;
+                pSession->running = true;
+            }
+
+            const RunStatus status = RunSlice( *pSession );
+
+            bool notify = false;
+            bool wake = false;
+
+            {
+                // The event loop takes the locks in the same order, so the EPOLLOUT handler
+                // sees either the output sent or the session stalled
+                const std::lock_guard ioLock( pSession->ioMutex );
+                const std::lock_guard lock( mQueueMutex );
+
+                pSession->running = false;
+
+                const bool finished = status == RunStatus::Finished || status == RunStatus::Error;
+
+                if( !finished && status == RunStatus::Yielded && pSession->waitingForWrite )
+                {
+                    // Otherwise a client that doesn't read makes outBuf grow without a limit.
+                    // The input that came meanwhile is taken on the resume.
+                    pSession->stalled = true;
+                }
+                else if( !finished && (status == RunStatus::Yielded || pSession->rerun) )
+                {
+                    // To the end of the queue, so busy sessions share the workers fairly
+                    pSession->queued = true;
+                    mQueue.push_back( pSession );
+                    notify = true;
+                }
+                else if( status == RunStatus::WaitingForKey )
+                {
+                    // The event loop may be blocked without the poll timeout
+                    wake = mKeyWaiters.empty();
+                    mKeyWaiters.push_back( pSession );
+                }
+
+                pSession->rerun = false;
+            }
+
+            if( notify )
+                mQueueCv.notify_one();
+
+            if( wake )
+                eventfd_write( mWakeFd, 1 );
+        }
+    }
+
+    RunStatus Server::RunSlice( Session& session )
+    {
+        const uint64_t startCpuNs = ThreadCpuTimeNs();
+        std::vector<std::string> input;
+
+        {
+            const std::lock_guard lock( session.ioMutex );
+
+            // Closed by the client
+            if( session.fd < 0 )
+                return RunStatus::Finished;
+
+            input.swap( session.pendingInput );
+        }
+
+        auto& runtime = session.runtime;
+        RunStatus status = RunStatus::Yielded;
+
+        // Run() reports only std::runtime_error, the rest, e.g. std::bad_alloc from a huge DIM,
+        // ends this session and not the whole process
+        try
+        {
+            if( !session.loaded )
+            {
+                session.loaded = true;
+
+                if( mLoader( runtime ) )
+                    runtime.Start();
+                else
+                    status = RunStatus::Error;
+            }
+
+            for( auto& line : input )
+                runtime.AddInput( std::move( line ) );
+
+            if( status != RunStatus::Error )
+            {
+                status = runtime.Run( mOptions.stepsPerSlice, std::chrono::steady_clock::now() + mOptions.sliceTime );
+
+                if( status == RunStatus::Error )
+                {
+                    const auto& step = runtime.GetLastStep();
+                    session.out << "\nError in line " << step.line << ": " << step.error << "\n";
+                }
+            }
+        }
+        catch( const std::exception& e )
+        {
+            status = RunStatus::Error;
+            session.out << "\nError: " << e.what() << "\n";
+        }
+
+        std::string output = session.out.str();
+        session.out.str( "" );
+
+        {
+            const std::lock_guard lock( session.ioMutex );
+
+            session.outBuf += output;
+            session.finished = status == RunStatus::Finished || status == RunStatus::Error;
+            Flush( session );
+        }
+
+        session.status = status;
+        session.memory = runtime.GetMemoryUsage() + sizeof( Session );
+        session.cpuNs += ThreadCpuTimeNs() - startCpuNs;
+        ++session.slices;
+
+        return status;
+    }
+
+    void Server::PrintStats()
+    {
+        static constexpr const char* StatusNames[] = { "running", "input", "inkey", "finished", "error" };
+
+        uint64_t totalMemory = 0;
+
+        std::cerr << "session      cpu,ms    slices  bytes in bytes out  memory,KB  status\n";
+
+        for( const auto& [_, pSession] : mSessions )
+        {
+            const auto& s = *pSession;
+            totalMemory += s.memory;
+
+            std::cerr << std::setw( 7 ) << s.id
+                << std::setw( 12 ) << s.cpuNs / 1000000
+                << std::setw( 10 ) << s.slices
+                << std::setw( 10 ) << s.bytesIn
+                << std::setw( 10 ) << s.bytesOut
+                << std::setw( 11 ) << s.memory / 1024
+                << "  " << StatusNames[static_cast<int>(s.status.load())] << '\n';
+        }
+
+        std::cerr << mSessions.size() << " session(s), " << totalMemory / 1024 << " KB" << std::endl;
+    }
+}
+
+int Run( const Options& options, const ProgramLoader& loader )
+{
+    return Server{ options, loader }.Run();
+}
+
+#else
+
+int Run( const Options& options, const ProgramLoader& loader )
+{
+    throw std::runtime_error( "The server mode is available on Linux only" );
+}
+
+#endif
+}
@@ -0,0 +1,38 @@
+#ifndef BASIC_INT_SERVER_H
+#define BASIC_INT_SERVER_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace runtime
+{
+    class Runtime;
+}
+
+// Hosts many sessions of the same program, e.g. text games, in one process.
+// Every connection to a local Unix socket gets its own runtime::Runtime which
+// prints to the connection and reads INPUT and INKEY$ from it. One epoll loop
+// does all the socket I/O, the sessions are executed in time slices by a small
+// pool of workers, so sessions waiting for their users cost no threads.
+namespace server
+{
+    struct Options
+    {
+        std::string socketPath;
+        unsigned threadsCount = 0;                          // 0 - one per core
+        size_t stepsPerSlice = 10000;
+        std::chrono::milliseconds sliceTime{ 10 };
+        std::chrono::milliseconds inkeyPollPeriod{ 50 };    // Resumes sessions polling INKEY$
+    };
+
+    // Loads the program into the runtime of a new session, errors go to runtime.Err()
+    using ProgramLoader = std::function<bool( runtime::Runtime& runtime )>;
+
+    // Serves the connections until SIGINT or SIGTERM. SIGUSR1 prints the counters
+    // of every session (CPU time, slices, traffic and approximate memory) to stderr.
+    // Linux only, throws std::runtime_error on other platforms and on setup errors.
+    int Run( const Options& options, const ProgramLoader& loader );
+}
+
+#endif // BASIC_INT_SERVER_H
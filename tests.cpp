@@ -5,6 +5,30 @@
 
 #include "parse_utils.hpp"
 #include "grammar.h"
+#include "ast.h"
+#include "analysis.h"
+#include "basic_int_api.h"
+#include "loader.h"
+#include "repl.h"
+#include "server.h"
+#include "emit_cpp.h"
+#include "platform.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+#ifdef __linux__
+#include <csignal>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 namespace runtime // Enables ADL for these methods for BOOST_TEST
 {
@@ -67,6 +91,29 @@ BOOST_AUTO_TEST_CASE( expression_test )
     BOOST_TEST( calc( R"(rnd(5) >= 0 and rnd(5) < 5)" ) == 1 );
 }
 
+BOOST_AUTO_TEST_CASE( random_test )
+{
+    // The sequence must not change, recorded inputs depend on it
+    runtime::Random random{ 0 };
+
+    BOOST_TEST( random.NextUInt() == 3918949401u );
+    BOOST_TEST( random.NextUInt() == 3103299678u );
+    BOOST_TEST( random.NextUInt() == 3277025221u );
+
+    random.Seed( 42 );
+
+    BOOST_TEST( random.NextFloat() == 0.347096503f );
+    BOOST_TEST( random.NextFloat() == 0.505316496f );
+
+    // Reseeding drops the rest of the generated block
+    random.Seed( 42 );
+
+    BOOST_TEST( random.NextFloat() == 0.347096503f );
+
+    for( int i = 0; i < 1000; ++i )
+        BOOST_TEST_REQUIRE( runtime::RndImpl( 1.0f, random ) < 1.0f );
+}
+
 BOOST_AUTO_TEST_CASE( line_parser_test )
 {
     runtime::TestExecutorClear calc{ main_pass::statement_rule() };
@@ -118,6 +165,783 @@ BOOST_AUTO_TEST_CASE( line_parser_test )
     BOOST_TEST( calc( R"(DEF FNB(X) = X * X: DEF FNA(Y) = FNB(Y) * 3: PRINT FNA(10);)" ) == "300" );
 
     BOOST_TEST( calc( R"(print "before": for i=1 to 3: print "body": next:print "after")" ) == "before\nbody\nbody\nbody\nafter\n" );
+
+    // Variable names starting with keywords
+    BOOST_TEST( calc( R"(ONE = 1: LENGTH = 2: INTX = 4: print ONE + LENGTH + INTX;)" ) == "7" );
+
+    // Names are case insensitive, re-DIM keeps only the elements out of the new ranges
+    BOOST_TEST( calc( R"(DIM Arr(2, 2): aRR(1, 2) = 7: Arr(5, 5) = 3: DIM arr(1, 1): print ARR(1, 2) + arr(5, 5) + arr(1, 1);)" ) == "10" );
+    BOOST_TEST( calc( R"(for I = 1 to 2: for j = 1 to 2: print i; J;: next J, i)" ) == "11122122" );
+}
+
+BOOST_AUTO_TEST_CASE( function_cache_test )
+{
+    runtime::TestExecutor calc{ main_pass::statement_rule() };
+    auto& runtime = calc.runtime;
+
+    calc( R"(DEF FN D(X) = X * X + 1: DEF FN E(X) = FN D(X) * 2: DEF FN R(X) = INT(RND(1) * X))" );
+    BOOST_TEST( calc( R"(FOR I = 1 TO 10: S = S + FN E(I - INT(I / 3) * 3): NEXT: PRINT S;)" ) == "52" );
+
+    const auto statsD = runtime.GetFunctionCacheStats( "d" );
+    const auto statsE = runtime.GetFunctionCacheStats( "E" );
+
+    BOOST_TEST( statsD.pure );
+    BOOST_TEST( statsD.hits == 0 );
+    BOOST_TEST( statsD.misses == 3 );
+    BOOST_TEST( statsE.pure );
+    BOOST_TEST( statsE.hits == 7 );
+    BOOST_TEST( statsE.misses == 3 );
+    BOOST_TEST( !runtime.GetFunctionCacheStats( "r" ).pure );
+
+    // Redefinition drops the cached results of the dependent functions
+    BOOST_TEST( calc( R"(DEF FN D(X) = X: PRINT FN E(2);)" ) == "4" );
+    BOOST_TEST( runtime.GetFunctionCacheStats( "e" ).pure );
+    calc( R"(DEF FN D(X) = X + RND(1) * 0)" );
+    BOOST_TEST( !runtime.GetFunctionCacheStats( "e" ).pure );
+
+    // Bodies reading globals or arrays depend on more than the argument, they are never cached
+    calc( R"(K = 1: DEF FN K(X) = X * K: DEF FN A(X) = A(X) + X: DEF FN B(X) = FN K(X) + 1)" );
+    BOOST_TEST( !runtime.GetFunctionCacheStats( "k" ).pure );
+    BOOST_TEST( !runtime.GetFunctionCacheStats( "a" ).pure );
+    BOOST_TEST( !runtime.GetFunctionCacheStats( "b" ).pure );
+}
+
+BOOST_AUTO_TEST_CASE( run_budget_test )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    std::istringstream in;
+    std::ostringstream out;
+    runtime::Runtime runtime;
+
+    runtime.SetStreams( in, out, out );
+    runtime.SetBlockingInput( false );
+    runtime.AddLine( 10, R"(PRINT "A";: INPUT "X"; X, Y: PRINT X + Y;)" );
+    runtime.AddLine( 20, "FOR I = 1 TO 3: GOSUB 40: NEXT: END" );
+    runtime.AddLine( 40, "N = N + 1: RETURN" );
+    runtime.Start();
+
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForInput) );
+    runtime.AddFakeInput( "1" );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForInput) );
+    runtime.AddFakeInput( "2" );
+
+    // Every line after a jump is a separate step
+    BOOST_TEST( (runtime.Run( 2 ) == RunStatus::Yielded) );
+    BOOST_TEST( out.str() == "AX? 1\n?? 2\n 3 " );
+    BOOST_TEST( (runtime.Run( 4 ) == RunStatus::Yielded) );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( runtime.Load( { "n" } ) == 3.0f );
+
+    runtime.AddLine( 50, "GOTO 50" );
+    runtime.Goto( 50 );
+    BOOST_TEST( (runtime.Run( 1000, std::chrono::steady_clock::now() + std::chrono::milliseconds( 10 ) ) == RunStatus::Yielded) );
+
+    runtime.AddLine( 60, "PRINT 1 +" );
+    runtime.Goto( 60 );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Error) );
+    BOOST_TEST( runtime.GetLastStep().line == 60u );
+
+    // The input from the host isn't echoed
+    runtime.AddLine( 70, R"(K$ = INKEY$: IF K$ = "" THEN 70)" );
+    runtime.AddLine( 80, R"(INPUT A$: PRINT K$; A$;)" );
+    runtime.Goto( 70 );
+    out.str( "" );
+
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForKey) );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForKey) );
+    runtime.AddInput( "k" );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForInput) );
+    runtime.AddInput( "abc" );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out.str() == "? kabc" );
+
+    // INPUT suspended in THEN branches skips their ELSE parts after the resume, also when
+    // the state goes through a checkpoint
+    runtime.AddLine( 90, R"(Z = 0: IF Z = 0 THEN IF Z < 1 THEN INPUT Z ELSE PRINT "NO" ELSE PRINT "NO")" );
+    runtime.AddLine( 100, "PRINT Z;" );
+    runtime.Goto( 90 );
+    out.str( "" );
+
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForInput) );
+
+    std::stringstream checkpoint;
+    runtime.SaveCheckpoint( checkpoint );
+
+    runtime::Runtime restored;
+    restored.SetStreams( in, out, out );
+    restored.SetBlockingInput( false );
+    restored.SetProgram( runtime.GetSharedProgram() );
+    restored.LoadCheckpoint( checkpoint );
+
+    runtime.AddInput( "5" );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Finished) );
+    restored.AddInput( "6" );
+    BOOST_TEST( (restored.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out.str() == "?  5  6 " );
+
+    // The IF condition is evaluated once, so INKEY$ in it reads one key
+    runtime.AddLine( 110, R"(IF INKEY$ = "a" THEN PRINT "A";)" );
+    runtime.AddLine( 120, "PRINT INKEY$;" );
+    runtime.Goto( 110 );
+    out.str( "" );
+
+    runtime.AddInput( "a" );
+    runtime.AddInput( "b" );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out.str() == "Ab" );
+}
+
+BOOST_AUTO_TEST_CASE( shared_program_test )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    runtime::Runtime loader;
+    loader.AddLine( 10, "READ A: PRINT A;" );
+    loader.AddData( 5 );
+    loader.AddLine( 20, "RESTORE 10: READ A: PRINT A;" );
+
+    const auto pProgram = loader.GetSharedProgram();
+
+    std::istringstream in;
+    std::ostringstream out1, out2;
+    runtime::Runtime runtime1, runtime2;
+
+    runtime1.SetStreams( in, out1, out1 );
+    runtime1.SetProgram( pProgram );
+    runtime1.Start();
+    runtime2.SetStreams( in, out2, out2 );
+    runtime2.SetProgram( pProgram );
+    runtime2.Start();
+
+    // Each runtime has its own variables and DATA cursor
+    BOOST_TEST( (runtime1.Run( 1 ) == RunStatus::Yielded) );
+    BOOST_TEST( (runtime2.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( (runtime1.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out1.str() == " 5  5 " );
+    BOOST_TEST( out2.str() == " 5  5 " );
+
+    // Changing the program of one runtime doesn't affect the others
+    runtime1.AddLine( 30, "PRINT 0" );
+    BOOST_TEST( runtime1.GetProgram().size() == 3u );
+    BOOST_TEST( runtime2.GetProgram().size() == 2u );
+    BOOST_TEST( pProgram->GetLines().size() == 2u );
+    BOOST_TEST( runtime2.GetSharedProgram() == pProgram );
+}
+
+#ifdef __linux__
+namespace
+{
+    // Connects to the Unix socket of the server, retries while the server starts
+    int ConnectToServer( const std::string& path )
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        path.copy( addr.sun_path, sizeof( addr.sun_path ) - 1 );
+
+        for( int attempt = 0; attempt < 500; ++attempt )
+        {
+            const int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+            if( connect( fd, reinterpret_cast<const sockaddr*>(&addr), sizeof( addr ) ) == 0 )
+            {
+                const timeval timeout{ 10, 0 };
+                setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+                return fd;
+            }
+
+            close( fd );
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        }
+
+        return -1;
+    }
+
+    void SendToServer( int fd, std::string_view str )
+    {
+        send( fd, str.data(), str.size(), MSG_NOSIGNAL );
+    }
+
+    // Reads until the server shuts the connection down
+    std::string ReceiveAll( int fd )
+    {
+        std::string res;
+        char buf[256];
+        ssize_t size;
+
+        while( (size = recv( fd, buf, sizeof( buf ), 0 )) > 0 )
+            res.append( buf, static_cast<size_t>(size) );
+
+        return res;
+    }
+}
+
+BOOST_AUTO_TEST_CASE( server_test )
+{
+    using namespace std::chrono;
+
+    runtime::Runtime loader;
+    loader.AddLine( 10, "N = 0: INPUT A$: INPUT B$" );
+    loader.AddLine( 15, R"(IF A$ = "DIM" THEN N = VAL(B$): DIM M(N, N, N))" );
+    loader.AddLine( 20, R"(N = N + 1: IF INKEY$ = "" AND N < 3 THEN 20)" );
+    loader.AddLine( 30, R"(PRINT A$; "-"; B$; N)" );
+
+    // Every session holds the program, so the use count tells how many are alive
+    const auto pProgram = loader.GetSharedProgram();
+    const long idleUseCount = pProgram.use_count();
+
+    server::Options options;
+    options.socketPath = "server_test.sock";
+    options.threadsCount = 2;
+    options.inkeyPollPeriod = milliseconds( 5 );
+
+    std::thread serverThread( [&] {
+        server::Run( options, [&pProgram]( runtime::Runtime& runtime ) {
+            runtime.SetProgram( pProgram );
+            return true;
+        } );
+    } );
+
+    const int fd = ConnectToServer( options.socketPath );
+    BOOST_REQUIRE( fd >= 0 );
+
+    // The lines are split on LF with CR dropped, the unterminated tail isn't sent to
+    // the program. INKEY$ gets no keys, so the session is resumed by the poll timer.
+    SendToServer( fd, "x\r" );
+    std::this_thread::sleep_for( milliseconds( 20 ) );
+    SendToServer( fd, "\ny\nz" );
+    BOOST_TEST( ReceiveAll( fd ) == "? ? x-y 3 \n" );
+    close( fd );
+
+    // A session waiting for INPUT is dropped when the client disconnects
+    const int fdLeft = ConnectToServer( options.socketPath );
+    BOOST_REQUIRE( fdLeft >= 0 );
+
+    char prompt[2] = {};
+    BOOST_TEST( recv( fdLeft, prompt, sizeof( prompt ), MSG_WAITALL ) == 2 );
+    BOOST_TEST( pProgram.use_count() > idleUseCount );
+    close( fdLeft );
+
+    const auto deadline = steady_clock::now() + seconds( 10 );
+
+    while( pProgram.use_count() > idleUseCount && steady_clock::now() < deadline )
+        std::this_thread::sleep_for( milliseconds( 5 ) );
+
+    BOOST_TEST( pProgram.use_count() == idleUseCount );
+
+    // An allocation failure ends only its session
+    const int fdHuge = ConnectToServer( options.socketPath );
+    BOOST_REQUIRE( fdHuge >= 0 );
+
+    SendToServer( fdHuge, "DIM\n1000000\n" );
+    BOOST_TEST( ReceiveAll( fdHuge ) == "? ? \nError: std::bad_alloc\n" );
+    close( fdHuge );
+
+    const int fdNext = ConnectToServer( options.socketPath );
+    BOOST_REQUIRE( fdNext >= 0 );
+
+    SendToServer( fdNext, "a\nb\n" );
+    BOOST_TEST( ReceiveAll( fdNext ) == "? ? a-b 3 \n" );
+    close( fdNext );
+
+    // SIGTERM is blocked in the server thread and read from its signalfd
+    pthread_kill( serverThread.native_handle(), SIGTERM );
+    serverThread.join();
+
+    // Only a socket is replaced at the path
+    std::ofstream( options.socketPath ) << "data";
+    BOOST_CHECK_THROW( server::Run( options, []( runtime::Runtime& ) { return true; } ), std::runtime_error );
+    BOOST_TEST( std::ifstream( options.socketPath ).good() );
+    std::filesystem::remove( options.socketPath );
+}
+#endif
+
+BOOST_AUTO_TEST_CASE( runtime_copy_test )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    std::istringstream in;
+    std::ostringstream out;
+    runtime::Runtime runtime;
+
+    runtime.SetStreams( in, out, out );
+    runtime.SetBlockingInput( false );
+    runtime.AddLine( 10, "DIM A(2): A(1) = 7: R = RND(1): GOSUB 30" );
+    runtime.AddLine( 20, "INPUT X: A(1) = A(1) + X: Z = RND(1): END" );
+    runtime.AddLine( 30, "RETURN" );
+    runtime.Start();
+
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::WaitingForInput) );
+
+    // Both branches continue from the prompt with the same RNG state
+    runtime::Runtime branch = runtime;
+
+    runtime.AddInput( "1" );
+    branch.AddInput( "2" );
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( (branch.Run( 100 ) == RunStatus::Finished) );
+
+    BOOST_TEST( runtime.Load( { "a", { 1 } } ) == runtime::value_t{ 8.0f } );
+    BOOST_TEST( branch.Load( { "a", { 1 } } ) == runtime::value_t{ 9.0f } );
+    BOOST_TEST( runtime.Load( { "Z" } ) == branch.Load( { "z" } ) );
+
+    // Restoring a snapshot
+    branch = runtime;
+    BOOST_TEST( branch.Load( { "A", { 1 } } ) == runtime::value_t{ 8.0f } );
+}
+
+BOOST_AUTO_TEST_CASE( checkpoint_test )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    const auto load = []( runtime::Runtime& runtime, std::istream& in, std::ostream& out ) {
+        runtime.SetStreams( in, out, out );
+        runtime.SetBlockingInput( false );
+        runtime.AddLine( 10, R"(DIM A%(3), B$(1): A%(2) = 5: B$(1) = "x": C(7) = 1.5: DEF FN F(X) = X * 2)" );
+        runtime.AddLine( 20, "FOR I = 1 TO 2: GOSUB 40: NEXT I: READ D: END" );
+        runtime.AddLine( 30, "DATA 3, 4" );
+        runtime.AddData( 3 );
+        runtime.AddData( 4 );
+        runtime.AddLine( 40, R"(INPUT "N"; N: PRINT FN F(N) + A%(2); B$(1); C(7); RND(1);: RETURN)" );
+    };
+
+    std::istringstream in;
+    std::ostringstream out1, out2;
+    runtime::Runtime runtime1, runtime2;
+
+    load( runtime1, in, out1 );
+    load( runtime2, in, out2 );
+    runtime1.Start();
+
+    BOOST_TEST( (runtime1.Run( 100 ) == RunStatus::WaitingForInput) );
+    runtime1.AddInput( "1" );
+    BOOST_TEST( (runtime1.Run( 100 ) == RunStatus::WaitingForInput) );
+
+    std::stringstream checkpoint;
+    runtime1.SaveCheckpoint( checkpoint );
+    runtime2.LoadCheckpoint( checkpoint );
+
+    out1.str( "" );
+    runtime1.AddInput( "2" );
+    runtime2.AddInput( "2" );
+    BOOST_TEST( (runtime1.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( (runtime2.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out2.str() == out1.str() );
+    BOOST_TEST( out2.str().find( " 9 x 1.5 " ) != std::string::npos );
+    BOOST_TEST( runtime2.Load( { "D" } ) == runtime::value_t{ 3.0f } );
+
+    // Another program or a broken file
+    std::ostringstream out3;
+    runtime::Runtime runtime3;
+    runtime3.SetStreams( in, out3, out3 );
+    runtime3.AddLine( 10, "END" );
+
+    std::istringstream checkpoint2{ checkpoint.str() };
+    BOOST_CHECK_THROW( runtime3.LoadCheckpoint( checkpoint2 ), std::runtime_error );
+
+    std::istringstream truncated{ checkpoint.str().substr( 0, checkpoint.str().size() - 1 ) };
+    BOOST_CHECK_THROW( runtime2.LoadCheckpoint( truncated ), std::runtime_error );
+    BOOST_TEST( runtime2.Load( { "D" } ) == runtime::value_t{ 3.0f } );
+}
+
+// DIM takes no memory until the elements are written, copies and checkpoints only get the written pages
+BOOST_AUTO_TEST_CASE( lazy_array_test )
+{
+    constexpr size_t PageSize = 4096;
+
+    std::istringstream in;
+    std::ostringstream out;
+    runtime::Runtime runtime;
+    runtime.SetStreams( in, out, out );
+
+    const size_t emptySize = runtime.GetMemoryUsage();
+
+    runtime.Dim( "m", { 500, 500 } );
+    runtime.Dim( "n%", { 500, 500 } );
+    runtime.Dim( "s$", { 500, 500 } );
+    BOOST_TEST( runtime.GetMemoryUsage() - emptySize < PageSize );
+
+    runtime.Store( { "m", { 250, 250 } }, runtime::value_t{ 1.5f } );
+    runtime.Store( { "n%", { 500, 500 } }, runtime::value_t{ 7.0f } );
+    runtime.Store( { "s$", { 3, 4 } }, runtime::value_t{ "x" } );
+    BOOST_TEST( runtime.GetMemoryUsage() - emptySize < 3 * PageSize );
+
+    BOOST_TEST( runtime.Load( { "m", { 250, 250 } } ) == 1.5f );
+    BOOST_TEST( runtime.Load( { "m", { 499, 1 } } ) == 0.0f );
+    BOOST_TEST( runtime.Load( { "n%", { 500, 500 } } ) == 7 );
+    BOOST_TEST( runtime.Load( { "s$", { 3, 4 } } ) == "x" );
+    BOOST_TEST( runtime.Load( { "s$", { 4, 3 } } ) == "" );
+
+    runtime::Runtime copy = runtime;
+    copy.Store( { "m", { 0, 0 } }, runtime::value_t{ 2.0f } );
+    BOOST_TEST( copy.GetMemoryUsage() - emptySize < 4 * PageSize );
+    BOOST_TEST( copy.Load( { "m", { 250, 250 } } ) == 1.5f );
+    BOOST_TEST( runtime.Load( { "m", { 0, 0 } } ) == 0.0f );
+
+    std::stringstream checkpoint;
+    copy.SaveCheckpoint( checkpoint );
+    runtime.LoadCheckpoint( checkpoint );
+    BOOST_TEST( runtime.GetMemoryUsage() - emptySize < 4 * PageSize );
+    BOOST_TEST( runtime.Load( { "m", { 0, 0 } } ) == 2.0f );
+    BOOST_TEST( runtime.Load( { "n%", { 500, 500 } } ) == 7 );
+    BOOST_TEST( runtime.Load( { "s$", { 3, 4 } } ) == "x" );
+
+    // Re-DIM keeps the written elements out of the new ranges
+    runtime.Dim( "m", { 100, 100 } );
+    runtime.Dim( "s$", { 1 } );
+    BOOST_TEST( runtime.Load( { "m", { 250, 250 } } ) == 1.5f );
+    BOOST_TEST( runtime.Load( { "m", { 0, 0 } } ) == 0.0f );
+    BOOST_TEST( runtime.Load( { "s$", { 3, 4 } } ) == "x" );
+
+    // The size of the numbers must not wrap around, the failed DIM keeps the array
+    BOOST_CHECK_THROW( runtime.Dim( "m", { 1023, 1023, 1023, 1023, 1023, 1023, 1023 } ), std::runtime_error );
+    BOOST_CHECK_THROW( runtime.Dim( "a%", std::vector<runtime::int_t>( 7, 1023 ) ), std::runtime_error );
+    BOOST_TEST( runtime.Load( { "m", { 250, 250 } } ) == 1.5f );
+    BOOST_TEST( out.str().empty() );
+}
+
+BOOST_AUTO_TEST_CASE( program_source_test )
+{
+    auto pText = std::make_shared<const std::string_view>( "10 PRINT 1\r\n20 PRINT 2\n:PRINT 3\n30 DATA 4, \"\", \" A,B \"\n" );
+    const std::string_view text = *pText;
+
+    std::ostringstream err;
+    const auto pProgram = runtime::LoadProgram( pText, err );
+    BOOST_REQUIRE( pProgram );
+
+    const auto& lines = pProgram->GetLines();
+    BOOST_TEST( lines.at( 10 ) == "PRINT 1" );
+    BOOST_TEST( lines.at( 10 ).data() == text.data() + 3 );
+
+    // Only joined lines are copied
+    BOOST_TEST( lines.at( 20 ) == "PRINT 2 : PRINT 3" );
+    BOOST_TEST( (lines.at( 20 ).data() < text.data() || lines.at( 20 ).data() >= text.data() + text.size()) );
+
+    const auto& data = pProgram->GetData();
+    BOOST_TEST( data.size() == 3u );
+    BOOST_TEST( data[0] == 4 );
+    BOOST_TEST( data[1] == runtime::value_t{ runtime::str_t{ "" } } );
+    BOOST_TEST( data[2] == runtime::value_t{ runtime::str_t{ " A,B " } } );
+    BOOST_TEST( (pProgram->FindDataPos( 30 ) == size_t{ 0 }) );
+    BOOST_TEST( !pProgram->FindDataPos( 20 ) );
+
+    // Copy on write keeps the views valid
+    runtime::Runtime runtime;
+    runtime.SetProgram( pProgram );
+    pText.reset();
+    runtime.AddLine( 40, "PRINT 5" );
+    BOOST_TEST( runtime.GetProgram().at( 10 ).data() == text.data() + 3 );
+    BOOST_TEST( runtime.GetProgram().at( 40 ) == "PRINT 5" );
+}
+
+BOOST_AUTO_TEST_CASE( parallel_preparse_test )
+{
+    // Large enough to be split into chunks
+    constexpr int linesCount = 40000;
+    std::string text;
+
+    for( int i = 1; i <= linesCount; ++i )
+    {
+        text += std::to_string( i * 10 ) + " DATA " + std::to_string( i ) + ", \"S\"\n";
+
+        if( i % 1000 == 0 )
+            text += "\n  :PRINT " + std::to_string( i ) + "\n";
+    }
+
+    std::ostringstream err;
+    const auto pProgram = runtime::LoadProgram( std::make_shared<const std::string_view>( text ), err, 4 );
+    BOOST_REQUIRE( pProgram );
+
+    const auto pSequential = runtime::LoadProgram( std::make_shared<const std::string_view>( text ), err, 1 );
+    BOOST_TEST( pProgram->GetHash() == pSequential->GetHash() );
+    BOOST_TEST( (pProgram->GetLineToDataPos() == pSequential->GetLineToDataPos()) );
+
+    const auto& data = pProgram->GetData();
+    BOOST_TEST( pProgram->GetLines().size() == size_t{ linesCount } );
+    BOOST_TEST( data.size() == size_t{ 2 * linesCount } );
+    BOOST_TEST( data[2 * 12344] == 12345 );
+    BOOST_TEST( (pProgram->FindDataPos( 123450 ) == size_t{ 2 * 12344 }) );
+    BOOST_TEST( data[2 * 12344 + 1] == runtime::value_t{ runtime::str_t{ "S" } } );
+    BOOST_TEST( pProgram->GetLines().at( 20000 ) == " : PRINT 2000" );
+
+    // The errors are the same as of the sequential preparse
+    const size_t pos = text.find( "\n300000 " );
+    text.replace( pos, 7, "\n299990" );
+
+    BOOST_TEST( runtime::LoadProgram( std::make_shared<const std::string_view>( text ), err, 4 ) == nullptr );
+    BOOST_TEST( err.str().find( "Line is in the wrong order 299990" ) != std::string::npos );
+}
+
+BOOST_AUTO_TEST_CASE( program_cache_test )
+{
+    const std::string fileName = "program_cache_test.bas";
+    const std::string cacheName = runtime::GetProgramCacheName( fileName );
+    BOOST_TEST( cacheName == "program_cache_test.basc" );
+
+    const auto write = []( const std::string& name, std::string_view text ) {
+        std::ofstream{ name, std::ios::binary | std::ios::trunc } << text;
+    };
+
+    write( fileName, "10 DATA 1, \"A\"\n20 PRINT 1:\n:PRINT 2\n30 DATA 2.5\n" );
+
+    std::ostringstream err;
+    const auto pProgram = runtime::LoadProgramCached( fileName, err );
+    BOOST_REQUIRE( pProgram );
+    BOOST_TEST( std::ifstream{ cacheName }.good() );
+
+    const auto pCached = runtime::LoadProgramCached( fileName, err );
+    BOOST_REQUIRE( pCached );
+    BOOST_TEST( pCached->GetHash() == pProgram->GetHash() );
+    BOOST_TEST( (pCached->GetData() == pProgram->GetData()) );
+    BOOST_TEST( (pCached->GetLineToDataPos() == pProgram->GetLineToDataPos()) );
+
+    // A changed source or a broken cache are preparsed again
+    write( cacheName, "BASICPRG" );
+    BOOST_TEST( runtime::LoadProgramCached( fileName, err )->GetHash() == pProgram->GetHash() );
+
+    write( fileName, "10 PRINT 3\n" );
+    BOOST_TEST( runtime::LoadProgramCached( fileName, err )->GetLines().size() == 1u );
+
+    write( fileName, "20 PRINT 3\n10 END\n" );
+    BOOST_TEST( runtime::LoadProgramCached( fileName, err ) == nullptr );
+    BOOST_TEST( err.str().find( "wrong order" ) != std::string::npos );
+
+    // Writers of the same cache, e.g. under different names of the file, don't share temporary files
+    write( fileName, "10 PRINT 4\n" );
+    std::remove( cacheName.c_str() );
+
+    std::vector<std::thread> threads;
+    std::atomic<int> loaded{ 0 };
+
+    for( int i = 0; i < 4; ++i )
+        threads.emplace_back( [&, i] {
+            std::ostringstream threadErr;
+
+            for( int n = 0; n < 20; ++n )
+                if( runtime::LoadProgramCached( (i % 2 == 0 ? "./" : "") + fileName, threadErr ) )
+                    ++loaded;
+        } );
+
+    for( auto& thread : threads )
+        thread.join();
+
+    BOOST_TEST( loaded == 80 );
+
+    for( const auto& entry : std::filesystem::directory_iterator( "." ) )
+        BOOST_TEST( entry.path().extension() != ".tmp" );
+
+    std::remove( fileName.c_str() );
+    std::remove( cacheName.c_str() );
+}
+
+BOOST_AUTO_TEST_CASE( input_script_test )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    const auto pScript = runtime::MakeSharedText( "HELLO\r\n5\n\nK" );
+
+    std::istringstream in;
+    std::ostringstream out1, out2;
+    runtime::Runtime runtime1, runtime2;
+
+    for( auto* pRuntime : { &runtime1, &runtime2 } )
+    {
+        pRuntime->SetStreams( in, pRuntime == &runtime1 ? out1 : out2, out1 );
+        pRuntime->SetBlockingInput( false );
+        pRuntime->AddLine( 10, "INPUT A$" );
+        pRuntime->AddLine( 20, "INPUT B: INPUT C$" );
+        pRuntime->AddLine( 30, R"(PRINT A$; B; "["; C$; "]"; INKEY$)" );
+        pRuntime->AddFakeInputScript( pScript );
+        pRuntime->Start();
+    }
+
+    // The rest of the script goes to the checkpoint
+    BOOST_TEST( (runtime1.Run( 1 ) == RunStatus::Yielded) );
+    std::stringstream checkpoint;
+    runtime1.SaveCheckpoint( checkpoint );
+
+    BOOST_TEST( (runtime1.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out1.str().find( "HELLO 5 []K\n" ) != std::string::npos );
+
+    runtime2.LoadCheckpoint( checkpoint );
+    BOOST_TEST( (runtime2.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out2.str() == out1.str().substr( out1.str().find( "? 5" ) ) );
+    BOOST_TEST( *pScript == "HELLO\r\n5\n\nK" );
+}
+
+BOOST_AUTO_TEST_CASE( repl_test )
+{
+    std::istringstream in;
+    std::ostringstream out, err;
+    runtime::Runtime runtime;
+    runtime.SetStreams( in, out, err );
+    runtime::Repl repl{ runtime };
+
+    const auto execute = [&]( std::string_view str ) {
+        out.str( {} );
+        return repl.Execute( str );
+    };
+
+    BOOST_TEST( execute( "10 DATA 1, 2" ) );
+    BOOST_TEST( execute( "30 DATA 5" ) );
+    BOOST_TEST( execute( "40 READ A, B, C: PRINT A; B; C" ) );
+    BOOST_TEST( execute( "RUN" ) );
+    BOOST_TEST( out.str() == " 1  2  5 \n" );
+
+    // The DATA of the replaced line and of the one inserted before the others
+    BOOST_TEST( execute( "10 DATA 3" ) );
+    BOOST_TEST( execute( "20 DATA 4" ) );
+    BOOST_TEST( execute( "RUN" ) );
+    BOOST_TEST( out.str() == " 3  4  5 \n" );
+
+    BOOST_TEST( execute( "20" ) );
+    BOOST_TEST( execute( "30 DATA \"X\"" ) );
+    BOOST_TEST( execute( "40 READ A: READ B$: PRINT A; B$" ) );
+    BOOST_TEST( execute( "RUN" ) );
+    BOOST_TEST( out.str() == " 3 X\n" );
+
+    // The variables stay, GOSUB from a direct line comes back to it
+    BOOST_TEST( execute( "100 X = X * 2: RETURN" ) );
+    BOOST_TEST( execute( "X = 5: GOSUB 100: PRINT X" ) );
+    BOOST_TEST( out.str() == " 10 \n" );
+    BOOST_TEST( execute( "PRINT B$" ) );
+    BOOST_TEST( out.str() == "X\n" );
+
+    BOOST_TEST( execute( "LIST 40-" ) );
+    BOOST_TEST( out.str() == "40 READ A: READ B$: PRINT A; B$\n100 X = X * 2: RETURN\n" );
+
+    BOOST_TEST( !execute( "GOTO 20" ) );
+    BOOST_TEST( !execute( "99999999999999999999 PRINT" ) );
+    BOOST_TEST( !execute( "RUN 20" ) );
+
+    BOOST_TEST( execute( "NEW" ) );
+    BOOST_TEST( execute( "LIST" ) );
+    BOOST_TEST( out.str().empty() );
+    BOOST_TEST( runtime.GetData().empty() );
+}
+
+BOOST_AUTO_TEST_CASE( patch_line_test )
+{
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    std::istringstream in{
+        "10 FOR I = 1 TO 2: READ D\n"
+        "20 GOSUB 100: PRINT \"A\"; D\n"
+        "30 NEXT I\n"
+        "40 READ E: PRINT E: END\n"
+        "100 PRINT \"S\";: RETURN\n"
+        "200 DATA 5, 6\n"
+    };
+
+    std::ostringstream out;
+    runtime::Runtime runtime;
+    runtime.SetStreams( in, out, out );
+    BOOST_REQUIRE( runtime::Preparse( in, runtime ) );
+    runtime.Start();
+
+    // Inside the subroutine, D was read
+    BOOST_TEST( (runtime.Run( 2 ) == RunStatus::Yielded) );
+    const runtime::Runtime copy = runtime;
+
+    const auto patch = [&runtime]( std::string_view str ) {
+        runtime::linenum_t line = 0;
+        runtime::Program part;
+
+        BOOST_TEST( runtime::PreparseLine( str, line, part, std::cerr ) );
+        runtime.PatchLine( line, std::move( part ) );
+    };
+
+    // RETURN comes back after GOSUB, the text before it is the same. NEXT goes after
+    // FOR, the first statement of the line, though its text has changed. READ continues
+    // with the second item.
+    patch( R"(20 GOSUB 100: PRINT "B"; D)" );
+    patch( R"(100 PRINT "T";: RETURN)" );
+    patch( "10 FOR I=1 TO 2: READ D" );
+    patch( "200 DATA 7, 8, 9" );
+    patch( "35 PRINT \"C\"" );
+
+    BOOST_TEST( (runtime.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out.str() == "TB 5 \nTB 8 \nC\n 9 \n" );
+    BOOST_TEST( copy.GetProgram().at( 100 ) == R"(PRINT "S";: RETURN)" );
+    BOOST_TEST( (runtime.GetData()[0] == 7) );
+
+    // Separators inside strings don't count, a statement that is gone continues the next line
+    std::istringstream subIn{ "10 PRINT 1;: GOSUB 100: PRINT 2;\n20 PRINT 3: END\n100 RETURN\n" };
+    out.str( "" );
+
+    runtime::Runtime sub;
+    sub.SetStreams( subIn, out, out );
+    BOOST_REQUIRE( runtime::Preparse( subIn, sub ) );
+    sub.Start();
+    BOOST_TEST( (sub.Run( 1 ) == RunStatus::Yielded) );
+
+    runtime::Runtime subCopy = sub;
+    runtime::linenum_t line = 0;
+    runtime::Program part;
+
+    BOOST_TEST( runtime::PreparseLine( R"(10 PRINT ":";:GOSUB 100 : PRINT 4;)", line, part, std::cerr ) );
+    sub.PatchLine( line, std::move( part ) );
+    BOOST_TEST( runtime::PreparseLine( "10 PRINT 5;", line, part, std::cerr ) );
+    subCopy.PatchLine( line, std::move( part ) );
+
+    BOOST_TEST( (sub.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( (subCopy.Run( 100 ) == RunStatus::Finished) );
+    BOOST_TEST( out.str() == " 1  4  3 \n 3 \n" );
+}
+
+BOOST_AUTO_TEST_CASE( c_api_test )
+{
+    const std::string_view text = "10 INPUT A$\n20 PRINT \"HI \"; A$\n30 GOTO 100\n";
+
+    std::string errors;
+    const auto append = []( void* pUserData, const char* szText, size_t size ) {
+        static_cast<std::string*>(pUserData)->append( szText, size );
+    };
+
+    BOOST_TEST( basic_load_program( "10 PRINT\n5 END\n", 16, append, &errors ) == nullptr );
+    BOOST_TEST( errors.find( "wrong order" ) != std::string::npos );
+
+    basic_program* pProgram = basic_load_program( text.data(), text.size(), append, &errors );
+    BOOST_REQUIRE( pProgram );
+
+    basic_session* pSession = basic_create_session( pProgram, nullptr, nullptr );
+    basic_free_program( pProgram );
+
+    const auto getOutput = [pSession]() {
+        size_t size = 0;
+        const char* szText = basic_get_output( pSession, &size );
+        return std::string( szText, size );
+    };
+
+    BOOST_TEST( basic_run( pSession, 100, 0 ) == BASIC_WAITING_FOR_INPUT );
+    BOOST_TEST( getOutput() == "? " );
+
+    // Resuming INPUT is the first step
+    basic_push_input( pSession, "BOB", 3 );
+    BOOST_TEST( basic_run( pSession, 2, 0 ) == BASIC_YIELDED );
+    BOOST_TEST( getOutput() == "HI BOB\n" );
+
+    unsigned long long line = 0;
+    BOOST_TEST( basic_run( pSession, 100, 10 ) == BASIC_ERROR );
+    BOOST_TEST( *basic_last_error( pSession, &line ) != '\0' );
+    BOOST_TEST( line == 30u );
+    basic_free_session( pSession );
+
+    // Output to a callback
+    std::string output;
+    pProgram = basic_load_program( text.data(), text.size(), nullptr, nullptr );
+    pSession = basic_create_session( pProgram, append, &output );
+    basic_push_input( pSession, "ANN", 3 );
+    BOOST_TEST( basic_run( pSession, 2, 0 ) == BASIC_YIELDED );
+    BOOST_TEST( output == "? HI ANN\n" );
+
+    // Line 30 fails in the first session, this one is fixed
+    BOOST_TEST( basic_patch_line( pSession, "X", 1 ) == 0 );
+    BOOST_TEST( basic_patch_line( pSession, "30 PRINT \"BYE\"", 14 ) == 1 );
+    BOOST_TEST( basic_run( pSession, 100, 0 ) == BASIC_FINISHED );
+    BOOST_TEST( output == "? HI ANN\nBYE\n" );
+    basic_free_session( pSession );
+    basic_free_program( pProgram );
 }
 
 BOOST_AUTO_TEST_CASE( ListAllArrayElements )
@@ -149,8 +973,220 @@ BOOST_AUTO_TEST_CASE( ListAllArrayElements )
     BOOST_TEST( calc({2, 0, 4}) == 15 );
 }
 
-void RunTests( const char *szPath)
+BOOST_AUTO_TEST_CASE( ast_test )
+{
+    static constexpr auto count = []( std::string_view str )
+    {
+        return ast::ParseLine( 100, str ).statements.size();
+    };
+
+    BOOST_TEST( count( "" ) == 0 );
+    BOOST_TEST( count( "PRINT 1;2: GOTO 100" ) == 2 );
+    BOOST_TEST( count( "IF A THEN PRINT 1 ELSE IF B THEN 200 : PRINT 3" ) == 2 );
+    BOOST_TEST( count( "FOR I = 1 TO 10 STEP 2: NEXT I: DEF FN A(X) = X * X" ) == 3 );
+    BOOST_TEST( count( "ONE = 1: LENGTH = INTX + ONE: rem : TEXT" ) == 3 );
+
+    const auto line = ast::ParseLine( 100, R"(A$ = LEFT$("abc", 2) + STR$(LEN("x")): B% = 1.5 * 2)" );
+    const auto& assign = std::get<ast::Assign>( *line.statements[1] );
+
+    BOOST_TEST( (assign.var.type == runtime::ValueType::Int) );
+    BOOST_TEST( (assign.value->type == runtime::ValueType::Float) );
+
+    BOOST_CHECK_THROW( ast::ParseLine( 100, "A = \"x\"" ), std::runtime_error );
+    BOOST_CHECK_THROW( ast::ParseLine( 100, "PRINT LEN(1)" ), std::runtime_error );
+    BOOST_CHECK_THROW( ast::ParseLine( 100, "PRINT 1 +" ), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( static_check_test )
+{
+    using Kind = analysis::Diagnostic::Kind;
+
+    std::istringstream in{
+        "10 INPUT N: IF N > 0 THEN A = 1 ELSE GOSUB 100\n"
+        "20 PRINT A + B: GOSUB 200: PRINT C\n"
+        "30 FOR I = 1 TO N: D(I) = I: NEXT I: PRINT I\n"
+        "40 IF N > 5 THEN 60\n"
+        "50 DIM E(10), D(20): PRINT E(1)\n"
+        "60 E(N) = D(N): END\n"
+        "70 PRINT F\n"
+        "100 A = 2: RETURN\n"
+        "200 IF N THEN C = 1: RETURN\n"
+        "210 C = 2: RETURN\n"
+    };
+
+    std::ostringstream out;
+    runtime::Runtime runtime;
+    runtime.SetStreams( in, out, out );
+    BOOST_REQUIRE( runtime::Preparse( in, runtime ) );
+
+    // A is assigned on both IF branches, C on every path of the subroutine. Line 70
+    // is never reached.
+    const std::vector<analysis::Diagnostic> expected{
+        { Kind::UninitializedVar, 20, "b" },
+        { Kind::ArrayBeforeDim, 30, "d" },
+        { Kind::ArrayBeforeDim, 60, "d" },
+        { Kind::ArrayBeforeDim, 60, "e" },
+    };
+
+    const auto diagnostics = analysis::AnalyzeProgram( ast::ParseProgram( runtime ) );
+    BOOST_TEST( (diagnostics == expected) );
+
+    std::ostringstream report;
+    analysis::PrintDiagnostics( diagnostics, report );
+    BOOST_TEST( report.str().find( "20\tVariable may be used before initialization: b\n" ) == 0 );
+
+    // The reported accesses are silent, the element out of the DIM range isn't
+    runtime.SetStaticallyChecked( true );
+    runtime.AddInput( "3" );
+    runtime.Start();
+    BOOST_TEST( (runtime.Run( 100 ) == runtime::Runtime::RunStatus::Finished) );
+    BOOST_TEST( out.str().find( "WARNING" ) == std::string::npos );
+
+    runtime.Dim( "g", { 2 } );
+    runtime.Load( { "g", { 3 } } );
+    runtime.Load( { "h" } );
+    BOOST_TEST( out.str().find( "WARNING: Access var before init: g(3)" ) != std::string::npos );
+    BOOST_TEST( out.str().find( "h," ) == std::string::npos );
+
+    // A FN call reads what the bodies of the function read, except the argument
+    std::istringstream fnIn{
+        "10 DEF FN F(X) = X * K + FN G(X)\n"
+        "20 DEF FN G(Y) = Y + M(1) + FN F(Y)\n"
+        "30 PRINT FN F(2): K = 1\n"
+    };
+
+    runtime::Runtime fnRuntime;
+    fnRuntime.SetStreams( fnIn, out, out );
+    BOOST_REQUIRE( runtime::Preparse( fnIn, fnRuntime ) );
+
+    const std::vector<analysis::Diagnostic> fnExpected{
+        { Kind::UninitializedVar, 30, "k" },
+        { Kind::ArrayBeforeDim, 30, "m" },
+    };
+
+    BOOST_TEST( (analysis::AnalyzeProgram( ast::ParseProgram( fnRuntime ) ) == fnExpected) );
+}
+
+// Launches the CLI built next to the tests with a one line program, the cold start is
+// a large part of the CPU time of short invocations
+BOOST_AUTO_TEST_CASE( startup_benchmark )
+{
+    namespace fs = std::filesystem;
+    using namespace std::chrono;
+
+    const auto& suite = boost::unit_test::framework::master_test_suite();
+    fs::path exePath = fs::absolute( suite.argv[0] ).parent_path() / "basic_int";
+
+#ifdef _WIN32
+    exePath += ".exe";
+#endif
+
+    if( !fs::exists( exePath ) )
+    {
+        BOOST_TEST_MESSAGE( "Skipped, the executable is not found: " << exePath );
+        return;
+    }
+
+    const std::string fileName = "startup_benchmark.bas";
+    std::ofstream{ fileName, std::ios::trunc } << "10 PRINT 1\n";
+
+#ifdef _WIN32
+    // cmd.exe strips the outer quotes
+    const std::string cmd = "\"\"" + exePath.string() + "\" " + fileName + " < NUL > NUL\"";
+#else
+    const std::string cmd = "\"" + exePath.string() + "\" " + fileName + " < /dev/null > /dev/null";
+#endif
+
+    constexpr int RunsCount = 20;
+    const auto start = steady_clock::now();
+
+    for( int i = 0; i < RunsCount; ++i )
+        BOOST_REQUIRE( std::system( cmd.c_str() ) == 0 );
+
+    const double time = duration<double, std::milli>( steady_clock::now() - start ).count() / RunsCount;
+    BOOST_TEST_MESSAGE( "Startup time: " << time << " ms" );
+
+    std::remove( fileName.c_str() );
+}
+
+// Builds the C++ translations of a few listings with the compiler of the system and
+// compares their output with the interpreter, FOR/NEXT, GOSUB, DEF FN and the fake input
+// go through both implementations
+BOOST_AUTO_TEST_CASE( emit_cpp_test )
 {
-    const char* rgBootTestArgs[] = { szPath, "--log_level=test_suite" };
-    boost::unit_test::unit_test_main( init_unit_test, (int)std::size( rgBootTestArgs ), const_cast<char**>(rgBootTestArgs) );
+#ifdef _WIN32
+    BOOST_TEST_MESSAGE( "Skipped, the test builds with a Unix command line compiler" );
+#else
+    namespace fs = std::filesystem;
+    using RunStatus = runtime::Runtime::RunStatus;
+
+    const fs::path srcPath = fs::absolute( __FILE__ ).parent_path();
+    const char* szCxx = std::getenv( "CXX" );
+    const std::string cxx = szCxx ? szCxx : "c++";
+
+    if( std::system( (cxx + " --version > /dev/null 2>&1").c_str() ) != 0 || !fs::exists( srcPath / "programs" ) )
+    {
+        BOOST_TEST_MESSAGE( "Skipped, no compiler or the listings are not found" );
+        return;
+    }
+
+    const std::pair<std::string, std::string> listings[] = {
+        { "unit_tests", "" },
+        { "amazing", "amazing.input" },
+    };
+
+    for( const auto& [name, inputName] : listings )
+    {
+        const std::string basName = (srcPath / "programs" / (name + ".bas")).string();
+        const std::string inputPath = inputName.empty() ? "" : (srcPath / "programs" / inputName).string();
+
+        std::istringstream noInput;
+        std::ostringstream out;
+        std::ostringstream err;
+        runtime::Runtime runtime;
+        runtime.SetStreams( noInput, out, err );
+        BOOST_REQUIRE( runtime::Preparse( MapFile( basName.c_str() ), runtime ) );
+
+        const std::string cppName = "emit_cpp_test_" + name + ".cpp";
+        const std::string binName = "emit_cpp_test_" + name;
+        const std::string outName = binName + ".txt";
+
+        {
+            std::ofstream flOut{ cppName, std::ios::trunc };
+            codegen::EmitCpp( ast::ParseProgram( runtime ), flOut );
+        }
+
+        if( !inputPath.empty() )
+            runtime.AddFakeInputScript( MapFile( inputPath.c_str() ) );
+
+        runtime.Start();
+        BOOST_TEST( (runtime.Run( std::numeric_limits<size_t>::max() ) == RunStatus::Finished) );
+
+        std::string cmd = cxx + " -std=c++17 -I\"" + srcPath.string() + "\" " + cppName;
+
+        for( const char* szSource : { "native_runtime.cpp", "value.cpp", "platform.cpp" } )
+            cmd += " \"" + (srcPath / szSource).string() + "\"";
+
+        BOOST_REQUIRE_MESSAGE( std::system( (cmd + " -o " + binName).c_str() ) == 0, "Failed to build " << cppName );
+        BOOST_REQUIRE( std::system( ("./" + binName + " " + inputPath + " < /dev/null > " + outName + " 2> /dev/null").c_str() ) == 0 );
+
+        std::ifstream flNative{ outName, std::ios::binary };
+        const std::string native{ std::istreambuf_iterator<char>{ flNative }, std::istreambuf_iterator<char>{} };
+        BOOST_TEST( native == out.str(), name );
+
+        for( const auto& fileName : { cppName, binName, outName } )
+            std::remove( fileName.c_str() );
+    }
+#endif
+}
+
+int main( int argc, char* argv[] )
+{
+    // The suite names are printed unless other options are given
+    const char* rgBootTestArgs[] = { argv[0], "--log_level=test_suite" };
+
+    if( argc <= 1 )
+        return boost::unit_test::unit_test_main( init_unit_test, (int)std::size( rgBootTestArgs ), const_cast<char**>(rgBootTestArgs) );
+
+    return boost::unit_test::unit_test_main( init_unit_test, argc, argv );
 }
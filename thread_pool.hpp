@@ -0,0 +1,99 @@
+#ifndef BASIC_INT_THREAD_POOL_H
+#define BASIC_INT_THREAD_POOL_H
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace runtime
+{
+    // Calls task(i) for every i in [0, tasksCount) on threadsCount threads and waits
+    // for all of them. The tasks are spread between per-thread queues upfront, every
+    // thread takes tasks from the front of its own queue and steals from the back of
+    // the others when its queue is empty. No tasks are added later, so a thread stops
+    // when it finds all queues empty. The first exception is rethrown to the caller.
+    template<class TaskFncT>
+    void RunParallel( size_t tasksCount, unsigned threadsCount, TaskFncT&& task )
+    {
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        threadsCount = static_cast<unsigned>(std::clamp<size_t>( threadsCount, 1, std::max<size_t>( tasksCount, 1 ) ));
+
+        std::deque<Queue> queues( threadsCount );
+
+        for( size_t i = 0; i < tasksCount; ++i )
+            queues[i % threadsCount].tasks.push_back( i );
+
+        std::mutex errorMutex;
+        std::exception_ptr pError;
+
+        const auto popTask = [&queues, threadsCount]( unsigned self ) -> std::optional<size_t> {
+            for( unsigned i = 0; i < threadsCount; ++i )
+            {
+                auto& queue = queues[(self + i) % threadsCount];
+                const std::lock_guard lock( queue.mutex );
+
+                if( queue.tasks.empty() )
+                    continue;
+
+                size_t res = 0;
+
+                if( i == 0 )
+                {
+                    res = queue.tasks.front();
+                    queue.tasks.pop_front();
+                }
+                else
+                {
+                    res = queue.tasks.back();
+                    queue.tasks.pop_back();
+                }
+
+                return res;
+            }
+
+            return std::nullopt;
+        };
+
+        const auto worker = [&]( unsigned self ) {
+            while( const auto idx = popTask( self ) )
+            {
+                try
+                {
+                    task( *idx );
+                }
+                catch( ... )
+                {
+                    const std::lock_guard lock( errorMutex );
+
+                    if( !pError )
+                        pError = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve( threadsCount - 1 );
+
+        for( unsigned i = 1; i < threadsCount; ++i )
+            threads.emplace_back( worker, i );
+
+        worker( 0 );
+
+        for( auto& thread : threads )
+            thread.join();
+
+        if( pError )
+            std::rethrow_exception( pError );
+    }
+}
+
+#endif // BASIC_INT_THREAD_POOL_H
@@ -2,6 +2,9 @@
 
 #include <boost/algorithm/string/replace.hpp>
 #include <sstream>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
 namespace runtime
 {
@@ -27,6 +30,24 @@ std::ostream& operator<<( std::ostream& os, const value_t& v )
     return os;
 }
 
+ValueType DetectVarType( std::string_view name )
+{
+    if( name.empty() )
+        throw std::runtime_error( "variable name cannot be empty" );
+
+    for( char c : name )
+    {
+        switch( c )
+        {
+        case '$': return ValueType::Str;
+        case '%': return ValueType::Int;
+        case '(': return ValueType::Float;
+        }
+    }
+
+    return ValueType::Float;
+}
+
 float_t ForceFloat( const value_t& v )
 {
     struct Impl
@@ -104,4 +125,96 @@ str_t ToStrImpl( const value_t& v )
     return boost::apply_visitor( Impl{}, v );
 }
 
+str_t SubStrImpl( const str_t& str, int_t pos, int_t count )
+{
+    --pos;
+
+    if( pos < 0 )
+        pos = 0;
+    else if( static_cast<size_t>(pos) > str.size() )
+        return str_t{};
+
+    return str.substr( pos, count );
+}
+
+str_t RightImpl( const str_t& str, int_t count )
+{
+    return SubStrImpl( str, static_cast<int_t>(str.length()) - count + 1, count );
+}
+
+float_t ValImpl( const str_t& str )
+{
+    char* ending = nullptr;
+    const float_t res = std::strtof( str.c_str(), &ending );
+
+    return *ending == '\0' ? res : float_t{ 0 };
+}
+
+int_t IntImpl( float_t val )
+{
+    if( val < 0 )
+        val -= 0.5f;
+
+    return static_cast<int_t>(val);
+}
+
+int_t AscImpl( const str_t& str )
+{
+    if( str.empty() )
+        throw std::runtime_error( "Illegal ASC() call" );
+
+    return int_t{ str[0] };
+}
+
+void Random::Seed( uint64_t seed )
+{
+    for( size_t i = 0; i < mState.size(); i += 2 )
+    {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        z ^= z >> 31;
+
+        mState[i] = static_cast<uint32_t>(z);
+        mState[i + 1] = static_cast<uint32_t>(z >> 32);
+    }
+
+    mBlockPos = mBlock.size();
+}
+
+uint32_t Random::NextUInt()
+{
+    const auto rotl = []( uint32_t x, int k ) { return (x << k) | (x >> (32 - k)); };
+
+    const uint32_t res = mState[0] + mState[3];
+    const uint32_t t = mState[1] << 9;
+
+    mState[2] ^= mState[0];
+    mState[3] ^= mState[1];
+    mState[1] ^= mState[2];
+    mState[0] ^= mState[3];
+    mState[2] ^= t;
+    mState[3] = rotl( mState[3], 11 );
+
+    return res;
+}
+
+void Random::GenerateBlock()
+{
+    // The lower bits of xoshiro128+ are weak, and 24 bits fit into float exactly
+    for( auto& v : mBlock )
+        v = static_cast<float_t>(NextUInt() >> 8) * (1.0f / (1 << 24));
+
+    mBlockPos = 0;
+}
+
+float_t RndImpl( float_t val, Random& random )
+{
+    if( val <= FLT_EPSILON )
+        throw std::runtime_error( "Only positive arguments of RND are supported" );
+
+    // The product may be rounded up to val itself
+    return std::min( val * random.NextFloat(), std::nextafter( val, 0.0f ) );
+}
+
 }
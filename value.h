@@ -3,6 +3,10 @@
 
 #include <boost/config/warning_disable.hpp>
 #include <boost/spirit/home/x3/support/ast/variant.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
 
 namespace runtime
 {
@@ -42,6 +46,8 @@ namespace runtime
 
     std::ostream& operator<<( std::ostream& os, const value_t& v );
 
+    ValueType DetectVarType( std::string_view name );
+
     // "All arithmetic operations are done in floating point.No matter what
     //  the operands to + , -, *, / , and^ are, they will be converted to floating
     //  point.The functions SIN, COS, ATN, TAN, SQR, LOG, EXPand RND also
@@ -64,6 +70,74 @@ namespace runtime
     bool ToBoolImpl( const value_t& v );
 
     str_t ToStrImpl( const value_t& v );
+
+    str_t SubStrImpl( const str_t& str, int_t pos, int_t count = -1 );
+
+    str_t RightImpl( const str_t& str, int_t count );
+
+    float_t ValImpl( const str_t& str );
+
+    int_t IntImpl( float_t val );
+
+    int_t AscImpl( const str_t& str );
+
+    // RND source with the same sequence on every platform: xoshiro128+ 1.0
+    // (https://prng.di.unimi.it/xoshiro128plus.c) with the state initialized
+    // from the RANDOMIZE seed by two outputs of splitmix64, each split into two
+    // 32-bit words, low word first. Every number is the upper 24 bits of the
+    // output divided by 2^24. The numbers are generated in blocks, so RND in a tight loop is
+    // mostly a load from the buffer.
+    class Random
+    {
+    public:
+        explicit Random( uint64_t seed = 0 )
+        {
+            Seed( seed );
+        }
+
+        void Seed( uint64_t seed );
+
+        uint32_t NextUInt();
+
+        // Uniformly distributed in [0, 1)
+        float_t NextFloat()
+        {
+            if( mBlockPos == mBlock.size() )
+                GenerateBlock();
+
+            return mBlock[mBlockPos++];
+        }
+
+        // The complete generator including the unused part of the block, for checkpoints
+        struct State
+        {
+            std::array<uint32_t, 4> words;
+            std::array<float_t, 64> block;
+            uint32_t blockPos;
+        };
+
+        State GetState() const
+        {
+            return { mState, mBlock, static_cast<uint32_t>(mBlockPos) };
+        }
+
+        void SetState( const State& state )
+        {
+            mState = state.words;
+            mBlock = state.block;
+            mBlockPos = std::min<size_t>( state.blockPos, mBlock.size() );
+        }
+
+    private:
+        void GenerateBlock();
+
+    private:
+        std::array<uint32_t, 4> mState{};
+        std::array<float_t, 64> mBlock{};
+        size_t mBlockPos = 0;
+    };
+
+    float_t RndImpl( float_t val, Random& random );
 }
 
 